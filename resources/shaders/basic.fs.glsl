@@ -4,12 +4,14 @@ in vec3 out_position;
 in vec2 out_uv_coord;
 in vec3 out_normal;
 
-uniform sampler2D diffuse;
+// Textures are packed into arrays (see TextureArrays); 'diffuse_layer' picks this mesh's.
+uniform sampler2DArray diffuse;
+uniform float          diffuse_layer;
 
 out vec4 FragColor;
 
 void main()
 {
-    vec4 color = texture(diffuse, out_uv_coord);
+    vec4 color = texture(diffuse, vec3(out_uv_coord, diffuse_layer));
     FragColor  = color;
 }
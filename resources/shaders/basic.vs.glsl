@@ -4,17 +4,24 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec2 uv_coord;
 layout (location = 2) in vec3 normal;
 
-uniform mat4 model;
+// Per instance (see InstanceBuffer), or the same for the whole draw (see SetModelMatrix).
+layout (location = 3) in mat4 model;
+
 uniform mat4 view;
 uniform mat4 projection;
 
+// Packed meshes store positions in [0, 1] relative to their bounds. Identity (0, 1) for unpacked meshes.
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
 out vec3 out_position;
 out vec2 out_uv_coord;
 out vec3 out_normal;
 
 void main()
 {
-    out_position = vec3(model * vec4(position, 1.0f));
+    vec3 local   = position_offset + position_scale * position;
+    out_position = vec3(model * vec4(local, 1.0f));
     out_uv_coord = uv_coord;
 
     out_normal = vec3(model * vec4(normal, 0.0f));
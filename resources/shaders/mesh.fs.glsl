@@ -0,0 +1,16 @@
+#version 330 core
+
+in vec3 out_position;
+in vec2 out_uv_coord;
+in vec3 out_normal;
+
+// For renderers that bind a plain 2D texture per mesh, like main2's Renderer3D. basic.fs.glsl samples texture arrays.
+uniform sampler2D diffuse;
+
+out vec4 FragColor;
+
+void main()
+{
+    vec4 color = texture(diffuse, out_uv_coord);
+    FragColor  = color;
+}
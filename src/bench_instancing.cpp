@@ -0,0 +1,224 @@
+// Draws a grid of cubes sharing one mesh, first with a draw call per cube and then as a single instanced draw, and
+// compares draw calls and frame times. Needs a display for its (hidden) window. Run from the build directory.
+//
+//   bench_instancing [--cubes 100000] [--frames 100] [--csv results.csv]
+//
+// 'submit' is the CPU time to build the model matrices and issue the draws; 'frame' also waits for the GPU to finish.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "gpu.h"
+#include "model.h"
+#include "shader.h"
+#include "texture.h"
+#include "utils.h"
+
+
+constexpr int   BENCH_WARMUP_FRAMES = 10;
+constexpr float CUBE_SPACING        = 3.0f;
+
+
+// Counted by the glad debug callback.
+static usize draw_calls = 0;
+
+static void CountDrawCalls(const char* name, void* function, int argument_count, ...)
+{
+    (void) function;
+    (void) argument_count;
+    if (std::strncmp(name, "glDraw", 6) == 0 || std::strncmp(name, "glMultiDraw", 11) == 0)
+        draw_calls += 1;
+}
+
+
+enum class Path { PER_CUBE, INSTANCED, COUNT };
+static const char* const PATH_NAMES[] = { "per cube", "instanced" };
+
+struct Result
+{
+    double submit_ms  = 0.0;    // Average per frame.
+    double frame_ms   = 0.0;    // Average per frame.
+    usize  draw_calls = 0;      // Per frame.
+};
+
+
+// The cubes spin a little each frame, so the matrices have to be rebuilt like they would be for moving entities.
+static void BuildModels(std::vector<mat4>& models, const std::vector<vec3>& positions, float time)
+{
+    models.resize(positions.size());
+    for (usize i = 0; i < positions.size(); ++i)
+    {
+        mat4 model = glm::translate(mat4(1.0f), positions[i]);
+        model = glm::rotate(model, time + float(i % 16), vec3(0.0f, 1.0f, 0.0f));
+        models[i] = glm::scale(model, vec3(0.5f));
+    }
+}
+
+static Result RunPath(Path path, const Mesh& cube, const std::vector<vec3>& positions, int frames)
+{
+    std::vector<mat4> models;
+    InstanceBuffer    instances;
+
+    Result result;
+    for (int frame = -BENCH_WARMUP_FRAMES; frame < frames; ++frame)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const usize draws_before = draw_calls;
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glBindVertexArray(cube.id);
+
+        BuildModels(models, positions, float(frame) * 0.01f);
+        if (path == Path::PER_CUBE)
+        {
+            for (const auto& model : models)
+            {
+                SetModelMatrix(model);
+                DrawMesh(cube);
+            }
+        }
+        else
+        {
+            instances.upload(models.data(), models.size());
+            instances.bind(0);
+            DrawMeshInstanced(cube, GLsizei(models.size()));
+        }
+
+        const auto submitted = std::chrono::steady_clock::now();
+        glFinish();
+        const auto finished  = std::chrono::steady_clock::now();
+        EndGpuFrame();
+
+        if (frame < 0)
+            continue;
+        result.submit_ms += std::chrono::duration<double, std::milli>(submitted - start).count();
+        result.frame_ms  += std::chrono::duration<double, std::milli>(finished  - start).count();
+        result.draw_calls = draw_calls - draws_before;
+    }
+
+    result.submit_ms /= double(frames);
+    result.frame_ms  /= double(frames);
+    return result;
+}
+
+
+int main(int argc, char* argv[])
+{
+    usize cubes  = 100000;
+    int   frames = 100;
+    std::string csv_path;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument = argv[i];
+        if (argument == "--cubes" && i + 1 < argc)
+            cubes = usize(std::strtoull(argv[++i], nullptr, 10));
+        else if (argument == "--frames" && i + 1 < argc)
+            frames = std::max(1, std::atoi(argv[++i]));
+        else if (argument == "--csv" && i + 1 < argc)
+            csv_path = argv[++i];
+    }
+
+    if (!glfwInit())
+    {
+        std::fprintf(stderr, "Couldn't initialize GLFW.\n");
+        return 1;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(1280, 720, "bench_instancing", nullptr, nullptr);
+    if (!window)
+    {
+        std::fprintf(stderr, "Couldn't create a window. Is there a display?\n");
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress))
+    {
+        std::fprintf(stderr, "Couldn't load OpenGL.\n");
+        glfwTerminate();
+        return 1;
+    }
+    glad_set_pre_callback(CountDrawCalls);
+
+    int result = 0;
+    {
+        MeshArena     geometry;
+        TextureArrays textures;
+        const auto cube    = CreateMesh(geometry, Cube::VERTICES, Cube::UV_COORDS, Cube::NORMALS, sizeof(Cube::VERTICES) / sizeof(*Cube::VERTICES));
+        const auto texture = textures.add(Image::empty());
+        auto shader = CreateShader("Basic", LoadFileToString("../resources/shaders/basic.vs.glsl").get(), LoadFileToString("../resources/shaders/basic.fs.glsl").get());
+
+        // A square grid, seen from above one corner.
+        const auto side = usize(std::ceil(std::sqrt(double(cubes))));
+        std::vector<vec3> positions(cubes);
+        for (usize i = 0; i < cubes; ++i)
+            positions[i] = vec3(float(i % side), 0.0f, -float(i / side)) * CUBE_SPACING;
+
+        const float extent = float(side) * CUBE_SPACING;
+        const mat4  view   = glm::lookAt(vec3(-0.1f * extent, 0.3f * extent, 0.1f * extent), vec3(0.5f * extent, 0.0f, -0.5f * extent), vec3(0.0f, 1.0f, 0.0f));
+        const mat4  projection = glm::perspective(glm::radians(80.0f), 1280.0f / 720.0f, 0.1f, 4.0f * extent);
+
+        glViewport(0, 0, 1280, 720);
+        glEnable(GL_DEPTH_TEST);
+        glClearColor(0.073f, 0.073f, 0.073f, 1.0f);
+
+        glUseProgram(shader.id);
+        SetUniform(shader, UNIFORM("view"), view);
+        SetUniform(shader, UNIFORM("projection"), projection);
+        SetUniform(shader, UNIFORM("position_offset"), cube.quantization.offset);
+        SetUniform(shader, UNIFORM("position_scale"),  cube.quantization.scale);
+        SetTextureArray(shader, UNIFORM("diffuse"), 0, texture.array);
+        glUniform1f(GetUniformLocation(shader, UNIFORM("diffuse_layer")), GLfloat(texture.layer));
+
+        Result results[usize(Path::COUNT)];
+        for (usize path = 0; path < usize(Path::COUNT); ++path)
+            results[path] = RunPath(Path(path), cube, positions, frames);
+
+        std::printf("\n%zu cubes, %d frames\n", cubes, frames);
+        for (usize path = 0; path < usize(Path::COUNT); ++path)
+            std::printf("  %-9s %8zu draw calls %9.3f ms submit %9.3f ms frame\n", PATH_NAMES[path],
+                        results[path].draw_calls, results[path].submit_ms, results[path].frame_ms);
+        const auto& per_cube  = results[usize(Path::PER_CUBE)];
+        const auto& instanced = results[usize(Path::INSTANCED)];
+        if (instanced.submit_ms > 0.0 && instanced.frame_ms > 0.0)
+            std::printf("  instanced submits %.1fx and finishes frames %.1fx as fast.\n", per_cube.submit_ms / instanced.submit_ms, per_cube.frame_ms / instanced.frame_ms);
+
+        if (!csv_path.empty())
+        {
+            FILE* csv = std::fopen(csv_path.data(), "w");
+            if (csv)
+            {
+                std::fprintf(csv, "path,cubes,frames,draw_calls,submit_ms,frame_ms\n");
+                for (usize path = 0; path < usize(Path::COUNT); ++path)
+                    std::fprintf(csv, "%s,%zu,%d,%zu,%.4f,%.4f\n", PATH_NAMES[path], cubes, frames, results[path].draw_calls, results[path].submit_ms, results[path].frame_ms);
+                std::fclose(csv);
+            }
+            else
+            {
+                std::fprintf(stderr, "Couldn't open '%s'.\n", csv_path.data());
+                result = 1;
+            }
+        }
+
+        glUseProgram(0);
+        DeleteShader(&shader);
+    }
+    FlushGpuReleases();
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return result;
+}
@@ -0,0 +1,318 @@
+// Measures the loader on the repo's own models: parsing from source (ParseScene), loading the cooked scene (LoadScene),
+// LoadAsset and decoding the texture maps (Image::from_path). Each stage runs in a child process so its peak RSS and
+// allocations are its own. Run from the build directory, or pass the .obj files (or directories of them) to load.
+//
+//   bench_loader [--csv results.csv] [file.obj | directory ...]
+//
+// The scenes are cooked into a temporary directory (removed afterwards), so the cooked files in the tree are left alone.
+//
+// The CSV has one row per model and stage, so the output of two commits can be diffed directly.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cook.h"
+#include "loader.h"
+#include "utils.h"
+
+
+constexpr int BENCH_REPETITIONS = 3;
+
+static const char* const DEFAULT_MODELS[] = {
+    "../resources/models/cube.obj",
+    "../resources/models/torus.obj",
+    "../resources/models/simple_scene.obj",
+    "../resources/models/sponza/sponza.obj",
+    "../resources/models/Great Hall/Great Hall Model.obj",
+    "../resources/models/kenney_holidaykit_2/Models/OBJ format",
+};
+
+
+// Every allocation in the process goes through here.
+static std::atomic<usize> allocations     = 0;
+static std::atomic<usize> allocated_bytes = 0;
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+void  operator delete(void* memory) noexcept              { std::free(memory); }
+void  operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+
+
+enum class Stage { PARSE, LOAD, ASSET, IMAGES, COUNT };
+static const char* const STAGE_NAMES[] = { "parse", "load", "asset", "images" };
+
+// What a stage produced, for the per vertex numbers.
+struct Output
+{
+    usize vertices  = 0;
+    usize triangles = 0;
+    usize bytes     = 0;    // Geometry, or decoded pixels.
+};
+
+// Sent from the child process back to the parent.
+struct Result
+{
+    bool   ran             = false;
+    double seconds         = 0.0;
+    usize  allocations     = 0;
+    usize  allocated_bytes = 0;
+    Output output          = {};
+};
+
+
+static Output Measure(const SoftwareScene& scene)
+{
+    Output output;
+    for (const auto& mesh : scene.meshes)
+    {
+        output.vertices  += mesh.vertex_count;
+        output.triangles += (mesh.index_count ? mesh.index_count : mesh.vertex_count) / 3;
+        output.bytes     += mesh.vertex_count * sizeof(Vertex) + mesh.index_count * usize(mesh.index_type);
+    }
+    return output;
+}
+
+static Output RunStage(Stage stage, const std::vector<std::string>& files)
+{
+    Output total;
+    for (const auto& file : files)
+    {
+        const auto directory = std::filesystem::path(file).parent_path().string() + "/";
+
+        Output output;
+        switch (stage)
+        {
+            case Stage::PARSE:
+            {
+                // Texture maps are benchmarked on their own.
+                std::vector<MaterialMapRequest> maps;
+                output = Measure(ParseScene(file, directory, &maps));
+            } break;
+            case Stage::LOAD:
+            {
+                std::vector<MaterialMapRequest> maps;
+                output = Measure(LoadScene(file, directory, &maps));
+            } break;
+            case Stage::ASSET:
+            {
+                const auto asset = LoadAsset(file, directory);
+                output.vertices  = asset.vertices.size();
+                output.triangles = asset.indices.size() / 3;
+                output.bytes     = asset.vertices.size() * sizeof(Vertex) + asset.indices.size() * sizeof(u32);
+            } break;
+            case Stage::IMAGES:
+            {
+                // Names are known without decoding anything once the scene is cooked.
+                std::vector<MaterialMapRequest> maps;
+                const auto scene = LoadScene(file, directory, &maps);
+
+                std::unordered_set<std::string> seen;
+                for (const auto& map : maps)
+                {
+                    if (!seen.insert(map.name).second)
+                        continue;
+                    const auto image = Image::from_path(map.name, directory);
+                    output.bytes += image.size();
+                }
+            } break;
+            case Stage::COUNT:
+                break;
+        }
+
+        total.vertices  += output.vertices;
+        total.triangles += output.triangles;
+        total.bytes     += output.bytes;
+    }
+    return total;
+}
+
+
+// Runs 'stage' in a child process. Returns its result and peak resident set size in kilobytes.
+static Result RunIsolated(Stage stage, const std::vector<std::string>& files, usize& peak_rss_kb)
+{
+    int channel[2];
+    if (pipe(channel) != 0)
+        return {};
+
+    std::fflush(stdout);
+    std::fflush(stderr);
+    const pid_t child = fork();
+    if (child == 0)
+    {
+        close(channel[0]);
+
+        Result result;
+        result.ran     = true;
+        result.seconds = 1e30;
+        for (int i = 0; i < BENCH_REPETITIONS; ++i)
+        {
+            const usize allocations_before = allocations;
+            const usize bytes_before       = allocated_bytes;
+
+            const auto start  = std::chrono::steady_clock::now();
+            const auto output = RunStage(stage, files);
+            const auto stop   = std::chrono::steady_clock::now();
+
+            result.seconds = std::min(result.seconds, std::chrono::duration<double>(stop - start).count());
+            if (i == 0)
+            {
+                result.allocations     = allocations     - allocations_before;
+                result.allocated_bytes = allocated_bytes - bytes_before;
+                result.output          = output;
+            }
+        }
+
+        const bool sent = write(channel[1], &result, sizeof(result)) == ssize(sizeof(result));
+        close(channel[1]);
+
+        // _exit doesn't flush, and stdout is fully buffered when it's a pipe.
+        std::fflush(stdout);
+        std::fflush(stderr);
+        _exit(sent ? 0 : 1);
+    }
+
+    close(channel[1]);
+
+    Result result;
+    const bool received = child > 0 && read(channel[0], &result, sizeof(result)) == ssize(sizeof(result));
+    close(channel[0]);
+
+    int status = 0;
+    rusage usage = {};
+    if (child > 0)
+        wait4(child, &status, 0, &usage);
+
+#if defined(__APPLE__)
+    peak_rss_kb = usize(usage.ru_maxrss) / 1024;    // Bytes on macOS.
+#else
+    peak_rss_kb = usize(usage.ru_maxrss);
+#endif
+
+    return received ? result : Result {};
+}
+
+
+// A directory stands for all the .obj files in it.
+static std::vector<std::string> ModelFiles(const std::string& path)
+{
+    std::vector<std::string> files;
+    std::error_code error;
+    if (std::filesystem::is_directory(path, error))
+    {
+        for (const auto& entry : std::filesystem::directory_iterator(path, error))
+            if (entry.path().extension() == ".obj")
+                files.push_back(entry.path().string());
+        std::sort(files.begin(), files.end());
+    }
+    else if (GetFileInfo(path).exists)
+    {
+        files.push_back(path);
+    }
+    return files;
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::string csv_path;
+    std::vector<std::string> models;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--csv" && i + 1 < argc)
+            csv_path = argv[++i];
+        else
+            models.emplace_back(argv[i]);
+    }
+    if (models.empty())
+        models.assign(std::begin(DEFAULT_MODELS), std::end(DEFAULT_MODELS));
+
+    FILE* csv = nullptr;
+    if (!csv_path.empty())
+    {
+        csv = std::fopen(csv_path.data(), "w");
+        if (!csv)
+        {
+            std::fprintf(stderr, "Couldn't open '%s'.\n", csv_path.data());
+            return 1;
+        }
+        std::fprintf(csv, "model,stage,ms,peak_rss_kb,allocations,allocated_kb,vertices,triangles,bytes,bytes_per_vertex\n");
+    }
+
+    std::error_code error;
+    const auto cooked_directory = std::filesystem::temp_directory_path(error) / ("bench_loader-" + std::to_string(getpid()));
+    SetCookedDirectory(cooked_directory.string());
+
+    int result = 0;
+    std::vector<std::string> lines;
+    for (const auto& model : models)
+    {
+        const auto files = ModelFiles(model);
+        if (files.empty())
+        {
+            lines.push_back(model + ": missing, skipped.");
+            continue;
+        }
+
+        const auto name = std::filesystem::path(model).filename().string();
+        lines.push_back(name + " (" + std::to_string(files.size()) + " file(s))");
+
+        // Cook first, so 'load' measures loading the cooked scene rather than parsing it.
+        usize ignored = 0;
+        RunIsolated(Stage::LOAD, files, ignored);
+
+        for (int s = 0; s < int(Stage::COUNT); ++s)
+        {
+            usize peak_rss_kb = 0;
+            const auto stage  = RunIsolated(Stage(s), files, peak_rss_kb);
+            if (!stage.ran)
+            {
+                lines.push_back(std::string("  ") + STAGE_NAMES[s] + ": FAILED");
+                result = 1;
+                continue;
+            }
+
+            const auto&  output       = stage.output;
+            const double milliseconds = stage.seconds * 1000.0;
+            const double per_vertex   = output.vertices ? double(output.bytes) / double(output.vertices) : 0.0;
+            const usize  allocated_kb = stage.allocated_bytes / 1024;
+
+            char line[256];
+            std::snprintf(line, sizeof(line), "  %-7s %9.2f ms %8zu KB peak %9zu allocs %9zu KB allocated %8zu KB out %8zu vertices %6.2f B/vertex",
+                          STAGE_NAMES[s], milliseconds, peak_rss_kb, stage.allocations, allocated_kb, output.bytes / 1024, output.vertices, per_vertex);
+            lines.emplace_back(line);
+
+            if (csv)
+                std::fprintf(csv, "\"%s\",%s,%.3f,%zu,%zu,%zu,%zu,%zu,%zu,%.2f\n", name.data(), STAGE_NAMES[s], milliseconds,
+                             peak_rss_kb, stage.allocations, allocated_kb, output.vertices, output.triangles, output.bytes, per_vertex);
+        }
+    }
+
+    // The loader logs as it goes, so the summary comes last.
+    std::printf("\n");
+    for (const auto& line : lines)
+        std::printf("%s\n", line.data());
+
+    if (csv)
+        std::fclose(csv);
+
+    std::filesystem::remove_all(cooked_directory, error);
+    return result;
+}
@@ -0,0 +1,149 @@
+// Compares ParseObj against tinyobj::ObjReader: checks that both give the same result and prints the throughput of
+// each, for 1, 2, 4, ... threads. Run from the build directory, or pass the .obj files to parse.
+//
+//   bench_obj [file.obj ...]
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "obj.h"
+#include "utils.h"
+
+
+constexpr int BENCH_REPETITIONS = 5;
+
+static const char* const DEFAULT_FILES[] = {
+    "../resources/models/sponza/sponza.obj",
+    "../resources/models/Great Hall/Great Hall Model.obj",
+};
+
+
+template <typename T>
+static bool SameBytes(const std::vector<T>& a, const std::vector<T>& b)
+{
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+static bool SameIndices(const std::vector<tinyobj::index_t>& a, const std::vector<tinyobj::index_t>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (std::size_t i = 0; i < a.size(); ++i)
+        if (a[i].vertex_index != b[i].vertex_index || a[i].normal_index != b[i].normal_index || a[i].texcoord_index != b[i].texcoord_index)
+            return false;
+    return true;
+}
+
+// Returns what differs, or nullptr if nothing does.
+static const char* Compare(const tinyobj::ObjReader& reader, const ObjContents& obj)
+{
+    const auto& attrib = reader.GetAttrib();
+    if (!SameBytes(attrib.vertices,  obj.attrib.vertices))  return "positions";
+    if (!SameBytes(attrib.normals,   obj.attrib.normals))   return "normals";
+    if (!SameBytes(attrib.texcoords, obj.attrib.texcoords)) return "texcoords";
+    if (!SameBytes(attrib.colors,    obj.attrib.colors))    return "colors";
+
+    if (reader.Warning() != obj.warning) return "warnings";
+    if (reader.Error()   != obj.error)   return "errors";
+
+    const auto& materials = reader.GetMaterials();
+    if (materials.size() != obj.materials.size())
+        return "material count";
+    for (std::size_t i = 0; i < materials.size(); ++i)
+        if (materials[i].name != obj.materials[i].name || materials[i].diffuse_texname != obj.materials[i].diffuse_texname)
+            return "materials";
+
+    const auto& shapes = reader.GetShapes();
+    if (shapes.size() != obj.shapes.size())
+        return "shape count";
+    for (std::size_t i = 0; i < shapes.size(); ++i)
+    {
+        const auto& a = shapes[i];
+        const auto& b = obj.shapes[i];
+        if (a.name != b.name)                                               return "shape names";
+        if (!SameIndices(a.mesh.indices, b.mesh.indices))                   return "face indices";
+        if (!SameBytes(a.mesh.num_face_vertices, b.mesh.num_face_vertices)) return "face sizes";
+        if (!SameBytes(a.mesh.material_ids, b.mesh.material_ids))           return "face materials";
+        if (!SameBytes(a.mesh.smoothing_group_ids, b.mesh.smoothing_group_ids)) return "smoothing groups";
+        if (!SameIndices(a.lines.indices, b.lines.indices))                 return "lines";
+        if (!SameIndices(a.points.indices, b.points.indices))               return "points";
+    }
+    return nullptr;
+}
+
+
+// Best of a few runs, in seconds.
+template <typename Function>
+static double Time(Function&& function)
+{
+    double best = 1e30;
+    for (int i = 0; i < BENCH_REPETITIONS; ++i)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        const auto stop  = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(stop - start).count());
+    }
+    return best;
+}
+
+static void Report(const char* name, usize threads, double seconds, double megabytes, double baseline)
+{
+    std::printf("  %-10s %3zu thread(s) %9.2f ms %9.2f MB/s %6.2fx\n", name, threads, seconds * 1000.0, megabytes / seconds, baseline / seconds);
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i)
+        files.emplace_back(argv[i]);
+    if (files.empty())
+        files.assign(std::begin(DEFAULT_FILES), std::end(DEFAULT_FILES));
+
+    const usize hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    int result = 0;
+    for (const auto& file : files)
+    {
+        const auto info = GetFileInfo(file);
+        if (!info.exists)
+        {
+            std::printf("%s: missing, skipped.\n", file.data());
+            continue;
+        }
+
+        const double megabytes = double(info.size) / (1024.0 * 1024.0);
+        std::printf("%s (%.2f MB)\n", file.data(), megabytes);
+
+        // Both read the materials next to the file.
+        tinyobj::ObjReader reader;
+        const double baseline = Time([&]() { reader = {}; reader.ParseFromFile(file); });
+        Report("tinyobj", 1, baseline, megabytes, baseline);
+
+        for (usize threads = 1; ; threads = std::min(threads * 2, hardware_threads))
+        {
+            // The calling thread does its share of the work.
+            ThreadPool pool(threads - 1);
+
+            ObjContents obj;
+            const double seconds = Time([&]() { obj = {}; ParseObj(file, "", obj, pool); });
+            Report("ParseObj", threads, seconds, megabytes, baseline);
+
+            if (const char* difference = Compare(reader, obj))
+            {
+                std::printf("  MISMATCH: %s differ from tinyobj.\n", difference);
+                result = 1;
+            }
+
+            if (threads == hardware_threads)
+                break;
+        }
+    }
+
+    return result;
+}
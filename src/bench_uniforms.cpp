@@ -0,0 +1,153 @@
+// Measures the CPU cost of finding a draw's uniform locations: by name through the shader's map, like SetUniform did
+// before, against by hashed id through its flat table. Only the lookups are timed, so it needs no window.
+//
+//   bench_uniforms [--draws 1000000] [--csv results.csv]
+//
+// 'mesh' finds the six uniforms main.cpp sets per draw with basic.vs.glsl. 'batch' finds Renderer2D's six samplers,
+// by building "texture" + std::to_string(i) like its flush did before.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "shader.h"
+
+
+constexpr int BENCH_REPETITIONS = 5;
+
+static const char* const MESH_UNIFORMS[] = { "view", "projection", "position_offset", "position_scale", "diffuse", "diffuse_layer" };
+static const GLenum      MESH_TYPES[]    = { GL_FLOAT_MAT4, GL_FLOAT_MAT4, GL_FLOAT_VEC3, GL_FLOAT_VEC3, GL_SAMPLER_2D_ARRAY, GL_FLOAT };
+constexpr int BATCH_TEXTURES = 6;
+
+
+enum class Case { MESH_BY_NAME, MESH_BY_ID, BATCH_BY_NAME, BATCH_BY_ID, COUNT };
+static const char* const CASE_NAMES[] = { "mesh, by name", "mesh, by id", "batch, by name", "batch, by id" };
+
+
+// What GetUniformLocation did before uniforms were hashed.
+static GLint FindByName(const Shader& shader, const char* name)
+{
+    const auto& it = shader.uniforms.find(name);
+    return (it != shader.uniforms.end()) ? it->second.index : -1;
+}
+
+// Like CreateShader would, but without a program.
+static Shader MakeShader(const char* name, const char* const* uniform_names, const GLenum* types, int count)
+{
+    std::unordered_map<std::string, UniformInfo> uniforms;
+    for (int i = 0; i < count; ++i)
+        uniforms[uniform_names[i]] = UniformInfo{ 1, types[i], GLint(i), nullptr };
+
+    auto program_name = std::make_unique<GLchar[]>(std::strlen(name) + 1);
+    std::strcpy(program_name.get(), name);
+
+    Shader shader(0, std::move(program_name), {}, std::move(uniforms), {});
+    BuildUniformTable(&shader);
+    return shader;
+}
+
+// Returns the sum of the locations, so none of the lookups can be left out.
+static long RunCase(Case test, const Shader& mesh, const Shader& batch, long draws)
+{
+    long sum = 0;
+    for (long draw = 0; draw < draws; ++draw)
+    {
+        switch (test)
+        {
+            case Case::MESH_BY_NAME:
+                for (const auto name : MESH_UNIFORMS)
+                    sum += FindByName(mesh, name);
+                break;
+            case Case::MESH_BY_ID:
+                sum += GetUniformLocation(mesh, UNIFORM("view"));
+                sum += GetUniformLocation(mesh, UNIFORM("projection"));
+                sum += GetUniformLocation(mesh, UNIFORM("position_offset"));
+                sum += GetUniformLocation(mesh, UNIFORM("position_scale"));
+                sum += GetUniformLocation(mesh, UNIFORM("diffuse"));
+                sum += GetUniformLocation(mesh, UNIFORM("diffuse_layer"));
+                break;
+            case Case::BATCH_BY_NAME:
+                for (int i = 0; i < BATCH_TEXTURES; ++i)
+                {
+                    const auto texture = std::string("texture") + std::to_string(i);
+                    sum += batch.uniforms.at(texture).index;
+                }
+                break;
+            case Case::BATCH_BY_ID:
+            {
+                static constexpr UniformId TEXTURE_UNIFORMS[BATCH_TEXTURES] = {
+                    UNIFORM("texture0"), UNIFORM("texture1"), UNIFORM("texture2"),
+                    UNIFORM("texture3"), UNIFORM("texture4"), UNIFORM("texture5"),
+                };
+                for (const auto& uniform : TEXTURE_UNIFORMS)
+                    sum += GetUniformLocation(batch, uniform);
+                break;
+            }
+            case Case::COUNT:
+                break;
+        }
+    }
+    return sum;
+}
+
+
+int main(int argc, char* argv[])
+{
+    long draws = 1000000;
+    std::string csv_path;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument = argv[i];
+        if (argument == "--draws" && i + 1 < argc)
+            draws = std::max(1L, std::atol(argv[++i]));
+        else if (argument == "--csv" && i + 1 < argc)
+            csv_path = argv[++i];
+    }
+
+    const char* batch_names[BATCH_TEXTURES] = { "texture0", "texture1", "texture2", "texture3", "texture4", "texture5" };
+    GLenum      batch_types[BATCH_TEXTURES];
+    std::fill(batch_types, batch_types + BATCH_TEXTURES, GLenum(GL_SAMPLER_2D));
+
+    const auto mesh  = MakeShader("basic", MESH_UNIFORMS, MESH_TYPES, int(sizeof(MESH_UNIFORMS) / sizeof(*MESH_UNIFORMS)));
+    const auto batch = MakeShader("batch", batch_names, batch_types, BATCH_TEXTURES);
+
+    // Best of a few runs, in nanoseconds per draw.
+    double results[usize(Case::COUNT)];
+    long   checksum = 0;
+    for (usize test = 0; test < usize(Case::COUNT); ++test)
+    {
+        results[test] = 1e300;
+        for (int repetition = 0; repetition < BENCH_REPETITIONS; ++repetition)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            checksum += RunCase(Case(test), mesh, batch, draws);
+            const auto end   = std::chrono::steady_clock::now();
+            results[test] = std::min(results[test], std::chrono::duration<double, std::nano>(end - start).count() / double(draws));
+        }
+    }
+
+    std::printf("\n%ld draws (checksum %ld)\n", draws, checksum);
+    for (usize test = 0; test < usize(Case::COUNT); ++test)
+        std::printf("  %-15s %8.2f ns per draw\n", CASE_NAMES[test], results[test]);
+    std::printf("  by id is %.1fx as fast for mesh and %.1fx for batch.\n",
+                results[usize(Case::MESH_BY_NAME)]  / results[usize(Case::MESH_BY_ID)],
+                results[usize(Case::BATCH_BY_NAME)] / results[usize(Case::BATCH_BY_ID)]);
+
+    if (!csv_path.empty())
+    {
+        FILE* csv = std::fopen(csv_path.data(), "w");
+        if (!csv)
+        {
+            std::fprintf(stderr, "Couldn't open '%s'.\n", csv_path.data());
+            return 1;
+        }
+        std::fprintf(csv, "case,draws,ns_per_draw\n");
+        for (usize test = 0; test < usize(Case::COUNT); ++test)
+            std::fprintf(csv, "%s,%ld,%.4f\n", CASE_NAMES[test], draws, results[test]);
+        std::fclose(csv);
+    }
+    return 0;
+}
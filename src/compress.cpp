@@ -0,0 +1,525 @@
+#include "compress.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "maths.h"
+
+
+usize BlockSize(BlockFormat format)
+{
+    return (format == BlockFormat::BC1 || format == BlockFormat::BC4) ? 8 : 16;
+}
+
+GLenum GetGLFormat(BlockFormat format)
+{
+    switch (format)
+    {
+        case BlockFormat::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BlockFormat::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BlockFormat::BC4: return GL_COMPRESSED_RED_RGTC1;
+        case BlockFormat::BC5: return GL_COMPRESSED_RG_RGTC2;
+    }
+    return 0;
+}
+
+bool GetBlockFormat(GLenum gl_format, BlockFormat& format)
+{
+    for (auto candidate : { BlockFormat::BC1, BlockFormat::BC3, BlockFormat::BC4, BlockFormat::BC5 })
+    {
+        if (GetGLFormat(candidate) == gl_format)
+        {
+            format = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+usize CompressedSize(BlockFormat format, int width, int height)
+{
+    return usize((width + 3) / 4) * usize((height + 3) / 4) * BlockSize(format);
+}
+
+
+BlockFormat ChooseBlockFormat(const u8* pixels, int width, int height, int channels)
+{
+    if (channels == 1)
+        return BlockFormat::BC4;
+    if (channels == 2)
+        return BlockFormat::BC5;
+    if (channels == 3)
+        return BlockFormat::BC1;
+
+    const usize count = usize(width) * usize(height);
+    for (usize i = 0; i < count; ++i)
+        if (pixels[4 * i + 3] != 255)
+            return BlockFormat::BC3;
+    return BlockFormat::BC1;
+}
+
+
+// ---- ENCODING ----
+
+static u16 To565(const vec3& color)
+{
+    const int r = std::clamp(int(color.r * (31.0f / 255.0f) + 0.5f), 0, 31);
+    const int g = std::clamp(int(color.g * (63.0f / 255.0f) + 0.5f), 0, 63);
+    const int b = std::clamp(int(color.b * (31.0f / 255.0f) + 0.5f), 0, 31);
+    return u16((r << 11) | (g << 5) | b);
+}
+
+static vec3 From565(u16 color)
+{
+    const int r = (color >> 11) & 31;
+    const int g = (color >>  5) & 63;
+    const int b = (color >>  0) & 31;
+    return vec3(f32((r << 3) | (r >> 2)), f32((g << 2) | (g >> 4)), f32((b << 3) | (b >> 2)));
+}
+
+// Picks the closest of the four colors between 'c0' and 'c1' for each pixel. Returns the packed indices.
+static u32 FitColorIndices(const vec3 colors[16], u16 c0, u16 c1, f32& error)
+{
+    const vec3 a = From565(c0);
+    const vec3 b = From565(c1);
+    const vec3 palette[4] = { a, b, (2.0f * a + b) / 3.0f, (a + 2.0f * b) / 3.0f };
+
+    u32 indices = 0;
+    error = 0.0f;
+    for (int i = 0; i < 16; ++i)
+    {
+        int best          = 0;
+        f32 best_distance = 1e30f;
+        for (int j = 0; j < 4; ++j)
+        {
+            const vec3 difference = colors[i] - palette[j];
+            const f32  distance   = glm::dot(difference, difference);
+            if (distance < best_distance)
+            {
+                best_distance = distance;
+                best          = j;
+            }
+        }
+        indices |= u32(best) << (2 * i);
+        error   += best_distance;
+    }
+    return indices;
+}
+
+// Endpoints that minimize the squared error for the given indices.
+static bool RefineColorEndpoints(const vec3 colors[16], u32 indices, vec3& a, vec3& b)
+{
+    static const f32 WEIGHT_OF_A[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+    f32  aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    vec3 ax = vec3(0.0f), bx = vec3(0.0f);
+    for (int i = 0; i < 16; ++i)
+    {
+        const f32 alpha = WEIGHT_OF_A[(indices >> (2 * i)) & 3];
+        const f32 beta  = 1.0f - alpha;
+        aa += alpha * alpha;
+        ab += alpha * beta;
+        bb += beta  * beta;
+        ax += alpha * colors[i];
+        bx += beta  * colors[i];
+    }
+
+    const f32 determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f)
+        return false;
+
+    a = glm::clamp((bb * ax - ab * bx) / determinant, 0.0f, 255.0f);
+    b = glm::clamp((aa * bx - ab * ax) / determinant, 0.0f, 255.0f);
+    return true;
+}
+
+static void EncodeColorBlock(const vec3 colors[16], u8* out)
+{
+    // Endpoints at the extremes of the principal axis of the colors.
+    vec3 mean = vec3(0.0f);
+    vec3 min  = colors[0];
+    vec3 max  = colors[0];
+    for (int i = 0; i < 16; ++i)
+    {
+        mean += colors[i];
+        min   = glm::min(min, colors[i]);
+        max   = glm::max(max, colors[i]);
+    }
+    mean /= 16.0f;
+
+    f32 covariance[6] = {};
+    for (int i = 0; i < 16; ++i)
+    {
+        const vec3 d = colors[i] - mean;
+        covariance[0] += d.r * d.r;
+        covariance[1] += d.r * d.g;
+        covariance[2] += d.r * d.b;
+        covariance[3] += d.g * d.g;
+        covariance[4] += d.g * d.b;
+        covariance[5] += d.b * d.b;
+    }
+
+    vec3 axis = max - min;
+    for (int iteration = 0; iteration < 4; ++iteration)
+    {
+        const vec3 next = vec3(
+            covariance[0] * axis.r + covariance[1] * axis.g + covariance[2] * axis.b,
+            covariance[1] * axis.r + covariance[3] * axis.g + covariance[4] * axis.b,
+            covariance[2] * axis.r + covariance[4] * axis.g + covariance[5] * axis.b
+        );
+        const f32 largest = glm::max(std::abs(next.r), glm::max(std::abs(next.g), std::abs(next.b)));
+        if (largest < 1e-6f)
+            break;
+        axis = next / largest;
+    }
+
+    vec3 a = max;
+    vec3 b = min;
+    const f32 length = glm::length(axis);
+    if (length > 1e-6f)
+    {
+        axis /= length;
+        f32 low = 1e30f, high = -1e30f;
+        for (int i = 0; i < 16; ++i)
+        {
+            const f32 t = glm::dot(colors[i] - mean, axis);
+            low  = glm::min(low,  t);
+            high = glm::max(high, t);
+        }
+
+        // Pulling the endpoints in a little gives the interpolated colors a better spread.
+        const f32 inset = (high - low) / 16.0f;
+        a = glm::clamp(mean + axis * (high - inset), 0.0f, 255.0f);
+        b = glm::clamp(mean + axis * (low  + inset), 0.0f, 255.0f);
+    }
+
+    u16 c0 = To565(a);
+    u16 c1 = To565(b);
+    f32 error;
+    u32 indices = FitColorIndices(colors, c0, c1, error);
+
+    if (RefineColorEndpoints(colors, indices, a, b))
+    {
+        const u16 r0 = To565(a);
+        const u16 r1 = To565(b);
+        f32 refined_error;
+        const u32 refined = FitColorIndices(colors, r0, r1, refined_error);
+        if (refined_error < error)
+        {
+            c0      = r0;
+            c1      = r1;
+            indices = refined;
+        }
+    }
+
+    // c0 > c1 selects the four color mode. Swapping the endpoints swaps index 0 with 1 and 2 with 3.
+    if (c0 < c1)
+    {
+        std::swap(c0, c1);
+        indices ^= 0x55555555u;
+    }
+    else if (c0 == c1)
+    {
+        indices = 0;
+    }
+
+    out[0] = u8(c0);
+    out[1] = u8(c0 >> 8);
+    out[2] = u8(c1);
+    out[3] = u8(c1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        out[4 + i] = u8(indices >> (8 * i));
+}
+
+static void BC4Palette(int r0, int r1, int palette[8])
+{
+    palette[0] = r0;
+    palette[1] = r1;
+    if (r0 > r1)
+    {
+        for (int i = 2; i < 8; ++i)
+            palette[i] = ((8 - i) * r0 + (i - 1) * r1) / 7;
+    }
+    else
+    {
+        for (int i = 2; i < 6; ++i)
+            palette[i] = ((6 - i) * r0 + (i - 1) * r1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+static void EncodeValueBlock(const u8 values[16], u8* out)
+{
+    int low = 255, high = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        low  = std::min(low,  int(values[i]));
+        high = std::max(high, int(values[i]));
+    }
+
+    // Always the eight value mode, which needs r0 > r1. A flat block just uses index 0.
+    out[0] = u8(high);
+    out[1] = u8(low);
+
+    u64 indices = 0;
+    if (high > low)
+    {
+        int palette[8];
+        BC4Palette(high, low, palette);
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            for (int j = 1; j < 8; ++j)
+                if (std::abs(palette[j] - values[i]) < std::abs(palette[best] - values[i]))
+                    best = j;
+            indices |= u64(best) << (3 * i);
+        }
+    }
+
+    for (int i = 0; i < 6; ++i)
+        out[2 + i] = u8(indices >> (8 * i));
+}
+
+
+void CompressPixels(const u8* pixels, int width, int height, int channels, BlockFormat format, u8* blocks, ThreadPool& pool)
+{
+    const int  blocks_x   = (width  + 3) / 4;
+    const int  blocks_y   = (height + 3) / 4;
+    const auto block_size = BlockSize(format);
+
+    pool.parallel_for(usize(blocks_y), [=](usize row) {
+        for (int bx = 0; bx < blocks_x; ++bx)
+        {
+            // Gather the block as RGBA, repeating the last row and column past the edges.
+            u8 rgba[16][4];
+            for (int i = 0; i < 16; ++i)
+            {
+                const int x = std::min(bx * 4 + (i & 3),       width  - 1);
+                const int y = std::min(int(row) * 4 + (i >> 2), height - 1);
+                const u8* pixel = pixels + (usize(y) * usize(width) + usize(x)) * usize(channels);
+
+                if (channels >= 3)
+                    rgba[i][0] = pixel[0], rgba[i][1] = pixel[1], rgba[i][2] = pixel[2];
+                else
+                    rgba[i][0] = rgba[i][1] = rgba[i][2] = pixel[0];
+
+                if (channels == 4)
+                    rgba[i][3] = pixel[3];
+                else if (channels == 2)
+                    rgba[i][3] = pixel[1];
+                else
+                    rgba[i][3] = 255;
+            }
+
+            u8* out = blocks + (row * usize(blocks_x) + usize(bx)) * block_size;
+            vec3 colors[16];
+            u8   values[16];
+            switch (format)
+            {
+                case BlockFormat::BC1:
+                case BlockFormat::BC3:
+                {
+                    if (format == BlockFormat::BC3)
+                    {
+                        for (int i = 0; i < 16; ++i)
+                            values[i] = rgba[i][3];
+                        EncodeValueBlock(values, out);
+                        out += 8;
+                    }
+                    for (int i = 0; i < 16; ++i)
+                        colors[i] = vec3(rgba[i][0], rgba[i][1], rgba[i][2]);
+                    EncodeColorBlock(colors, out);
+                } break;
+                case BlockFormat::BC4:
+                case BlockFormat::BC5:
+                {
+                    for (int i = 0; i < 16; ++i)
+                        values[i] = rgba[i][0];
+                    EncodeValueBlock(values, out);
+                    if (format == BlockFormat::BC5)
+                    {
+                        // Green is the second channel, which is alpha for gray and alpha images.
+                        for (int i = 0; i < 16; ++i)
+                            values[i] = (channels == 2) ? rgba[i][3] : rgba[i][1];
+                        EncodeValueBlock(values, out + 8);
+                    }
+                } break;
+            }
+        }
+    });
+}
+
+
+// ---- DECODING ----
+
+static void DecodeColorBlock(const u8* block, u8 rgba[16][4])
+{
+    const u16 c0 = u16(block[0] | (block[1] << 8));
+    const u16 c1 = u16(block[2] | (block[3] << 8));
+    const vec3 a = From565(c0);
+    const vec3 b = From565(c1);
+
+    vec3 palette[4] = { a, b, vec3(0.0f), vec3(0.0f) };
+    if (c0 > c1)
+    {
+        palette[2] = (2.0f * a + b) / 3.0f;
+        palette[3] = (a + 2.0f * b) / 3.0f;
+    }
+    else
+    {
+        palette[2] = (a + b) / 2.0f;
+    }
+
+    const u32 indices = u32(block[4]) | (u32(block[5]) << 8) | (u32(block[6]) << 16) | (u32(block[7]) << 24);
+    for (int i = 0; i < 16; ++i)
+    {
+        const vec3& color = palette[(indices >> (2 * i)) & 3];
+        rgba[i][0] = u8(color.r + 0.5f);
+        rgba[i][1] = u8(color.g + 0.5f);
+        rgba[i][2] = u8(color.b + 0.5f);
+    }
+}
+
+static void DecodeValueBlock(const u8* block, u8 values[16])
+{
+    int palette[8];
+    BC4Palette(block[0], block[1], palette);
+
+    u64 indices = 0;
+    for (int i = 0; i < 6; ++i)
+        indices |= u64(block[2 + i]) << (8 * i);
+    for (int i = 0; i < 16; ++i)
+        values[i] = u8(palette[(indices >> (3 * i)) & 7]);
+}
+
+void DecompressPixels(const u8* blocks, int width, int height, BlockFormat format, u8* rgba)
+{
+    const int  blocks_x   = (width  + 3) / 4;
+    const int  blocks_y   = (height + 3) / 4;
+    const auto block_size = BlockSize(format);
+
+    for (int by = 0; by < blocks_y; ++by)
+    {
+        for (int bx = 0; bx < blocks_x; ++bx)
+        {
+            const u8* block = blocks + (usize(by) * usize(blocks_x) + usize(bx)) * block_size;
+
+            u8 decoded[16][4] = {};
+            u8 values[16];
+            switch (format)
+            {
+                case BlockFormat::BC1:
+                    DecodeColorBlock(block, decoded);
+                    for (auto& pixel : decoded) pixel[3] = 255;
+                    break;
+                case BlockFormat::BC3:
+                    DecodeValueBlock(block, values);
+                    DecodeColorBlock(block + 8, decoded);
+                    for (int i = 0; i < 16; ++i) decoded[i][3] = values[i];
+                    break;
+                case BlockFormat::BC4:
+                    DecodeValueBlock(block, values);
+                    for (int i = 0; i < 16; ++i) decoded[i][0] = values[i], decoded[i][3] = 255;
+                    break;
+                case BlockFormat::BC5:
+                    DecodeValueBlock(block, values);
+                    for (int i = 0; i < 16; ++i) decoded[i][0] = values[i], decoded[i][3] = 255;
+                    DecodeValueBlock(block + 8, values);
+                    for (int i = 0; i < 16; ++i) decoded[i][1] = values[i];
+                    break;
+            }
+
+            for (int i = 0; i < 16; ++i)
+            {
+                const int x = bx * 4 + (i & 3);
+                const int y = by * 4 + (i >> 2);
+                if (x < width && y < height)
+                    std::memcpy(rgba + (usize(y) * usize(width) + usize(x)) * 4, decoded[i], 4);
+            }
+        }
+    }
+}
+
+
+// ---- IMAGES ----
+
+Image CompressImage(const Image& image, bool srgb, ThreadPool& pool)
+{
+    if (!image.data || image.compression || image.width <= 0 || image.height <= 0 || image.channels < 1 || image.channels > 4)
+        return image;
+
+    const auto chain  = image.levels.empty() ? GenerateMipmaps(image, srgb) : image;
+    const auto format = ChooseBlockFormat(chain.data, chain.width, chain.height, chain.channels);
+
+    std::vector<ImageLevel> levels;
+    usize offset = 0;
+    for (const auto& source : chain.levels)
+    {
+        const usize size = CompressedSize(format, source.width, source.height);
+        levels.push_back({ source.width, source.height, offset, size });
+        offset += size;
+    }
+
+    std::shared_ptr<unsigned char> blocks(new unsigned char[offset], std::default_delete<unsigned char[]>());
+
+    pool.parallel_for(levels.size(), [&](usize i) {
+        const auto& level = levels[i];
+        CompressPixels(chain.data + chain.levels[i].offset, level.width, level.height, chain.channels, format, blocks.get() + level.offset, pool);
+    });
+
+    Image result = image;
+    result.data        = blocks.get();
+    result.pixels      = std::move(blocks);
+    result.compression = GetGLFormat(format);
+    result.levels      = std::move(levels);
+    return result;
+}
+
+
+f32 CompressionError(const Image& original, const Image& compressed)
+{
+    BlockFormat format;
+    if (!original.data || !compressed.data || compressed.levels.empty() || !GetBlockFormat(compressed.compression, format))
+        return 0.0f;
+
+    std::vector<u8> decoded(usize(original.width) * usize(original.height) * 4);
+    DecompressPixels(compressed.data, original.width, original.height, format, decoded.data());
+
+    // Compare the channels the format keeps, in the order CompressPixels puts them.
+    f64 sum   = 0.0;
+    usize count = 0;
+    const usize pixels = usize(original.width) * usize(original.height);
+    for (usize i = 0; i < pixels; ++i)
+    {
+        const u8* source = original.data + i * usize(original.channels);
+        const u8* result = decoded.data() + i * 4;
+
+        u8 expected[4] = { source[0], 0, 0, 255 };
+        u8 actual[4]   = { result[0], result[1], result[2], result[3] };
+        int channels = 1;
+        if (format == BlockFormat::BC5)
+        {
+            expected[1] = source[1];
+            channels    = 2;
+        }
+        else if (format == BlockFormat::BC1 || format == BlockFormat::BC3)
+        {
+            expected[0] = source[0];
+            expected[1] = (original.channels >= 3) ? source[1] : source[0];
+            expected[2] = (original.channels >= 3) ? source[2] : source[0];
+            expected[3] = (original.channels == 4) ? source[3] : 255;
+            channels    = (format == BlockFormat::BC3) ? 4 : 3;
+        }
+
+        for (int c = 0; c < channels; ++c)
+        {
+            const f64 difference = f64(expected[c]) - f64(actual[c]);
+            sum += difference * difference;
+        }
+        count += usize(channels);
+    }
+
+    return count ? f32(std::sqrt(sum / f64(count))) : 0.0f;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "jobs.h"
+#include "texture.h"
+#include "types.h"
+
+
+// Block compression formats. Each stores a 4x4 pixel block in a fixed number of bytes, which the GPU samples directly.
+//   BC1: RGB,   8 bytes per block. Two 5:6:5 endpoints and a 2-bit index per pixel.
+//   BC3: RGBA, 16 bytes per block. A BC4 block for alpha followed by a BC1 block for color.
+//   BC4: R,     8 bytes per block. Two 8-bit endpoints and a 3-bit index per pixel.
+//   BC5: RG,   16 bytes per block. One BC4 block per channel.
+enum class BlockFormat : u32
+{
+    BC1, BC3, BC4, BC5
+};
+
+usize  BlockSize(BlockFormat format);
+GLenum GetGLFormat(BlockFormat format);
+bool   GetBlockFormat(GLenum gl_format, BlockFormat& format);   // False if 'gl_format' isn't one of ours.
+usize  CompressedSize(BlockFormat format, int width, int height);
+
+// The smallest format that keeps every channel of the image: BC4 for one channel, BC5 for two (gray and alpha end up
+// in red and green), BC1 for three and BC3 for four unless all pixels are opaque.
+BlockFormat ChooseBlockFormat(const u8* pixels, int width, int height, int channels);
+
+// Encodes 'pixels' (8-bit, 'channels' interleaved) into 'blocks', which must hold CompressedSize bytes. Partial blocks
+// at the edges repeat the last row and column. Rows of blocks are spread over 'pool'.
+void CompressPixels(const u8* pixels, int width, int height, int channels, BlockFormat format, u8* blocks, ThreadPool& pool = ThreadPool::shared());
+
+// Decodes into 8-bit RGBA, like the GPU would. Missing channels come out as 0, alpha as 255.
+void DecompressPixels(const u8* blocks, int width, int height, BlockFormat format, u8* rgba);
+
+// Compresses an image and its whole mip chain, levels and blocks in parallel on 'pool'. The chain is built with
+// GenerateMipmaps (filtered as colors if 'srgb') unless the image already has one. The result has 'compression' and
+// 'levels' set and owns its data. Images that failed to load are returned as they are.
+Image CompressImage(const Image& image, bool srgb = false, ThreadPool& pool = ThreadPool::shared());
+
+// Root mean square error per channel of the base level of 'compressed' against 'original'.
+f32 CompressionError(const Image& original, const Image& compressed);
@@ -0,0 +1,487 @@
+#include "cook.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include "compress.h"
+#include "debug.h"
+
+
+static usize AlignUp(usize value, usize alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static u64 HashFile(const std::string& path)
+{
+    auto file = MappedFile::open(path);
+    if (!file)
+        return 0;
+    return HashBytes((const char*) file.data, file.size);
+}
+
+// A missing file is fine; the cooked file can be shipped on its own.
+static bool IsStale(const std::string& path, u64 size, s64 modified, u64 hash)
+{
+    const auto info = GetFileInfo(path);
+    if (!info.exists)
+        return false;
+    if (info.size != size)
+        return true;
+    return info.modified != modified && HashFile(path) != hash;
+}
+
+
+struct StringTable
+{
+    std::string data;
+
+    CookedString add(const std::string& string)
+    {
+        CookedString result { u32(this->data.size()), u32(string.size()) };
+        this->data += string;
+        return result;
+    }
+
+    CookedString add(const std::optional<Image>& image)
+    {
+        return image ? this->add(image->name) : CookedString { 0, 0 };
+    }
+};
+
+static std::string ReadString(const u8* strings, CookedString string)
+{
+    return { (const char*) strings + string.offset, string.length };
+}
+
+static void RequestMap(std::vector<MaterialMapRequest>& requests, std::optional<Image>& image, const u8* strings, CookedString string, std::size_t material, bool color, const std::string& material_directory)
+{
+    if (string.length == 0)
+        return;
+
+    // Only the name until it's decoded.
+    auto name = ReadString(strings, string);
+    image = Image { 0, 0, 0, nullptr, name, material_directory };
+    requests.push_back({ &image, std::move(name), material, color });
+}
+
+
+static std::string cooked_directory;
+
+void SetCookedDirectory(const std::string& directory)
+{
+    cooked_directory = directory;
+    if (!cooked_directory.empty() && cooked_directory.back() == '/')
+        cooked_directory.pop_back();
+
+    std::error_code error;
+    if (!cooked_directory.empty())
+        std::filesystem::create_directories(cooked_directory, error);
+}
+
+static std::string CookedPath(const std::string& source_file)
+{
+    if (cooked_directory.empty())
+        return source_file + ".cooked";
+
+    // Sources in different directories can have the same name, so the full path is hashed into the name.
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) HashBytes(source_file.data(), source_file.size()));
+    return cooked_directory + '/' + hash + '-' + std::filesystem::path(source_file).filename().string() + ".cooked";
+}
+
+
+std::string CookedScenePath(const std::string& source_file)
+{
+    return CookedPath(source_file);
+}
+
+
+bool CookScene(const SoftwareScene& scene, const std::string& source_file, const std::string& cooked_file)
+{
+    const auto source = GetFileInfo(source_file);
+    if (!source.exists)
+        return false;
+
+    StringTable strings;
+
+    std::vector<CookedMaterial> materials;
+    materials.reserve(scene.materials.size());
+    for (const auto& material : scene.materials)
+    {
+        materials.push_back(CookedMaterial {
+            strings.add(material.name),
+            { material.ambient.x,  material.ambient.y,  material.ambient.z  },
+            { material.diffuse.x,  material.diffuse.y,  material.diffuse.z  },
+            { material.specular.x, material.specular.y, material.specular.z },
+            material.shininess, material.transparency, material.opaqueness, u32(material.illumination),
+            strings.add(material.ambient_map),
+            strings.add(material.diffuse_map),
+            strings.add(material.specular_map),
+            strings.add(material.bump_map),
+            strings.add(material.opaque_map),
+        });
+    }
+
+    std::vector<CookedDependency> dependencies;
+    dependencies.reserve(scene.material_files.size());
+    for (const auto& material_file : scene.material_files)
+    {
+        const auto info = GetFileInfo(material_file);
+        if (info.exists)
+            dependencies.push_back({ strings.add(material_file), info.size, info.modified, HashFile(material_file) });
+    }
+
+    std::vector<CookedMesh> meshes;
+    meshes.reserve(scene.meshes.size());
+    u64 vertex_count = 0;
+    u64 indices_size = 0;
+    for (const auto& mesh : scene.meshes)
+    {
+        meshes.push_back(CookedMesh {
+            strings.add(mesh.name),
+            mesh.mesh_id,
+            mesh.material ? s64(mesh.material - scene.materials.data()) : -1,
+            vertex_count, mesh.vertex_count,
+            indices_size, mesh.index_count, u32(mesh.index_type), 0
+        });
+        vertex_count += mesh.vertex_count;
+        indices_size  = AlignUp(indices_size + mesh.index_count * u64(mesh.index_type), 4);
+    }
+
+    CookedSceneHeader header {};
+    header.magic            = COOKED_SCENE_MAGIC;
+    header.version          = COOKED_SCENE_VERSION;
+    header.vertex_size      = sizeof(Vertex);
+    header.material_count   = u32(materials.size());
+    header.mesh_count       = u32(meshes.size());
+    header.dependency_count = u32(dependencies.size());
+    header.strings_size     = u32(strings.data.size());
+    header.source_size      = source.size;
+    header.source_modified  = source.modified;
+    header.source_hash      = HashFile(source_file);
+    header.vertex_count     = vertex_count;
+    header.indices_size     = indices_size;
+
+    header.materials_offset    = sizeof(CookedSceneHeader);
+    header.meshes_offset       = AlignUp(header.materials_offset + materials.size() * sizeof(CookedMaterial), alignof(CookedMesh));
+    header.dependencies_offset = AlignUp(header.meshes_offset    + meshes.size()    * sizeof(CookedMesh),     alignof(CookedDependency));
+    header.strings_offset      = header.dependencies_offset + dependencies.size() * sizeof(CookedDependency);
+    header.vertices_offset     = AlignUp(header.strings_offset  + strings.data.size(),           COOKED_ALIGNMENT);
+    header.indices_offset      = AlignUp(header.vertices_offset + vertex_count * sizeof(Vertex), COOKED_ALIGNMENT);
+
+    // Write to a temporary file first so a crash halfway never leaves a truncated cache behind.
+    const auto temporary_file = cooked_file + ".tmp";
+    {
+        std::ofstream out(temporary_file, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+
+        auto pad_to = [&out](u64 offset) {
+            static const char zeros[COOKED_ALIGNMENT] = {};
+            out.write(zeros, std::streamsize(offset - u64(out.tellp())));
+        };
+
+        out.write((const char*) &header, sizeof(header));
+        out.write((const char*) materials.data(), std::streamsize(materials.size() * sizeof(CookedMaterial)));
+        pad_to(header.meshes_offset);
+        out.write((const char*) meshes.data(),    std::streamsize(meshes.size()    * sizeof(CookedMesh)));
+        pad_to(header.dependencies_offset);
+        out.write((const char*) dependencies.data(), std::streamsize(dependencies.size() * sizeof(CookedDependency)));
+        out.write(strings.data.data(), std::streamsize(strings.data.size()));
+
+        pad_to(header.vertices_offset);
+        for (const auto& mesh : scene.meshes)
+            out.write((const char*) mesh.vertices, std::streamsize(mesh.vertex_count * sizeof(Vertex)));
+
+        pad_to(header.indices_offset);
+        for (std::size_t i = 0; i < meshes.size(); ++i)
+        {
+            pad_to(header.indices_offset + meshes[i].index_offset);
+            out.write((const char*) scene.meshes[i].indices, std::streamsize(meshes[i].index_count * meshes[i].index_size));
+        }
+        pad_to(header.indices_offset + indices_size);
+
+        if (!out)
+            return false;
+    }
+
+    if (std::rename(temporary_file.data(), cooked_file.data()) != 0)
+    {
+        std::remove(temporary_file.data());
+        return false;
+    }
+
+    INFO("Cooked '%s' (%llu vertices, %llu bytes of indices, %u meshes).", source_file.data(), (unsigned long long) vertex_count, (unsigned long long) indices_size, header.mesh_count);
+    return true;
+}
+
+
+std::optional<SoftwareScene> LoadCookedScene(const std::string& cooked_file, const std::string& source_file, const std::string& material_directory, std::vector<MaterialMapRequest>* deferred_maps)
+{
+    auto file = MappedFile::open(cooked_file);
+    if (!file || file.size < sizeof(CookedSceneHeader))
+        return {};
+
+    CookedSceneHeader header;
+    std::memcpy(&header, file.data, sizeof(header));
+
+    if (header.magic != COOKED_SCENE_MAGIC || header.version != COOKED_SCENE_VERSION || header.vertex_size != sizeof(Vertex))
+        return {};
+
+    // Sections are cast to their types in place, so they also have to be aligned for them.
+    const bool sections_fit =
+        FitsIn(header.materials_offset,    header.material_count,   sizeof(CookedMaterial),   file.size) && header.materials_offset    % alignof(CookedMaterial)   == 0 &&
+        FitsIn(header.meshes_offset,       header.mesh_count,       sizeof(CookedMesh),       file.size) && header.meshes_offset       % alignof(CookedMesh)       == 0 &&
+        FitsIn(header.dependencies_offset, header.dependency_count, sizeof(CookedDependency), file.size) && header.dependencies_offset % alignof(CookedDependency) == 0 &&
+        FitsIn(header.strings_offset,      header.strings_size,     1,                        file.size) &&
+        FitsIn(header.vertices_offset,     header.vertex_count,     sizeof(Vertex),           file.size) && header.vertices_offset     % alignof(Vertex)           == 0 &&
+        FitsIn(header.indices_offset,      header.indices_size,     1,                        file.size) && header.indices_offset      % 4                         == 0;
+    if (!sections_fit)
+    {
+        WARNING("Cooked scene '%s' is truncated or corrupt.", cooked_file.data());
+        return {};
+    }
+
+    const auto* materials    = (const CookedMaterial*)   (file.data + header.materials_offset);
+    const auto* meshes       = (const CookedMesh*)       (file.data + header.meshes_offset);
+    const auto* dependencies = (const CookedDependency*) (file.data + header.dependencies_offset);
+    const auto* strings      = file.data + header.strings_offset;
+    const auto* vertices     = (const Vertex*)           (file.data + header.vertices_offset);
+    const auto* indices      = file.data + header.indices_offset;
+
+    auto string_fits = [&header](CookedString string) { return FitsIn(string.offset, string.length, 1, header.strings_size); };
+
+    bool corrupt = false;
+    for (u32 i = 0; i < header.dependency_count; ++i)
+        corrupt |= !string_fits(dependencies[i].path);
+    for (u32 i = 0; i < header.material_count; ++i)
+    {
+        const auto& material = materials[i];
+        for (const auto string : { material.name, material.ambient_map, material.diffuse_map, material.specular_map, material.bump_map, material.opaque_map })
+            corrupt |= !string_fits(string);
+        corrupt |= material.illumination != SoftwareMaterial::NO_SPECULAR && material.illumination != SoftwareMaterial::HAS_SPECULAR;
+    }
+    for (u32 i = 0; i < header.mesh_count; ++i)
+    {
+        const auto& mesh = meshes[i];
+        corrupt |= !string_fits(mesh.name);
+        corrupt |= !FitsIn(mesh.first_vertex, mesh.vertex_count, 1, header.vertex_count);
+        corrupt |= (mesh.index_size != 2 && mesh.index_size != 4) || mesh.index_offset % 4 != 0;
+        corrupt |= !FitsIn(mesh.index_offset, mesh.index_count, mesh.index_size, header.indices_size);
+        corrupt |= mesh.material_id < -1 || mesh.material_id >= s64(header.material_count);
+    }
+    if (corrupt)
+    {
+        WARNING("Cooked scene '%s' is corrupt.", cooked_file.data());
+        return {};
+    }
+
+    if (IsStale(source_file, header.source_size, header.source_modified, header.source_hash))
+        return {};
+    for (u32 i = 0; i < header.dependency_count; ++i)
+    {
+        const auto& dependency = dependencies[i];
+        if (IsStale(ReadString(strings, dependency.path), dependency.size, dependency.modified, dependency.hash))
+            return {};
+    }
+
+    SoftwareScene scene;
+
+    scene.materials.reserve(header.material_count);
+    for (u32 i = 0; i < header.material_count; ++i)
+    {
+        const auto& material = materials[i];
+        scene.materials.push_back(SoftwareMaterial {
+            ReadString(strings, material.name),
+            { material.ambient[0],  material.ambient[1],  material.ambient[2]  },
+            { material.diffuse[0],  material.diffuse[1],  material.diffuse[2]  },
+            { material.specular[0], material.specular[1], material.specular[2] },
+            material.shininess, material.transparency, material.opaqueness,
+            SoftwareMaterial::Illumination(material.illumination),
+        });
+    }
+
+    std::vector<MaterialMapRequest> maps;
+    for (u32 i = 0; i < header.material_count; ++i)
+    {
+        auto& result = scene.materials[i];
+        RequestMap(maps, result.ambient_map,  strings, materials[i].ambient_map,  i, true,  material_directory);
+        RequestMap(maps, result.diffuse_map,  strings, materials[i].diffuse_map,  i, true,  material_directory);
+        RequestMap(maps, result.specular_map, strings, materials[i].specular_map, i, false, material_directory);
+        RequestMap(maps, result.bump_map,     strings, materials[i].bump_map,     i, false, material_directory);
+        RequestMap(maps, result.opaque_map,   strings, materials[i].opaque_map,   i, false, material_directory);
+    }
+    if (deferred_maps)
+        *deferred_maps = std::move(maps);
+    else
+        LoadMaterialMaps(maps, material_directory);
+
+    scene.meshes.reserve(header.mesh_count);
+    for (u32 i = 0; i < header.mesh_count; ++i)
+    {
+        const auto& mesh = meshes[i];
+        scene.meshes.push_back(SoftwareMesh {
+            mesh.mesh_id, std::size_t(mesh.material_id), ReadString(strings, mesh.name),
+            vertices + mesh.first_vertex, mesh.vertex_count,
+            indices + mesh.index_offset, mesh.index_count, IndexType(mesh.index_size),
+            (mesh.material_id >= 0) ? &scene.materials[mesh.material_id] : nullptr
+        });
+    }
+
+    scene.quantization = ComputeQuantization(scene);
+    scene.cooked_file  = std::move(file);
+    return scene;
+}
+
+
+
+std::string CookedTexturePath(const std::string& source_file)
+{
+    return CookedPath(source_file);
+}
+
+
+bool CookTexture(const Image& image, bool srgb, const std::string& source_file, const std::string& cooked_file)
+{
+    const auto source = GetFileInfo(source_file);
+    if (!source.exists || !image.compression || !image.data || image.levels.empty())
+        return false;
+
+    std::vector<CookedTextureLevel> levels;
+    levels.reserve(image.levels.size());
+    for (const auto& level : image.levels)
+        levels.push_back({ u32(level.width), u32(level.height), level.offset, level.size });
+
+    CookedTextureHeader header {};
+    header.magic           = COOKED_TEXTURE_MAGIC;
+    header.version         = COOKED_TEXTURE_VERSION;
+    header.width           = u32(image.width);
+    header.height          = u32(image.height);
+    header.channels        = u32(image.channels);
+    header.format          = image.compression;
+    header.level_count     = u32(levels.size());
+    header.srgb            = srgb;
+    header.source_size     = source.size;
+    header.source_modified = source.modified;
+    header.source_hash     = HashFile(source_file);
+    header.levels_offset   = sizeof(CookedTextureHeader);
+    header.blocks_offset   = AlignUp(header.levels_offset + levels.size() * sizeof(CookedTextureLevel), COOKED_ALIGNMENT);
+    header.blocks_size     = image.size();
+
+    const auto temporary_file = cooked_file + ".tmp";
+    {
+        std::ofstream out(temporary_file, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+
+        static const char zeros[COOKED_ALIGNMENT] = {};
+        out.write((const char*) &header, sizeof(header));
+        out.write((const char*) levels.data(), std::streamsize(levels.size() * sizeof(CookedTextureLevel)));
+        out.write(zeros, std::streamsize(header.blocks_offset - u64(out.tellp())));
+        out.write((const char*) image.data, std::streamsize(header.blocks_size));
+
+        if (!out)
+            return false;
+    }
+
+    if (std::rename(temporary_file.data(), cooked_file.data()) != 0)
+    {
+        std::remove(temporary_file.data());
+        return false;
+    }
+    return true;
+}
+
+
+std::optional<Image> LoadCookedTexture(const std::string& cooked_file, const std::string& source_file, const std::string& name, const std::string& directory, bool srgb)
+{
+    auto file = MappedFile::open(cooked_file);
+    if (!file || file.size < sizeof(CookedTextureHeader))
+        return {};
+
+    CookedTextureHeader header;
+    std::memcpy(&header, file.data, sizeof(header));
+
+    if (header.magic != COOKED_TEXTURE_MAGIC || header.version != COOKED_TEXTURE_VERSION || header.level_count == 0 || header.srgb != u32(srgb))
+        return {};
+
+    // The level table is cast in place, so it also has to be aligned for it.
+    const bool sections_fit =
+        FitsIn(header.levels_offset, header.level_count, sizeof(CookedTextureLevel), file.size) && header.levels_offset % alignof(CookedTextureLevel) == 0 &&
+        FitsIn(header.blocks_offset, header.blocks_size, 1,                          file.size);
+    if (!sections_fit)
+    {
+        WARNING("Cooked texture '%s' is truncated or corrupt.", cooked_file.data());
+        return {};
+    }
+
+    // Each level halves the one before it, starting from the header's size, and holds exactly the blocks that covers.
+    BlockFormat format;
+    const auto* levels = (const CookedTextureLevel*) (file.data + header.levels_offset);
+    bool corrupt = !GetBlockFormat(header.format, format) || header.width == 0 || header.height == 0 || header.width > MAX_COOKED_TEXTURE_SIZE || header.height > MAX_COOKED_TEXTURE_SIZE;
+    for (u32 i = 0, width = header.width, height = header.height; i < header.level_count && !corrupt; ++i)
+    {
+        const auto& level = levels[i];
+        corrupt |= level.width != width || level.height != height;
+        corrupt |= level.size != CompressedSize(format, int(width), int(height));
+        corrupt |= !FitsIn(level.offset, level.size, 1, header.blocks_size);
+        width  = std::max(width  / 2, 1u);
+        height = std::max(height / 2, 1u);
+    }
+    if (corrupt)
+    {
+        WARNING("Cooked texture '%s' is corrupt.", cooked_file.data());
+        return {};
+    }
+
+    if (IsStale(source_file, header.source_size, header.source_modified, header.source_hash))
+        return {};
+
+    Image image { int(header.width), int(header.height), int(header.channels), nullptr, name, directory };
+    image.compression = header.format;
+
+    for (u32 i = 0; i < header.level_count; ++i)
+        image.levels.push_back({ int(levels[i].width), int(levels[i].height), usize(levels[i].offset), usize(levels[i].size) });
+
+    // The blocks stay in the mapping, which goes away with the last copy of the image.
+    auto mapping = std::make_shared<MappedFile>(std::move(file));
+    image.data   = mapping->data + header.blocks_offset;
+    image.pixels = std::shared_ptr<const unsigned char>(mapping, image.data);
+    return image;
+}
+
+
+Image LoadCompressedImage(const std::string& name, const std::string& directory, bool srgb)
+{
+    const auto source_file = directory + name;
+    const auto cooked_file = CookedTexturePath(source_file);
+    if (auto cooked = LoadCookedTexture(cooked_file, source_file, name, directory, srgb))
+        return std::move(*cooked);
+
+    const auto image = Image::from_path(name, directory);
+    if (!image.data)
+        return image;
+
+    auto compressed = CompressImage(image, srgb);
+    if (!compressed.compression)
+        return compressed;
+
+    INFO("Compressed %s (%ix%i, %i channels) from %.2f MB to %.2f MB with %zu levels, RMSE %.2f.", name.data(), image.width, image.height, image.channels,
+         double(image.size()) / (1024.0 * 1024.0), double(compressed.size()) / (1024.0 * 1024.0), compressed.levels.size(), CompressionError(image, compressed));
+
+    if (!CookTexture(compressed, srgb, source_file, cooked_file))
+    {
+        WARNING("Couldn't cook '%s' to '%s'.", source_file.data(), cooked_file.data());
+        return compressed;
+    }
+
+    // NOTE(ted): Hand out the mapping rather than the copy on the heap, so the pages can be dropped once uploaded
+    //            (see ReleasePixels) instead of the whole chain staying resident for as long as the image is kept.
+    if (auto cooked = LoadCookedTexture(cooked_file, source_file, name, directory, srgb))
+        return std::move(*cooked);
+    return compressed;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <string>
+#include <optional>
+
+#include "loader.h"
+#include "types.h"
+
+
+// ---- COOKED SCENE FORMAT ----
+// A scene cooked into a single binary file that can be mapped straight into memory.
+//
+//   CookedSceneHeader
+//   CookedMaterial[material_count]
+//   CookedMesh[mesh_count]             (aligned for CookedMesh)
+//   CookedDependency[dependency_count] (the .mtl files)
+//   char strings[strings_size]         (names and paths, not null-terminated)
+//   Vertex vertices[vertex_count]      (aligned to COOKED_ALIGNMENT)
+//   u8 indices[indices_size]           (aligned to COOKED_ALIGNMENT, u16 or u32 per mesh, each mesh 4 byte aligned)
+//
+// All offsets are in bytes from the start of the file. Bump COOKED_SCENE_VERSION whenever any of these change.
+constexpr u32   COOKED_SCENE_MAGIC   = 0x454E4353;  // "SCNE"
+constexpr u32   COOKED_SCENE_VERSION = 4;
+constexpr usize COOKED_ALIGNMENT     = 16;
+
+struct CookedString
+{
+    u32 offset;
+    u32 length;
+};
+
+struct CookedSceneHeader
+{
+    u32 magic;
+    u32 version;
+    u32 vertex_size;     // sizeof(Vertex) at cook time.
+    u32 material_count;
+    u32 mesh_count;
+    u32 dependency_count;
+    u32 strings_size;
+    u32 padding;
+
+    // Identity of the source file. Size and time are checked first; the hash settles it when only the time changed.
+    u64 source_size;
+    s64 source_modified;
+    u64 source_hash;
+
+    u64 vertex_count;
+    u64 indices_size;    // In bytes.
+
+    u64 materials_offset;
+    u64 meshes_offset;
+    u64 dependencies_offset;
+    u64 strings_offset;
+    u64 vertices_offset;
+    u64 indices_offset;
+};
+
+struct CookedMaterial
+{
+    CookedString name;
+
+    f32 ambient[3];
+    f32 diffuse[3];
+    f32 specular[3];
+
+    f32 shininess;
+    f32 transparency;
+    f32 opaqueness;
+    u32 illumination;
+
+    // Relative to the material directory. Zero length means no map.
+    CookedString ambient_map;
+    CookedString diffuse_map;
+    CookedString specular_map;
+    CookedString bump_map;
+    CookedString opaque_map;
+};
+
+// A range into the scene's vertex and index blobs. Non-indexed meshes have index_count == 0.
+struct CookedMesh
+{
+    CookedString name;
+
+    u64 mesh_id;
+    s64 material_id;    // -1 if the mesh has no material.
+
+    u64 first_vertex;
+    u64 vertex_count;
+    u64 index_offset;   // In bytes, relative to the index blob.
+    u64 index_count;
+    u32 index_size;     // 2 or 4.
+    u32 padding;
+};
+
+// Another file the scene was built from, checked like the source.
+struct CookedDependency
+{
+    CookedString path;
+    u64 size;
+    s64 modified;
+    u64 hash;
+};
+
+
+// Where cooked scenes and textures go. Empty (the default) puts each next to its source. Set it before loading anything.
+void SetCookedDirectory(const std::string& directory);
+
+std::string CookedScenePath(const std::string& source_file);
+
+bool CookScene(const SoftwareScene& scene, const std::string& source_file, const std::string& cooked_file);
+
+// Returns nothing if the cooked file is missing, from another version, stale compared to 'source_file' or its .mtl files,
+// or corrupt. See LoadScene for 'deferred_maps'.
+std::optional<SoftwareScene> LoadCookedScene(const std::string& cooked_file, const std::string& source_file, const std::string& material_directory, std::vector<MaterialMapRequest>* deferred_maps = nullptr);
+
+
+
+// ---- COOKED TEXTURE FORMAT ----
+// A block compressed image (see compress.h) with its whole mip chain, cooked next to the source image. Upload is a plain
+// copy per level.
+//
+//   CookedTextureHeader
+//   CookedTextureLevel levels[level_count]
+//   u8 blocks[blocks_size]             (aligned to COOKED_ALIGNMENT, largest level first)
+//
+// All offsets are in bytes from the start of the file. Bump COOKED_TEXTURE_VERSION whenever any of these change.
+constexpr u32 COOKED_TEXTURE_MAGIC   = 0x58455443;  // "CTEX"
+constexpr u32 COOKED_TEXTURE_VERSION = 2;
+constexpr u32 MAX_COOKED_TEXTURE_SIZE = 1u << 16;   // Pixels across. Larger headers are treated as corrupt.
+
+struct CookedTextureHeader
+{
+    u32 magic;
+    u32 version;
+    u32 width;
+    u32 height;
+    u32 channels;       // Of the source image.
+    u32 format;         // GL_COMPRESSED_*.
+    u32 level_count;
+    u32 srgb;           // Whether the levels were filtered as sRGB colors rather than linear data.
+
+    u64 source_size;
+    s64 source_modified;
+    u64 source_hash;
+
+    u64 levels_offset;
+    u64 blocks_offset;
+    u64 blocks_size;
+};
+
+struct CookedTextureLevel
+{
+    u32 width;
+    u32 height;
+    u64 offset;         // In bytes, relative to the blocks.
+    u64 size;
+};
+
+
+std::string CookedTexturePath(const std::string& source_file);
+
+bool CookTexture(const Image& image, bool srgb, const std::string& source_file, const std::string& cooked_file);
+
+// Returns nothing if the cooked file is missing, from another version, filtered in the other color space or stale
+// compared to 'source_file'. The image keeps the file mapped for as long as it's shared.
+std::optional<Image> LoadCookedTexture(const std::string& cooked_file, const std::string& source_file, const std::string& name, const std::string& directory, bool srgb);
+
+// Loads the cooked version of the image if it's up to date, otherwise decodes and compresses the source and cooks it
+// for next time. 'srgb' is whether the image holds colors, which decides how its mip chain is filtered.
+Image LoadCompressedImage(const std::string& name, const std::string& directory, bool srgb);
@@ -0,0 +1,186 @@
+#include "gpu.h"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "debug.h"
+
+
+struct PendingRelease
+{
+    GpuObject type;
+    GLuint    id;
+    usize     bytes;
+    u64       frame;    // Deleted once this one is retired.
+};
+
+struct FrameFence
+{
+    u64    frame;
+    GLsync fence;
+};
+
+// NOTE(ted): Only releases can come from other threads, but they touch everything below, so it's all behind the mutex.
+static std::mutex                        gpu_mutex;
+static std::unordered_map<GLuint, usize> gpu_objects[usize(GpuObject::COUNT)];   // Live ones, id to bytes.
+static usize                             gpu_bytes[usize(GpuObject::COUNT)];
+static std::deque<PendingRelease>        gpu_releases;     // In the order they were released.
+static std::deque<FrameFence>            gpu_fences;       // Of frames that haven't retired yet, oldest first.
+static usize                             gpu_pending_bytes = 0;
+static u64                               gpu_frame         = 1;
+static u64                               gpu_retired       = 0;
+
+static const char* const GPU_OBJECT_NAMES[] = { "buffer", "texture", "vertex array" };
+static_assert(sizeof(GPU_OBJECT_NAMES) / sizeof(*GPU_OBJECT_NAMES) == usize(GpuObject::COUNT), "A GPU object has no name.");
+
+
+static void DeleteGpuObject(GpuObject type, GLuint id)
+{
+    switch (type)
+    {
+        case GpuObject::BUFFER:       glDeleteBuffers(1, &id);      break;
+        case GpuObject::TEXTURE:      glDeleteTextures(1, &id);     break;
+        case GpuObject::VERTEX_ARRAY: glDeleteVertexArrays(1, &id); break;
+        case GpuObject::COUNT:        break;
+    }
+}
+
+// Expects the mutex to be held.
+static void DeleteRetiredObjects()
+{
+    while (!gpu_releases.empty() && gpu_releases.front().frame <= gpu_retired)
+    {
+        const auto& release = gpu_releases.front();
+        DeleteGpuObject(release.type, release.id);
+        gpu_pending_bytes -= release.bytes;
+        gpu_releases.pop_front();
+    }
+}
+
+
+GLuint CreateGpuObject(GpuObject type)
+{
+    GLuint id = 0;
+    switch (type)
+    {
+        case GpuObject::BUFFER:       glGenBuffers(1, &id);      break;
+        case GpuObject::TEXTURE:      glGenTextures(1, &id);     break;
+        case GpuObject::VERTEX_ARRAY: glGenVertexArrays(1, &id); break;
+        case GpuObject::COUNT:        break;
+    }
+    ASSERT(id, "Couldn't create a %s.", GPU_OBJECT_NAMES[usize(type)]);
+
+    std::lock_guard<std::mutex> lock(gpu_mutex);
+    gpu_objects[usize(type)][id] = 0;
+    return id;
+}
+
+void ResizeGpuObject(GpuObject type, GLuint id, usize bytes)
+{
+    std::lock_guard<std::mutex> lock(gpu_mutex);
+    auto it = gpu_objects[usize(type)].find(id);
+    if (it == gpu_objects[usize(type)].end())
+    {
+        WARNING("Resized %s %u, which isn't live.", GPU_OBJECT_NAMES[usize(type)], id);
+        return;
+    }
+
+    gpu_bytes[usize(type)] += bytes;
+    gpu_bytes[usize(type)] -= it->second;
+    it->second = bytes;
+}
+
+void ReleaseGpuObject(GpuObject type, GLuint id)
+{
+    if (!id)
+        return;
+
+    std::lock_guard<std::mutex> lock(gpu_mutex);
+    auto it = gpu_objects[usize(type)].find(id);
+    if (it == gpu_objects[usize(type)].end())
+    {
+        WARNING("Released %s %u, which isn't live. Released twice?", GPU_OBJECT_NAMES[usize(type)], id);
+        return;
+    }
+
+    gpu_bytes[usize(type)] -= it->second;
+    gpu_pending_bytes      += it->second;
+    gpu_releases.push_back({ type, id, it->second, gpu_frame });
+    gpu_objects[usize(type)].erase(it);
+}
+
+
+u64 GetGpuFrame()
+{
+    std::lock_guard<std::mutex> lock(gpu_mutex);
+    return gpu_frame;
+}
+
+u64 GetRetiredGpuFrame()
+{
+    std::lock_guard<std::mutex> lock(gpu_mutex);
+    return gpu_retired;
+}
+
+void EndGpuFrame()
+{
+    std::lock_guard<std::mutex> lock(gpu_mutex);
+    gpu_fences.push_back({ gpu_frame, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) });
+    gpu_frame += 1;
+
+    // Frames retire in order, so the first one that hasn't is as far as it goes.
+    while (!gpu_fences.empty())
+    {
+        const auto status = glClientWaitSync(gpu_fences.front().fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        gpu_retired = gpu_fences.front().frame;
+        glDeleteSync(gpu_fences.front().fence);
+        gpu_fences.pop_front();
+    }
+
+    DeleteRetiredObjects();
+}
+
+void FlushGpuReleases()
+{
+    std::lock_guard<std::mutex> lock(gpu_mutex);
+    glFinish();
+    for (const auto& fence : gpu_fences)
+        glDeleteSync(fence.fence);
+    gpu_fences.clear();
+
+    // Whatever was recorded so far is done, so the frame being recorded counts as retired too.
+    gpu_retired = gpu_frame;
+    gpu_frame  += 1;
+
+    DeleteRetiredObjects();
+}
+
+
+GpuMemory GetGpuMemory()
+{
+    std::lock_guard<std::mutex> lock(gpu_mutex);
+    GpuMemory memory;
+    for (usize i = 0; i < usize(GpuObject::COUNT); ++i)
+    {
+        memory.count[i] = gpu_objects[i].size();
+        memory.bytes[i] = gpu_bytes[i];
+    }
+    memory.pending_count = gpu_releases.size();
+    memory.pending_bytes = gpu_pending_bytes;
+    return memory;
+}
+
+void ReportGpuMemory()
+{
+    constexpr double MB = 1024.0 * 1024.0;
+
+    const auto memory = GetGpuMemory();
+    INFO("GPU memory: %.2f MB.", double(memory.total()) / MB);
+    for (usize i = 0; i < usize(GpuObject::COUNT); ++i)
+        INFO("    %-13s %6zu live %8.2f MB", GPU_OBJECT_NAMES[i], memory.count[i], double(memory.bytes[i]) / MB);
+    if (memory.pending_count)
+        INFO("    %-13s %6zu      %8.2f MB", "pending", memory.pending_count, double(memory.pending_bytes) / MB);
+}
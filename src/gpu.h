@@ -0,0 +1,104 @@
+#pragma once
+
+#include <utility>
+
+#include <glad/glad.h>
+
+#include "types.h"
+
+
+// Every GL buffer, texture and vertex array goes through here, from creation to deletion, so there's one place that
+// knows what's on the GPU and how large it is.
+//
+// Objects aren't deleted when they're released, since draws that were already issued may still use them. They're
+// deleted once the GPU has retired the frame they were released in, which EndGpuFrame finds out from a fence per frame.
+// Until then they count as pending. Releasing only queues the object, so it can be done from any thread; everything
+// else has to be on the thread owning the GL context.
+enum class GpuObject { BUFFER, TEXTURE, VERTEX_ARRAY, COUNT };
+
+// A new object of 'type', with no storage.
+GLuint CreateGpuObject(GpuObject type);
+
+// Call whenever the object's storage is (re)specified, with its size in bytes.
+void ResizeGpuObject(GpuObject type, GLuint id, usize bytes);
+
+// Deletes the object once the frame being recorded is retired. 0 is ignored.
+void ReleaseGpuObject(GpuObject type, GLuint id);
+
+// Frames are counted from 1.
+u64 GetGpuFrame();          // The one being recorded.
+u64 GetRetiredGpuFrame();   // The last one the GPU is done with, or 0.
+
+// Fences the frame being recorded and deletes what was released in the frames that have retired since. Doesn't wait
+// for the GPU. Call once per frame, after its draws.
+void EndGpuFrame();
+
+// Waits for the GPU and deletes everything that was released.
+void FlushGpuReleases();
+
+
+struct GpuMemory
+{
+    usize count[usize(GpuObject::COUNT)] = {};
+    usize bytes[usize(GpuObject::COUNT)] = {};
+    usize pending_count = 0;    // Released, but maybe still in use.
+    usize pending_bytes = 0;
+
+    [[nodiscard]] usize total() const noexcept
+    {
+        usize total = this->pending_bytes;
+        for (const auto bytes : this->bytes)
+            total += bytes;
+        return total;
+    }
+};
+
+GpuMemory GetGpuMemory();
+void ReportGpuMemory();
+
+
+// Owns a GL object and releases it when it goes away. Move only.
+template <GpuObject Type>
+class GpuHandle
+{
+public:
+    GpuHandle() = default;
+    GpuHandle(const GpuHandle&) = delete;
+    GpuHandle& operator= (const GpuHandle&) = delete;
+    GpuHandle(GpuHandle&& other) noexcept : id(std::exchange(other.id, 0)) {}
+    GpuHandle& operator= (GpuHandle&& other) noexcept
+    {
+        if (this != &other)
+        {
+            this->reset();
+            this->id = std::exchange(other.id, 0);
+        }
+        return *this;
+    }
+    ~GpuHandle() { this->reset(); }
+
+    static GpuHandle create()
+    {
+        GpuHandle handle;
+        handle.id = CreateGpuObject(Type);
+        return handle;
+    }
+
+    void resize(usize bytes) const { ResizeGpuObject(Type, this->id, bytes); }
+
+    void reset()
+    {
+        ReleaseGpuObject(Type, this->id);
+        this->id = 0;
+    }
+
+    [[nodiscard]] GLuint get() const noexcept { return this->id; }
+    explicit operator bool() const noexcept { return this->id; }
+
+private:
+    GLuint id = 0;
+};
+
+using GpuBuffer      = GpuHandle<GpuObject::BUFFER>;
+using GpuTexture     = GpuHandle<GpuObject::TEXTURE>;
+using GpuVertexArray = GpuHandle<GpuObject::VERTEX_ARRAY>;
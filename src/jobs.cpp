@@ -0,0 +1,101 @@
+#include "jobs.h"
+
+#include <algorithm>
+#include <atomic>
+
+
+ThreadPool::ThreadPool(usize worker_count)
+{
+    this->threads.reserve(worker_count);
+    for (usize i = 0; i < worker_count; ++i)
+        this->threads.emplace_back([this]() { this->run(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->condition.notify_all();
+
+    for (auto& thread : this->threads)
+        thread.join();
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+
+void ThreadPool::push(std::function<void()>&& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->queue.push_back(std::move(job));
+    }
+    this->condition.notify_one();
+}
+
+void ThreadPool::run()
+{
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->condition.wait(lock, [this]() { return this->stopping || !this->queue.empty(); });
+
+            // Drain the queue before stopping so no future is left without a value.
+            if (this->queue.empty())
+                return;
+
+            job = std::move(this->queue.front());
+            this->queue.pop_front();
+        }
+        job();
+    }
+}
+
+
+void ThreadPool::parallel_for(usize count, const std::function<void(usize)>& job)
+{
+    if (count == 0)
+        return;
+
+    struct State
+    {
+        std::atomic<usize>      next { 0 };
+        std::atomic<usize>      done { 0 };
+        std::mutex              mutex;
+        std::condition_variable finished;
+    };
+
+    // Helpers may only get to run after we've returned (when every worker is busy), so they share ownership of the
+    // state. They never touch 'job' unless they claim an index, and claiming one means we're still waiting.
+    auto state = std::make_shared<State>();
+    auto work  = [state, count, &job]()
+    {
+        usize i;
+        while ((i = state->next.fetch_add(1)) < count)
+        {
+            job(i);
+            if (state->done.fetch_add(1) + 1 == count)
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    const usize helpers = std::min(count - 1, this->size());
+    for (usize i = 0; i < helpers; ++i)
+        this->push(work);
+
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state, count]() { return state->done.load() == count; });
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "types.h"
+
+
+// Fixed set of worker threads pulling jobs from a shared queue.
+class ThreadPool
+{
+public:
+    // A pool without workers runs everything on the calling thread.
+    explicit ThreadPool(usize worker_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator= (const ThreadPool&) = delete;
+
+    // Process-wide pool, created on first use. One worker less than there are hardware threads, as the thread calling
+    // parallel_for helps out.
+    static ThreadPool& shared();
+
+    template <typename Job>
+    std::future<std::invoke_result_t<Job>> submit(Job&& job)
+    {
+        using Result = std::invoke_result_t<Job>;
+
+        // std::function must be copyable, so the task goes through a shared pointer.
+        auto task   = std::make_shared<std::packaged_task<Result()>>(std::forward<Job>(job));
+        auto result = task->get_future();
+        if (this->threads.empty())
+            (*task)();
+        else
+            this->push([task]() { (*task)(); });
+        return result;
+    }
+
+    // Calls job(i) for every i in [0, count) on the workers and the calling thread, and returns when all are done.
+    // Safe to call from inside a job.
+    void parallel_for(usize count, const std::function<void(usize)>& job);
+
+    // Number of workers, not counting the calling thread.
+    [[nodiscard]] usize size() const noexcept { return this->threads.size(); }
+
+private:
+    void push(std::function<void()>&& job);
+    void run();
+
+    std::vector<std::thread>          threads;
+    std::deque<std::function<void()>> queue;
+    std::mutex                        mutex;
+    std::condition_variable           condition;
+    bool                              stopping = false;
+};
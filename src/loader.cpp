@@ -1,51 +1,105 @@
 #include "loader.h"
 
+#include <algorithm>
 #include <unordered_map>
-
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
+#include <cstring>
+#include <chrono>
+#include <ctime>
 
 #include "debug.h"
+#include "cook.h"
+#include "obj.h"
+#include "optimize.h"
 
 
-// Stolen from SO. Should be temporary.
-struct pair_hash
+// Corners referencing the same position, normal and uv are the same vertex.
+struct CornerHash
 {
-    template <class T1, class T2>
-    std::size_t operator () (const std::pair<T1, T2> &p) const
+    std::size_t operator () (const tinyobj::index_t& corner) const noexcept
     {
-        auto h1 = std::hash<T1>{}(p.first);
-        auto h2 = std::hash<T2>{}(p.second);
-
-        // Mainly for demonstration purposes, i.e. works but is overly simple
-        // In the real world, use sth. like boost.hash_combine
-        return h1 ^ h2;
+        const int data[] = { corner.vertex_index, corner.normal_index, corner.texcoord_index };
+        return HashBytes((const char*) data, sizeof(data));
     }
 };
+struct CornerEqual
+{
+    bool operator () (const tinyobj::index_t& a, const tinyobj::index_t& b) const noexcept
+    {
+        return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+    }
+};
+
 
+static Vertex FetchVertex(const tinyobj::attrib_t& attrib, tinyobj::index_t idx)
+{
+    Vertex vertex {};
+    vertex.position = { attrib.vertices[3*idx.vertex_index+0], attrib.vertices[3*idx.vertex_index+1], attrib.vertices[3*idx.vertex_index+2] };
 
+    // Normals and uv coordinates are optional in OBJ files.
+    if (idx.texcoord_index >= 0)
+        vertex.uv_coord = { attrib.texcoords[2*idx.texcoord_index+0], attrib.texcoords[2*idx.texcoord_index+1] };
+    if (idx.normal_index >= 0)
+        vertex.normal = { attrib.normals[3*idx.normal_index+0], attrib.normals[3*idx.normal_index+1], attrib.normals[3*idx.normal_index+2] };
 
-// TODO(ted): Stupidly slow and probably buggy.
-std::pair<std::vector<SoftwareMesh>, std::vector<SoftwareMaterial>>
-LoadScene(const std::string& input_file, const std::string& material_directory)
+    return vertex;
+}
+
+
+// Appends the unique vertices among 'corners' to 'vertices' and one index per corner to 'indices'. Indices are
+// relative to the first vertex appended.
+static void Deduplicate(const tinyobj::attrib_t& attrib, const tinyobj::index_t* corners, std::size_t corner_count, std::vector<Vertex>& vertices, std::vector<u32>& indices)
 {
-    tinyobj::ObjReaderConfig reader_config;
-    reader_config.mtl_search_path = material_directory;
+    std::unordered_map<tinyobj::index_t, u32, CornerHash, CornerEqual> unique;
+    unique.reserve(corner_count);
+
+    const auto first_vertex = vertices.size();
+    indices.reserve(indices.size() + corner_count);
+    for (std::size_t i = 0; i < corner_count; ++i)
+    {
+        const auto& corner = corners[i];
+        auto [it, inserted] = unique.try_emplace(corner, u32(vertices.size() - first_vertex));
+        if (inserted)
+            vertices.push_back(FetchVertex(attrib, corner));
+        indices.push_back(it->second);
+    }
+}
 
-    tinyobj::ObjReader reader;
 
-    if (!reader.ParseFromFile(input_file, reader_config))
-        ASSERT(!reader.Error().empty(), reader.Error().data());
 
-    if (!reader.Warning().empty())
-        WARNING(reader.Warning().data());
+SoftwareScene LoadScene(const std::string& input_file, const std::string& material_directory, std::vector<MaterialMapRequest>* deferred_maps)
+{
+    const auto cooked_file = CookedScenePath(input_file);
 
-    auto& attrib = reader.GetAttrib();
-    auto& shapes = reader.GetShapes();
-    auto& materials = reader.GetMaterials();
-    
+    if (auto cooked = LoadCookedScene(cooked_file, input_file, material_directory, deferred_maps))
+        return std::move(*cooked);
+
+    auto scene = ParseScene(input_file, material_directory, deferred_maps);
+    if (!CookScene(scene, input_file, cooked_file))
+        WARNING("Couldn't cook '%s' to '%s'.", input_file.data(), cooked_file.data());
+
+    return scene;
+}
+
+
+// TODO(ted): Probably buggy.
+SoftwareScene ParseScene(const std::string& input_file, const std::string& material_directory, std::vector<MaterialMapRequest>* deferred_maps)
+{
+    ObjContents obj;
+    if (!ParseObj(input_file, material_directory, obj))
+        ASSERT(!obj.error.empty(), obj.error.data());
+
+    if (!obj.warning.empty())
+        WARNING(obj.warning.data());
+
+    auto& attrib = obj.attrib;
+    auto& shapes = obj.shapes;
+    auto& materials = obj.materials;
     
-    std::vector<SoftwareMaterial> all_materials;
+
+    SoftwareScene scene;
+    scene.material_files = std::move(obj.material_files);
+
+    auto& all_materials = scene.materials;
     all_materials.reserve(materials.size());
     for (const auto& material : materials)
         all_materials.emplace_back(SoftwareMaterial {
@@ -55,112 +109,410 @@ LoadScene(const std::string& input_file, const std::string& material_directory)
             { material.specular[0], material.specular[1], material.specular[2] },
             material.shininess, 0.0, 1.0,
             (material.illum == 1) ? SoftwareMaterial::NO_SPECULAR : SoftwareMaterial::HAS_SPECULAR,
-            (material.ambient_texname.size()  > 0) ? std::move(Image::from_path(material.ambient_texname,  material_directory)) : std::optional<Image>(),
-            (material.diffuse_texname.size()  > 0) ? std::move(Image::from_path(material.diffuse_texname,  material_directory)) : std::optional<Image>(),
-            (material.specular_texname.size() > 0) ? std::move(Image::from_path(material.specular_texname, material_directory)) : std::optional<Image>(),
-            (material.bump_texname.size()     > 0) ? std::move(Image::from_path(material.bump_texname,     material_directory)) : std::optional<Image>(),
-            (material.alpha_texname.size()    > 0) ? std::move(Image::from_path(material.alpha_texname,    material_directory)) : std::optional<Image>()
         });
+
+    // The maps are decoded together afterwards, as that's where most of the load time goes.
+    std::vector<MaterialMapRequest> maps;
+    for (std::size_t i = 0; i < materials.size(); ++i)
+    {
+        const auto& material = materials[i];
+        auto&       result   = all_materials[i];
+
+        // Until decoded, the maps only have their names, which is all cooking needs.
+        auto request = [&maps, &material_directory, i](std::optional<Image>& map, const std::string& name, bool color) {
+            if (name.empty())
+                return;
+            map = Image { 0, 0, 0, nullptr, name, material_directory };
+            maps.push_back({ &map, name, i, color });
+        };
+
+        request(result.ambient_map,  material.ambient_texname,  true);
+        request(result.diffuse_map,  material.diffuse_texname,  true);
+        request(result.specular_map, material.specular_texname, false);
+        request(result.bump_map,     material.bump_texname,     false);
+        request(result.opaque_map,   material.alpha_texname,    false);
+    }
+    if (deferred_maps)
+        *deferred_maps = std::move(maps);
+    else
+        LoadMaterialMaps(maps, material_directory);
     
     
 
-    std::unordered_map<std::pair<std::size_t, std::size_t>, SoftwareMesh, pair_hash> meshes;
-    for (size_t s = 0; s < shapes.size(); s++)
+    // One mesh per (shape, material). First count the corners of each, then copy them into one array where each mesh
+    // is contiguous, ordered by material and then by shape.
+    struct Group { std::size_t shape; int material; std::size_t first, count; };
+    std::vector<Group> groups;
+
+    // Faces without a material use slot 0.
+    constexpr std::size_t NO_GROUP = std::size_t(-1);
+    std::vector<std::size_t> group_of(materials.size() + 1, NO_GROUP);
+
+    std::vector<std::size_t> shape_groups;
+    std::vector<std::size_t> first_group_of_shape(shapes.size() + 1);
+    for (std::size_t s = 0; s < shapes.size(); ++s)
     {
-        std::vector<Vertex> vertices;
-        size_t index_offset = 0;
-        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++)
-        {
-            auto m  = shapes[s].mesh.material_ids[f];  // per-face material
-            auto i  = std::pair(std::size_t(s), std::size_t(m));
-            auto it = meshes.find(i);
-            if (it == meshes.end())
-            {
-                meshes[i] = std::move(SoftwareMesh {
-                    i.first, i.second, shapes[s].name, {}, &all_materials[m]
-                });
-            };
+        const auto& mesh = shapes[s].mesh;
+        first_group_of_shape[s] = groups.size();
 
-            auto& mesh = meshes[i];
+        for (std::size_t f = 0; f < mesh.num_face_vertices.size(); ++f)
+        {
+            const int m = mesh.material_ids[f];
+            ASSERT(m >= -1 && m < int(materials.size()), "Face %zu of shape '%s' has an invalid material %d.", f, shapes[s].name.data(), m);
 
-            int fv = shapes[s].mesh.num_face_vertices[f];
-            for (size_t v = 0; v < fv; v++)
+            auto& group = group_of[std::size_t(m + 1)];
+            if (group == NO_GROUP)
             {
-                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                tinyobj::real_t vx = attrib.vertices[3*idx.vertex_index+0];
-                tinyobj::real_t vy = attrib.vertices[3*idx.vertex_index+1];
-                tinyobj::real_t vz = attrib.vertices[3*idx.vertex_index+2];
-                tinyobj::real_t nx = attrib.normals[3*idx.normal_index+0];
-                tinyobj::real_t ny = attrib.normals[3*idx.normal_index+1];
-                tinyobj::real_t nz = attrib.normals[3*idx.normal_index+2];
-                tinyobj::real_t tx = attrib.texcoords[2*idx.texcoord_index+0];
-                tinyobj::real_t ty = attrib.texcoords[2*idx.texcoord_index+1];
-                mesh.vertices.push_back({
-                   {vx, vy, vz}, {tx, ty}, {nx, ny, nz}
-               });
+                group = groups.size();
+                groups.push_back({ s, m, 0, 0 });
             }
-            index_offset += fv;
+            groups[group].count += mesh.num_face_vertices[f];
+        }
+
+        // Reset only the slots this shape touched.
+        for (std::size_t g = first_group_of_shape[s]; g < groups.size(); ++g)
+            group_of[std::size_t(groups[g].material + 1)] = NO_GROUP;
+    }
+    first_group_of_shape[shapes.size()] = groups.size();
+
+    std::vector<std::size_t> order(groups.size());
+    for (std::size_t g = 0; g < groups.size(); ++g)
+        order[g] = g;
+    std::stable_sort(order.begin(), order.end(), [&groups](std::size_t a, std::size_t b) {
+        return groups[a].material < groups[b].material;
+    });
+
+    std::size_t total_corners = 0;
+    for (auto g : order)
+    {
+        groups[g].first = total_corners;
+        total_corners  += groups[g].count;
+    }
+
+    std::vector<tinyobj::index_t> corners(total_corners);
+    for (std::size_t s = 0; s < shapes.size(); ++s)
+    {
+        const auto& mesh = shapes[s].mesh;
+
+        for (std::size_t g = first_group_of_shape[s]; g < first_group_of_shape[s + 1]; ++g)
+            group_of[std::size_t(groups[g].material + 1)] = g;
+
+        std::size_t index_offset = 0;
+        for (std::size_t f = 0; f < mesh.num_face_vertices.size(); ++f)
+        {
+            auto& group = groups[group_of[std::size_t(mesh.material_ids[f] + 1)]];
+            const std::size_t count = mesh.num_face_vertices[f];
+            std::copy_n(mesh.indices.begin() + index_offset, count, corners.begin() + group.first);
+            group.first  += count;
+            index_offset += count;
+        }
+    }
+
+    // 'first' was moved past the end of each group while filling.
+    for (auto& group : groups)
+        group.first -= group.count;
+
+    // Pack all meshes into one block so the scene can be written out (and mapped back in) as a single blob. Meshes
+    // small enough get 16-bit indices.
+    struct Range { std::size_t first_vertex, index_offset; };
+    std::vector<Range> ranges;
+    ranges.reserve(groups.size());
+    scene.meshes.reserve(groups.size());
+
+    // Every corner being a unique vertex is the worst case. The excess is given back below.
+    scene.vertex_storage.reserve(total_corners);
+    scene.index_storage.reserve(total_corners * sizeof(u32) + 3 * groups.size());
+
+    VertexCacheStats  before, after;
+    std::vector<u32> indices;
+    for (auto g : order)
+    {
+        const auto& group = groups[g];
+        const auto first_vertex = scene.vertex_storage.size();
+
+        indices.clear();
+        Deduplicate(attrib, corners.data() + group.first, group.count, scene.vertex_storage, indices);
+
+        const auto vertex_count = scene.vertex_storage.size() - first_vertex;
+
+        // Done here, rather than at upload, so cooked scenes keep the result.
+        before += AnalyzeVertexCache(indices.data(), indices.size(), vertex_count);
+        OptimizeMesh(scene.vertex_storage.data() + first_vertex, vertex_count, indices.data(), indices.size());
+        after  += AnalyzeVertexCache(indices.data(), indices.size(), vertex_count);
+
+        const auto index_type   = (vertex_count <= 0x10000) ? IndexType::U16 : IndexType::U32;
+        const auto index_offset = (scene.index_storage.size() + 3) & ~std::size_t(3);
+
+        scene.index_storage.resize(index_offset + indices.size() * std::size_t(index_type));
+        if (index_type == IndexType::U16)
+        {
+            auto* destination = (u16*) (scene.index_storage.data() + index_offset);
+            for (std::size_t j = 0; j < indices.size(); ++j)
+                destination[j] = u16(indices[j]);
+        }
+        else
+        {
+            std::memcpy(scene.index_storage.data() + index_offset, indices.data(), indices.size() * sizeof(u32));
         }
+
+        scene.meshes.push_back(SoftwareMesh {
+            group.shape, std::size_t(group.material), shapes[group.shape].name,
+            nullptr, vertex_count,
+            nullptr, indices.size(), index_type,
+            (group.material >= 0) ? &all_materials[group.material] : nullptr
+        });
+        ranges.push_back({ first_vertex, index_offset });
+    }
+
+    scene.vertex_storage.shrink_to_fit();
+    scene.index_storage.shrink_to_fit();
+
+    scene.quantization = ComputeQuantization(scene.vertex_storage.data(), scene.vertex_storage.size());
+    const auto quantization_error = MeasureQuantization(scene.vertex_storage.data(), scene.vertex_storage.size(), scene.quantization);
+
+    INFO("Optimized %zu meshes for a %zu entry vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f.", scene.meshes.size(), VERTEX_CACHE_SIZE, before.acmr(), after.acmr(), before.atvr(), after.atvr());
+    INFO("Packing the vertices would introduce an error of at most %g units in position, %g in uv and %.3g degrees in normals.", quantization_error.position, quantization_error.uv_coord, quantization_error.normal);
+
+    for (std::size_t i = 0; i < scene.meshes.size(); ++i)
+    {
+        scene.meshes[i].vertices = scene.vertex_storage.data() + ranges[i].first_vertex;
+        scene.meshes[i].indices  = scene.index_storage.data()  + ranges[i].index_offset;
     }
 
-    std::vector<SoftwareMesh> all_meshes;
-    all_meshes.reserve(meshes.size());
+    return scene;
+}
+
 
-    for(auto it : meshes)
-        all_meshes.push_back(it.second);
 
-    return { all_meshes, all_materials };
+void LoadMaterialMaps(const std::vector<MaterialMapRequest>& requests, const std::string& material_directory)
+{
+    if (requests.empty())
+        return;
+
+    // Materials often share maps. Decode each file once and hand out copies, which share the pixels. A file used both as
+    // a color and a data map is filtered as whichever came first.
+    std::unordered_map<std::string, std::size_t> first_request;
+    std::vector<std::size_t> unique;
+    for (std::size_t i = 0; i < requests.size(); ++i)
+        if (first_request.try_emplace(requests[i].name, i).second)
+            unique.push_back(i);
+
+    using Clock = std::chrono::steady_clock;
+    std::vector<double> times(unique.size());
+
+    // Decode times are in CPU time of the decoding thread, so they don't include time spent waiting for a core. The
+    // speedup then compares against decoding everything on one thread.
+    auto thread_time = []() {
+        timespec time {};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+        return double(time.tv_sec) * 1000.0 + double(time.tv_nsec) / 1000000.0;
+    };
+
+    // NOTE(ted): stb_image keeps no state between calls, except the failure reason which we don't use. Compressing
+    // also runs on the pool, so the time of a map that's cooked for the first time only includes part of that work.
+    auto& pool = ThreadPool::shared();
+    const auto start = Clock::now();
+    pool.parallel_for(unique.size(), [&requests, &unique, &times, &material_directory, &thread_time](usize i) {
+        const auto& request = requests[unique[i]];
+        const double begin = thread_time();
+        *request.image = LoadCompressedImage(request.name, material_directory, request.color);
+        times[i] = thread_time() - begin;
+    });
+    const double total = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    // Copies share the pixels (or the mapped blocks) of the first.
+    for (std::size_t i = 0; i < requests.size(); ++i)
+    {
+        const auto  first = first_request[requests[i].name];
+        const auto& image = *requests[first].image;
+        if (first == i)
+            continue;
+
+        *requests[i].image = *image;
+        if (image->data)
+            CountSharedImage(*image);
+    }
+
+    double serial = 0.0;
+    for (std::size_t i = 0; i < unique.size(); ++i)
+    {
+        const auto& request = requests[unique[i]];
+        const auto& image   = **request.image;
+        INFO("  %8.2f ms  %s (%ix%i, %i channels)", times[i], request.name.data(), image.width, image.height, image.channels);
+        serial += times[i];
+    }
+    INFO("Loaded %zu textures (%zu uses) in %.2f ms on %zu threads (%.2f ms of loading, %.2fx speedup).", unique.size(), requests.size(), total, pool.size() + 1, serial, serial / total);
 }
 
 
+Quantization ComputeQuantization(const SoftwareScene& scene)
+{
+    bool  empty = true;
+    vec3  min   = vec3(0.0f);
+    vec3  max   = vec3(0.0f);
+    for (const auto& mesh : scene.meshes)
+    {
+        if (mesh.vertex_count == 0)
+            continue;
 
-std::vector<Vertex> LoadAsset(const std::string& input_file, const std::string& material_directory)
+        const auto bounds = ComputeQuantization(mesh.vertices, mesh.vertex_count);
+        min   = empty ? bounds.offset : glm::min(min, bounds.offset);
+        max   = empty ? bounds.offset + bounds.scale : glm::max(max, bounds.offset + bounds.scale);
+        empty = false;
+    }
+    return empty ? Quantization() : Quantization{ min, max - min };
+}
+
+
+void ReleasePixels(SoftwareScene& scene)
 {
-    tinyobj::ObjReaderConfig reader_config;
-    reader_config.mtl_search_path = material_directory; // "./"; // Path to material files
+    for (auto& material : scene.materials)
+        for (auto* map : { &material.ambient_map, &material.diffuse_map, &material.specular_map, &material.bump_map, &material.opaque_map })
+            if (*map)
+                (*map)->release();
+}
 
-    tinyobj::ObjReader reader;
 
-    if (!reader.ParseFromFile(input_file, reader_config))
-        ASSERT(!reader.Error().empty(), reader.Error().data());
 
-    if (!reader.Warning().empty())
-        WARNING(reader.Warning().data());
+std::unique_ptr<AsyncScene> AsyncScene::load(const std::string& input_file, const std::string& material_directory)
+{
+    std::unique_ptr<AsyncScene> result(new AsyncScene());
+    auto* self = result.get();
+
+    self->job = ThreadPool::shared().submit([self, input_file, material_directory]()
+    {
+        std::vector<MaterialMapRequest> maps;
+        auto scene = LoadScene(input_file, material_directory, &maps);
 
-    auto& attrib = reader.GetAttrib();
-    auto& shapes = reader.GetShapes();
-    auto& materials = reader.GetMaterials();
+        // Group the maps and meshes by material. Meshes without maps to wait for go out right away.
+        const auto material_count = scene.materials.size();
+        std::vector<std::vector<std::size_t>> maps_of(material_count);
+        std::vector<std::vector<std::size_t>> meshes_of(material_count);
+        for (std::size_t i = 0; i < maps.size(); ++i)
+            maps_of[maps[i].material].push_back(i);
 
-    std::vector<Vertex> vertices;
-    for (size_t s = 0; s < shapes.size(); s++) {
-        // Loop over faces(polygon)
-        size_t index_offset = 0;
-        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-            int fv = shapes[s].mesh.num_face_vertices[f];
+        std::vector<std::size_t> materials_to_load;
+        for (std::size_t material = 0; material < material_count; ++material)
+            if (!maps_of[material].empty())
+                materials_to_load.push_back(material);
 
-            // Loop over vertices in the face.
-            for (size_t v = 0; v < fv; v++) {
-                // access to vertex
-                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                tinyobj::real_t vx = attrib.vertices[3*idx.vertex_index+0];
-                tinyobj::real_t vy = attrib.vertices[3*idx.vertex_index+1];
-                tinyobj::real_t vz = attrib.vertices[3*idx.vertex_index+2];
-                tinyobj::real_t nx = attrib.normals[3*idx.normal_index+0];
-                tinyobj::real_t ny = attrib.normals[3*idx.normal_index+1];
-                tinyobj::real_t nz = attrib.normals[3*idx.normal_index+2];
-                tinyobj::real_t tx = attrib.texcoords[2*idx.texcoord_index+0];
-                tinyobj::real_t ty = attrib.texcoords[2*idx.texcoord_index+1];
-                vertices.push_back({
-                   {vx, vy, vz}, {tx, ty}, {nx, ny, nz}
-                });
+        {
+            std::lock_guard<std::mutex> lock(self->mutex);
+            for (std::size_t i = 0; i < scene.meshes.size(); ++i)
+            {
+                const auto* material = scene.meshes[i].material;
+                if (material && !maps_of[material - scene.materials.data()].empty())
+                    meshes_of[material - scene.materials.data()].push_back(i);
+                else
+                    self->ready.push_back(i);
             }
-            index_offset += fv;
 
-            // per-face material
-            shapes[s].mesh.material_ids[f];
+            // Moving the scene keeps the materials where they are, so 'maps' still points into it.
+            self->data       = std::move(scene);
+            self->mesh_count = self->data.meshes.size();
+            self->has_meshes = true;
         }
+
+        // Each file is decoded (and cooked) once, by whichever material gets to it first. The others wait for it and
+        // take a copy, which shares the pixels. As in LoadMaterialMaps, a file used both as a color and a data map is
+        // filtered as whichever came first.
+        std::unordered_map<std::string, std::size_t> first_request;
+        for (std::size_t i = 0; i < maps.size(); ++i)
+            first_request.try_emplace(maps[i].name, i);
+        std::unique_ptr<std::once_flag[]> decoded(new std::once_flag[maps.size()]);
+
+        // A material's meshes are released as soon as all of its maps are decoded.
+        ThreadPool::shared().parallel_for(materials_to_load.size(), [self, &maps, &maps_of, &meshes_of, &materials_to_load, &material_directory, &first_request, &decoded](usize i)
+        {
+            const auto material = materials_to_load[i];
+            for (auto map : maps_of[material])
+            {
+                const auto  first   = first_request.at(maps[map].name);
+                const auto& request = maps[first];
+                std::call_once(decoded[first], [&request, &material_directory]() {
+                    *request.image = LoadCompressedImage(request.name, material_directory, request.color);
+                });
+
+                if (map == first)
+                    continue;
+
+                const auto& image = *request.image;
+                *maps[map].image = *image;
+                if (image->data)
+                    CountSharedImage(*image);
+            }
+
+            std::lock_guard<std::mutex> lock(self->mutex);
+            self->ready.insert(self->ready.end(), meshes_of[material].begin(), meshes_of[material].end());
+        });
+    });
+
+    return result;
+}
+
+AsyncScene::~AsyncScene()
+{
+    if (this->job.valid())
+        this->job.wait();
+}
+
+const SoftwareMesh* AsyncScene::next()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->ready.empty())
+        return nullptr;
+
+    const auto i = this->ready.front();
+    this->ready.pop_front();
+    this->handed_out += 1;
+    return &this->data.meshes[i];
+}
+
+bool AsyncScene::done()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->has_meshes || this->handed_out != this->mesh_count)
+            return false;
     }
+    return this->job.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
 
-    return vertices;
+SoftwareScene& AsyncScene::scene()
+{
+    ASSERT(this->job.wait_for(std::chrono::seconds(0)) == std::future_status::ready, "Scene is still loading.");
+    return this->data;
 }
 
+Quantization AsyncScene::quantization()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    ASSERT(this->has_meshes, "Scene is still loading its geometry.");
+    return this->data.quantization;
+}
+
+
+
+SoftwareAsset LoadAsset(const std::string& input_file, const std::string& material_directory)
+{
+    ObjContents obj;
+    if (!ParseObj(input_file, material_directory, obj))
+        ASSERT(!obj.error.empty(), obj.error.data());
+
+    if (!obj.warning.empty())
+        WARNING(obj.warning.data());
+
+    auto& attrib = obj.attrib;
+    auto& shapes = obj.shapes;
+
+    // The whole file becomes a single mesh.
+    std::vector<tinyobj::index_t> corners;
+    for (const auto& shape : shapes)
+        corners.insert(corners.end(), shape.mesh.indices.begin(), shape.mesh.indices.end());
+
+    SoftwareAsset asset;
+    Deduplicate(attrib, corners.data(), corners.size(), asset.vertices, asset.indices);
+    OptimizeMesh(asset.vertices.data(), asset.vertices.size(), asset.indices.data(), asset.indices.size());
+
+    return asset;
+}
@@ -1,11 +1,17 @@
 #pragma once
 
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <optional>
 
 #include "maths.h"
 #include "texture.h"
+#include "utils.h"
+#include "types.h"
 
 // newmtl name
 //    defines the name of the material.
@@ -52,17 +58,117 @@ struct SoftwareMaterial
     std::optional<Image> opaque_map   = {};  // map_d
 };
 
+// Value is the size in bytes.
+enum class IndexType : u8
+{
+    U16 = 2, U32 = 4
+};
+
+// Doesn't own its vertices or indices; they live in the 'SoftwareScene' it came from.
 struct SoftwareMesh
 {
-    std::size_t          mesh_id     = 0;
-    std::size_t          material_id = 0;
-    std::string          name        = "";
-    std::vector<Vertex>  vertices    = {};
-    SoftwareMaterial*    material    = nullptr;
+    std::size_t          mesh_id      = 0;
+    std::size_t          material_id  = 0;
+    std::string          name         = "";
+    const Vertex*        vertices     = nullptr;
+    std::size_t          vertex_count = 0;
+    const void*          indices      = nullptr;
+    std::size_t          index_count  = 0;
+    IndexType            index_type   = IndexType::U32;
+    SoftwareMaterial*    material     = nullptr;
+
+    [[nodiscard]] u32 index(std::size_t i) const noexcept
+    {
+        if (this->index_type == IndexType::U16)
+            return static_cast<const u16*>(this->indices)[i];
+        else
+            return static_cast<const u32*>(this->indices)[i];
+    }
+};
+
+// Must outlive anything holding on to its meshes or materials. Move-only.
+struct SoftwareScene
+{
+    std::vector<SoftwareMesh>     meshes    = {};
+    std::vector<SoftwareMaterial> materials = {};
+    std::vector<std::string>      material_files = {};  // The .mtl files 'materials' were read from.
+
+    // Bounds of all the meshes. Packing every mesh against these (see CreateMesh) lets them share the uniforms that
+    // unpack the positions, so they can be drawn together.
+    Quantization quantization = {};
+
+    // Backing memory for the meshes. Owned when parsed from source, a view into 'cooked_file' when loaded from cache.
+    // Each mesh's indices start on a 4 byte boundary in 'index_storage'.
+    std::vector<Vertex>  vertex_storage = {};
+    std::vector<u8>      index_storage  = {};
+    MappedFile           cooked_file    = {};
+};
+
+// A texture map waiting to be decoded into 'image'.
+struct MaterialMapRequest
+{
+    std::optional<Image>* image    = nullptr;
+    std::string           name     = "";
+    std::size_t           material = 0;    // Index of the material the map belongs to.
+    bool                  color    = false; // Ambient and diffuse maps hold sRGB colors, the others linear data.
+};
+
+struct SoftwareAsset
+{
+    std::vector<Vertex> vertices = {};
+    std::vector<u32>    indices  = {};
 };
 
 
 
-std::vector<Vertex> LoadAsset(const std::string& input_file, const std::string& material_directory = "");
-std::pair<std::vector<SoftwareMesh>, std::vector<SoftwareMaterial>>
-LoadScene(const std::string& input_file, const std::string& material_directory = "");
\ No newline at end of file
+SoftwareAsset LoadAsset(const std::string& input_file, const std::string& material_directory = "");
+
+// Loads the cooked version of the scene if it's up to date, otherwise parses the source and cooks it for next time.
+// With 'deferred_maps', the material maps are left for the caller to decode (they point into the returned scene).
+SoftwareScene LoadScene(const std::string& input_file, const std::string& material_directory = "", std::vector<MaterialMapRequest>* deferred_maps = nullptr);
+SoftwareScene ParseScene(const std::string& input_file, const std::string& material_directory = "", std::vector<MaterialMapRequest>* deferred_maps = nullptr);
+
+// Decodes all maps at once on the shared worker pool and logs how long each took.
+void LoadMaterialMaps(const std::vector<MaterialMapRequest>& requests, const std::string& material_directory);
+
+// Lets go of the decoded maps, e.g. once they've been uploaded. Their names and sizes are kept.
+void ReleasePixels(SoftwareScene& scene);
+
+// Bounds of the vertices of all meshes in the scene.
+Quantization ComputeQuantization(const SoftwareScene& scene);
+
+
+// A scene loading on the worker pool. The geometry is loaded first, then each mesh is handed out as soon as the maps
+// of its material are decoded. Meant to be polled from the main thread every frame.
+class AsyncScene
+{
+public:
+    // Returns right away.
+    static std::unique_ptr<AsyncScene> load(const std::string& input_file, const std::string& material_directory = "");
+
+    // Waits for the loading to finish.
+    ~AsyncScene();
+
+    // The next mesh that's ready, or nullptr if there's none right now. It lives as long as the AsyncScene.
+    const SoftwareMesh* next();
+
+    // True once every mesh has been handed out and nothing is left loading.
+    [[nodiscard]] bool done();
+
+    // The whole scene. Only to be touched once done().
+    SoftwareScene& scene();
+
+    // The scene's quantization, known from the first mesh next() hands out on.
+    [[nodiscard]] Quantization quantization();
+
+private:
+    AsyncScene() = default;
+
+    std::mutex              mutex;
+    SoftwareScene           data;
+    std::deque<std::size_t> ready;                  // Indices into data.meshes.
+    std::size_t             mesh_count  = 0;
+    std::size_t             handed_out  = 0;
+    bool                    has_meshes  = false;    // Whether 'data' has been filled in.
+    std::future<void>       job;
+};
\ No newline at end of file
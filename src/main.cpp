@@ -2,7 +2,12 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <entt/entt.hpp>
 
+#include <cmath>
+#include <deque>
+#include <limits>
+
 #include "window.h"
+#include "gpu.h"
 #include "shader.h"
 #include "utils.h"
 #include "loader.h"
@@ -22,6 +27,17 @@ static constexpr vec3 WHITE   {1.0f, 1.0f, 1.0f};
 static constexpr vec3 BLACK   {0.0f, 0.0f, 0.0f};
 
 
+// Bytes of vertices, indices and pixels to upload per frame while a scene is loading.
+static constexpr std::size_t UPLOAD_BUDGET = 8 * 1024 * 1024;
+
+// VRAM for textures, and how much of it may be streamed in per frame.
+static constexpr std::size_t TEXTURE_BUDGET        = 256 * 1024 * 1024;
+static constexpr std::size_t TEXTURE_STREAM_BUDGET = 8 * 1024 * 1024;
+
+// Static meshes are uploaded quantized, at half the size.
+static constexpr VertexFormat VERTEX_FORMAT = VertexFormat::PACKED;
+
+
 static constexpr vec3 WORLD_AXIS_RIGHT   = vec3(1.0f,  0.0f,  0.0f);
 static constexpr vec3 WORLD_AXIS_UP      = vec3(0.0f,  1.0f,  0.0f);
 static constexpr vec3 WORLD_AXIS_FORWARD = vec3(0.0f,  0.0f, -1.0f);
@@ -35,9 +51,11 @@ struct Transform
 };
 struct Renderable
 {
-     vec3     color;
-     Mesh*    mesh;
-     Texture* texture;
+     vec3        color;
+     Mesh*       mesh;
+     TextureSlot texture;
+     vec3        center;    // Bounding sphere, in world space.
+     float       radius;
 };
 struct HitBox
 {
@@ -263,93 +281,207 @@ std::tuple<mat4, mat4> UpdateCamera(entt::registry& registry, entt::entity camer
     return {view, projection};
 }
 
-void Render(entt::registry& registry, const Shader& shader, entt::entity camera)
+// Asks for the mip level of each texture that matches how large its mesh is on screen. Assumes the texture is mapped
+// once over the mesh, so tiled textures end up a bit blurrier than they could be.
+void RequestMips(entt::registry& registry, TextureArrays& textures, entt::entity camera)
+{
+    const auto& data = registry.get<Camera>(camera);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const float pixels_per_unit = float(viewport[3]) / (2.0f * std::tan(glm::radians(data.fov) / 2.0f));
+
+    for (auto [entity, renderable]: registry.view<const Renderable>().each())
+    {
+        const float distance  = std::max(glm::length(renderable.center - data.position) - renderable.radius, data.near);
+        const float footprint = 2.0f * renderable.radius * pixels_per_unit / distance;
+        textures.request(renderable.texture, footprint);
+    }
+}
+
+mat4 ModelMatrix(const Transform& transform)
+{
+    mat4 model = glm::translate(mat4(1.0f), transform.position);
+    if (transform.rotation != vec3(0.0f))
+    {
+        model = glm::rotate(model, glm::radians(transform.rotation.x), vec3(1.0f, 0.0f, 0.0f));
+        model = glm::rotate(model, glm::radians(transform.rotation.y), vec3(0.0f, 1.0f, 0.0f));
+        model = glm::rotate(model, glm::radians(transform.rotation.z), vec3(0.0f, 0.0f, 1.0f));
+    }
+    return glm::scale(model, vec3(transform.scale));
+}
+
+void Render(entt::registry& registry, const Shader& shader, InstanceBuffer& instances, entt::entity camera)
 {
     auto [view, projection] = UpdateCamera(registry, camera);
 
     glEnable(GL_DEPTH_TEST);
-    glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
+
+    // Diffuse maps are sRGB, so they're sampled in linear light and have to be encoded again on the way out. The clear
+    // color is linear too; this is the 0.3 gray it's always been.
+    glEnable(GL_FRAMEBUFFER_SRGB);
+    glClearColor(0.073f, 0.073f, 0.073f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
-    glUseProgram(shader.id);
-    auto model = glm::mat4();
-    model = glm::translate(model, vec3(0));
-//    model = glm::rotate(model, glm::radians(transform.rotation.x), vec3(1.0f, 0.0f, 0.0f));
-//    model = glm::rotate(model, glm::radians(transform.rotation.y), vec3(0.0f, 1.0f, 0.0f));
-//    model = glm::rotate(model, glm::radians(transform.rotation.z), vec3(0.0f, 0.0f, 1.0f));
-//    model = glm::scale(model, vec3(transform.scale, transform.scale, transform.scale));
-    SetUniform(shader, "model", model);
-    SetUniform(shader, "view",  view);
-    SetUniform(shader, "projection", projection);
-    GLuint bound_mesh_id = -1;
+    // Renderables are sorted by texture array, mesh and layer, so entities drawing the same mesh with the same texture
+    // are next to each other. Each run of them goes out as one instanced draw, with their model matrices next to each
+    // other in 'instances'. Runs of a single entity that share the vertex array, texture and model matrix with the ones
+    // after them (like all of the scene, which is in world space) go out together as one DrawBatch instead.
+    struct Run
+    {
+        const Mesh* mesh;
+        TextureSlot texture;
+        size_t      first;
+        GLsizei     count;
+    };
+    static std::vector<mat4> models;
+    static std::vector<Run>  runs;
+    static DrawBatch         batch;
+    models.clear();
+    runs.clear();
     for (auto [entity, transform, renderable]: registry.view<const Transform, const Renderable>().each())
     {
-        if (bound_mesh_id != renderable.mesh->id)
+        const bool same_run = !runs.empty() && runs.back().mesh == renderable.mesh &&
+                              runs.back().texture.array == renderable.texture.array && runs.back().texture.layer == renderable.texture.layer;
+        if (same_run)
+            runs.back().count += 1;
+        else
+            runs.push_back({ renderable.mesh, renderable.texture, models.size(), 1 });
+        models.push_back(ModelMatrix(transform));
+    }
+    instances.upload(models.data(), models.size());
+
+    glUseProgram(shader.id);
+    SetUniform(shader, UNIFORM("view"),  view);
+    SetUniform(shader, UNIFORM("projection"), projection);
+
+    // Texture arrays are only rebound when the next one starts, and so on.
+    const GLint  layer_location = GetUniformLocation(shader, UNIFORM("diffuse_layer"));
+    GLuint       bound_mesh_id  = -1;
+    GLuint       bound_array_id = 0;
+    GLint        bound_layer    = -1;
+    Quantization bound_quantization = { vec3(NAN), vec3(NAN) };
+    size_t       bound_first    = SIZE_MAX;   // Instance attributes are state of the vertex array.
+
+    // Whether 'next' can be drawn with 'run' by the same DrawBatch, without changing any state in between.
+    auto mergeable = [](const Run& run, const Run& next) {
+        return run.count == 1 && next.count == 1 && run.mesh->id == next.mesh->id && run.mesh->index_type == next.mesh->index_type &&
+               run.texture.array == next.texture.array && run.texture.layer == next.texture.layer &&
+               run.mesh->quantization.offset == next.mesh->quantization.offset && run.mesh->quantization.scale == next.mesh->quantization.scale &&
+               models[run.first] == models[next.first];
+    };
+
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        const auto& run  = runs[i];
+        const auto& mesh = *run.mesh;
+        if (bound_mesh_id != mesh.id)
+        {
+            glBindVertexArray(mesh.id);
+            bound_mesh_id = mesh.id;
+            bound_first   = SIZE_MAX;
+        }
+        if (mesh.quantization.offset != bound_quantization.offset || mesh.quantization.scale != bound_quantization.scale)
         {
-            glBindVertexArray(renderable.mesh->id);
-            bound_mesh_id = renderable.mesh->id;
+            SetUniform(shader, UNIFORM("position_offset"), mesh.quantization.offset);
+            SetUniform(shader, UNIFORM("position_scale"),  mesh.quantization.scale);
+            bound_quantization = mesh.quantization;
+        }
+        if (bound_array_id != run.texture.array)
+        {
+            SetTextureArray(shader, UNIFORM("diffuse"), 0, run.texture.array);
+            bound_array_id = run.texture.array;
+        }
+        if (bound_layer != run.texture.layer)
+        {
+            glUniform1f(layer_location, GLfloat(run.texture.layer));
+            bound_layer = run.texture.layer;
+        }
+//        SetUniform(shader,   UNIFORM("object_color"), renderable.color);
+
+        // A single instance only reads the first matrix, so any bound one that's the same will do.
+        const bool same_models = bound_first == run.first || (run.count == 1 && bound_first != SIZE_MAX && models[bound_first] == models[run.first]);
+        if (!same_models)
+        {
+            instances.bind(run.first);
+            bound_first = run.first;
+        }
+
+        // NOTE(ted): A draw that isn't instanced reads the instance attributes of instance 0, so every mesh in the batch
+        //            gets the matrix of the first run.
+        if (i + 1 < runs.size() && mergeable(run, runs[i + 1]))
+        {
+            batch.add(mesh);
+            while (i + 1 < runs.size() && mergeable(run, runs[i + 1]))
+                batch.add(*runs[++i].mesh);
+            batch.draw();
+        }
+        else
+        {
+            DrawMeshInstanced(mesh, run.count);
         }
-        SetTexture2D(shader, "diffuse", 0, renderable.mesh->texture);
-//        SetUniform(shader,   "object_color", renderable.color);
-        glDrawArrays(GL_TRIANGLES, 0, renderable.mesh->count);
     }
     glUseProgram(0);
 }
 
 
+// Entities own their mesh, so its vertices and indices go along with them.
+void ReleaseMesh(MeshArena& geometry, entt::registry& registry, entt::entity entity)
+{
+    geometry.remove(*registry.get<Renderable>(entity).mesh);
+}
+
+
 int main()
 {
     entt::registry registry;
     Window window = CreateWindow(2880, 1710, "Game");
     glfwSetWindowUserPointer(window.id, &registry);
 
-    const auto empty_texture = CreateTexture2D(Image::empty());
-
-//    auto [all_meshes, all_materials] = LoadScene("../resources/models/sponza/sponza.obj", "../resources/models/sponza/");
-    auto [all_meshes, all_materials] = LoadScene("../resources/models/cube.obj", "../resources/models/");
-    std::vector<Mesh> meshes;
-    for (const auto& data : all_meshes)
-    {
-        auto mesh = CreateMesh(data.vertices);
-        if (data.material)
-        {
-            auto material = data.material;
+    // Every diffuse map goes in here, so drawing the scene only takes a bind per array.
+    TextureArrays textures(TEXTURE_BUDGET);
+    const auto empty_texture = textures.add(Image::empty());
 
-            if (material->diffuse_map)
-                mesh.texture = CreateTexture2D(material->diffuse_map.value());
-            else
-                mesh.texture = empty_texture;   // TODO(ted): Colored material.
-        }
-        else
-        {
-            mesh.texture = empty_texture;
-        }
+//    auto loader = AsyncScene::load("../resources/models/sponza/sponza.obj", "../resources/models/sponza/");
+    auto loader = AsyncScene::load("../resources/models/cube.obj", "../resources/models/");
 
-        meshes.push_back(mesh);
-    }
+    // Renderables point into this, so it must never move its elements. The vertices and indices are all in 'geometry'.
+    MeshArena        geometry;
+    std::deque<Mesh> meshes;
+    registry.on_destroy<Renderable>().connect<&ReleaseMesh>(geometry);
 
+    InstanceBuffer instances;
     auto shader = CreateShader("Basic", LoadFileToString("../resources/shaders/basic.vs.glsl").get(), LoadFileToString("../resources/shaders/basic.fs.glsl").get());
 
-    float x = -1.0f;
-    int   i = 0;
     auto colors = std::array{ RED, GREEN, BLUE };
-    for (std::size_t i = 0; i < meshes.size(); ++i)
+    auto add_mesh = [&](const SoftwareMesh& data)
     {
-        auto& mesh = meshes[i];
-        auto& data = all_meshes[i];
+        // Packed meshes share the bounds of the scene, so they can be merged into one draw (see Render).
+        auto& mesh = meshes.emplace_back((VERTEX_FORMAT == VertexFormat::PACKED) ? CreateMesh(geometry, data, loader->quantization()) : CreateMesh(geometry, data, VERTEX_FORMAT));
+
+        TextureSlot texture = empty_texture;   // TODO(ted): Colored material.
+        if (data.material && data.material->diffuse_map)
+            texture = textures.add(data.material->diffuse_map.value(), {}, empty_texture);
+
+        vec3 min = vec3(std::numeric_limits<float>::max());
+        vec3 max = vec3(std::numeric_limits<float>::lowest());
+        for (std::size_t i = 0; i < data.vertex_count; ++i)
+        {
+            min = glm::min(min, data.vertices[i].position);
+            max = glm::max(max, data.vertices[i].position);
+        }
+        const vec3 center = data.vertex_count ? (min + max) * 0.5f : vec3(0.0f);
+        const float radius = data.vertex_count ? glm::length(max - min) * 0.5f : 0.0f;
 
         const auto entity = registry.create();
-        registry.emplace<Transform>(entity, vec3{x*data.mesh_id,2.0f,0}, vec3{0,0,0}, 0.3f);
-        registry.emplace<Renderable>(entity, colors[data.material_id % 3], &mesh);
+        registry.emplace<Transform>(entity, vec3{0.0f}, vec3{0.0f}, 1.0f);   // The scene is modelled in world space.
+        registry.emplace<Renderable>(entity, colors[data.material_id % 3], &mesh, texture, center, radius);
 //        registry.emplace<Velocity>(entity, vec3{0, 0, 0}, vec3{0, 0, 0});
 //        registry.emplace<Physics>(entity, 0.005f, HitBox{-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0}, false);
-        x += 1.0f;
-    }
 
-
-    registry.sort<Renderable>([](const auto& lhs, const auto& rhs) {
-        return lhs.mesh->id < rhs.mesh->id;
-    });
+        const std::size_t pixels = (data.material && data.material->diffuse_map) ? data.material->diffuse_map->size() : 0;
+        return data.vertex_count * VertexSize(VERTEX_FORMAT) + data.index_count * std::size_t(data.index_type) + pixels;
+    };
 
 
 //    const auto floor = registry.create();
@@ -364,10 +496,61 @@ int main()
 
     while (!glfwWindowShouldClose(window.id))
     {
+        // Upload whatever finished loading, but only so much per frame to keep the window responsive.
+        if (loader)
+        {
+            std::size_t uploaded = 0;
+            while (uploaded < UPLOAD_BUDGET)
+            {
+                const auto* data = loader->next();
+                if (!data)
+                    break;
+                uploaded += add_mesh(*data);
+            }
+
+            // Transforms are put in the same order, so views of both go through them in this order too.
+            if (uploaded > 0)
+            {
+                registry.sort<Renderable>([](const auto& lhs, const auto& rhs) {
+                    if (lhs.texture.array != rhs.texture.array)
+                        return lhs.texture.array < rhs.texture.array;
+                    if (lhs.mesh->id != rhs.mesh->id)
+                        return lhs.mesh->id < rhs.mesh->id;
+                    if (lhs.texture.layer != rhs.texture.layer)
+                        return lhs.texture.layer < rhs.texture.layer;
+                    return lhs.mesh < rhs.mesh;
+                });
+                registry.sort<Transform, Renderable>();
+            }
+
+            if (loader->done())
+            {
+                // Everything's on the GPU now.
+                ReleasePixels(loader->scene());
+                ReportResidency();
+                INFO("Packed %zu textures into %zu texture arrays.", textures.texture_count(), textures.array_count());
+                ReportTextureMemory();
+                INFO("%zu meshes in %.2f MB of vertices and indices (%.2f MB reserved).", geometry.mesh_count(),
+                     double(geometry.bytes_used()) / (1024.0 * 1024.0), double(geometry.bytes_reserved()) / (1024.0 * 1024.0));
+                ReportGpuMemory();
+                loader = nullptr;
+            }
+        }
+
         Update(registry);
-        Render(registry, shader, camera);
+
+        RequestMips(registry, textures, camera);
+        const auto streaming = textures.update(TEXTURE_STREAM_BUDGET);
+        if (streaming.levels_streamed > 0 || streaming.levels_evicted > 0)
+            INFO("Streamed %zu mip levels (%.2f MB), evicted %zu (%.2f MB). %.2f MB of %.2f MB wanted is resident.",
+                 streaming.levels_streamed, double(streaming.bytes_streamed) / (1024.0 * 1024.0),
+                 streaming.levels_evicted,  double(streaming.bytes_evicted)  / (1024.0 * 1024.0),
+                 double(streaming.bytes_resident) / (1024.0 * 1024.0), double(streaming.bytes_wanted) / (1024.0 * 1024.0));
+
+        Render(registry, shader, instances, camera);
 
         glfwSwapBuffers(window.id);
+        EndGpuFrame();
         glfwPollEvents();
     }
 
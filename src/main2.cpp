@@ -3,6 +3,13 @@
 #include <fstream>
 #include <unordered_map>
 #include <optional>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <future>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
@@ -16,6 +23,10 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "debug.h"
+#include "gpu.h"
+#include "jobs.h"
+#include "uniform.h"
+#include "renderer/opengl/buffer.h"
 
 using glm::vec2;
 using glm::vec3;
@@ -40,6 +51,22 @@ static const RendrererAPI RENDERER_API = RendrererAPI::OpenGL;
 static bool context_created = false;
 
 
+// GL calls that create objects or (re)allocate their storage, counted by the glad debug callback. Once everything is
+// uploaded, a frame should only bind and draw, so these are expected to stay put from one frame to the next.
+static std::size_t gl_objects_created = 0;
+
+static void CountGLObjects(const char* name, void* function, int argument_count, ...)
+{
+    (void) function;
+    (void) argument_count;
+
+    const bool creates   = std::strncmp(name, "glGen", 5) == 0 || std::strncmp(name, "glCreate", 8) == 0;
+    const bool allocates = std::strcmp(name, "glBufferData") == 0 || std::strncmp(name, "glTexImage", 10) == 0;
+    if (creates || allocates)
+        gl_objects_created += 1;
+}
+
+
 enum class ShaderDataType
 {
     None = 0, Float1, Float2, Float3, Float4, Mat3, Mat4, Int, Int2, Int3, Int4, Bool,
@@ -91,27 +118,6 @@ static std::uint32_t ShaderDataTypeSize(ShaderDataType type)
     }
 }
 
-static GLenum ShaderDataTypeToOpenGLBaseType(ShaderDataType type)
-{
-    switch (type)
-    {
-        case ShaderDataType::Float1:    return GL_FLOAT;
-        case ShaderDataType::Float2:    return GL_FLOAT;
-        case ShaderDataType::Float3:    return GL_FLOAT;
-        case ShaderDataType::Float4:    return GL_FLOAT;
-        case ShaderDataType::Mat3:      return GL_FLOAT;
-        case ShaderDataType::Mat4:      return GL_FLOAT;
-        case ShaderDataType::Int:       return GL_INT;
-        case ShaderDataType::Int2:      return GL_INT;
-        case ShaderDataType::Int3:      return GL_INT;
-        case ShaderDataType::Int4:      return GL_INT;
-        case ShaderDataType::Bool:      return GL_BOOL;
-        case ShaderDataType::Texture2D: return GL_SAMPLER_2D;
-        case ShaderDataType::None:      return 0;
-        default: ERROR("Unknown data type!");
-    }
-}
-
 static GLenum ShaderDataTypeToOpenGLType(ShaderDataType type)
 {
     switch (type)
@@ -239,10 +245,12 @@ class Window
 public:
     Window(GLFWwindow* id) : id{id} {}
 
-    static Window Create(int width, int height, const char* name)
+    static Window Create(int width, int height, const char* name, bool visible = true)
     {
         ASSERT(glfwInit(), "Oh no!");
 
+        glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
+
         if (RENDERER_API == RendrererAPI::OpenGL)
         {
             glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -272,6 +280,8 @@ public:
 
 //            if constexpr (DEBUG)
 //                glad_set_post_callback(OpenGLCallback);
+            if constexpr (DEBUG)
+                glad_set_pre_callback(CountGLObjects);
 
             context_created = true;
         }
@@ -305,54 +315,6 @@ private:
 };
 
 
-class BufferElement
-{
-public:
-    std::string      name;
-    ShaderDataType   type;
-    std::uint32_t    size;
-    std::size_t      offset;
-    bool normalized;
-
-    BufferElement() = default;
-
-    BufferElement(ShaderDataType type, const std::string& name, bool normalized = false)
-            : name(name), type(type), size(ShaderDataTypeSize(type)), offset(0), normalized(normalized)
-    {
-    }
-};
-
-class BufferLayout
-{
-public:
-    BufferLayout() {}
-
-    BufferLayout(std::initializer_list<BufferElement> elements)
-            : elements(elements)
-    {
-        size_t offset = 0;
-        this->stride  = 0;
-        for (auto& element : this->elements)
-        {
-            element.offset = offset;
-            offset += element.size;
-            this->stride += element.size;
-        }
-    }
-
-    uint32_t GetStride() const { return this->stride; }
-    const std::vector<BufferElement>& GetElements() const { return this->elements; }
-
-    std::vector<BufferElement>::iterator begin() { return this->elements.begin(); }
-    std::vector<BufferElement>::iterator end()   { return this->elements.end(); }
-    std::vector<BufferElement>::const_iterator begin() const { return this->elements.begin(); }
-    std::vector<BufferElement>::const_iterator end()   const { return this->elements.end(); }
-private:
-    std::vector<BufferElement> elements;
-    uint32_t stride = 0;
-};
-
-
 class Shader
 {
 public:
@@ -374,7 +336,16 @@ public:
     using AttributeMap = std::unordered_map<std::string, ValueInfo>;
     using UniformMap   = std::unordered_map<std::string, ValueInfo>;
 
-    Shader(std::uint32_t id, std::string name, AttributeMap&& attributes, UniformMap&& uniforms) : id{id}, name{name}, attributes{attributes}, uniforms{uniforms} {}
+    Shader(std::uint32_t id, std::string name, AttributeMap&& attributes, UniformMap&& uniforms) : id{id}, name{name}, attributes{attributes}, uniforms{uniforms}
+    {
+        // Arrays are reported as 'name[0]', but can be found by 'name' as well.
+        for (const auto& [uniform_name, info] : this->uniforms)
+        {
+            this->AddUniformLocation(uniform_name.data(), uniform_name.size(), info.index);
+            if (uniform_name.size() > 3 && uniform_name.compare(uniform_name.size() - 3, 3, "[0]") == 0)
+                this->AddUniformLocation(uniform_name.data(), uniform_name.size() - 3, info.index);
+        }
+    }
 
     static Shader Create(const char* name, const char* vertex_source, const char* fragment_source)
     {
@@ -498,30 +469,31 @@ public:
         return { program, name, std::move(attributes), std::move(uniforms) };
     }
 
-    bool Validate(int index, const BufferElement& element) const
+    bool Validate(int index, const VertexAttribute& attribute) const
     {
-        auto it = attributes.find(element.name);
+        auto it = attributes.find(attribute.name);
         if (it == attributes.end())
         {
-            WARNING("Attribute '%s' doesn't exist in shader '%s'.", element.name.data(), this->name.data());
+            WARNING("Attribute '%s' doesn't exist in shader '%s'.", attribute.name, this->name.data());
             return false;
         }
 
         auto info  = it->second;
+        auto type  = OpenGLTypeToShaderDataType(attribute.type);
         bool valid = true;
-        if (info.type != element.type)
+        if (info.type != type)
         {
-            WARNING("Attribute '%s' in shader '%s' has type %i, not %i.", element.name.data(), this->name.data(), info.type, element.type);
+            WARNING("Attribute '%s' in shader '%s' has type %i, not %i.", attribute.name, this->name.data(), info.type, type);
             valid = false;
         }
-        if (info.size != element.size)
+        if (info.size != attribute.size)
         {
-            WARNING("Attribute '%s' in shader '%s' has size %i, not %i.", element.name.data(), this->name.data(), info.size, element.size);
+            WARNING("Attribute '%s' in shader '%s' has size %i, not %i.", attribute.name, this->name.data(), info.size, attribute.size);
             valid = false;
         }
         if (info.index != index)
         {
-            WARNING("Attribute '%s' in shader '%s' has index %i, not %i.", element.name.data(), this->name.data(), info.index, index);
+            WARNING("Attribute '%s' in shader '%s' has index %i, not %i.", attribute.name, this->name.data(), info.index, index);
             valid = false;
         }
 
@@ -541,7 +513,7 @@ public:
     static void Destroy(Shader* shader)
     {
         glDeleteProgram(shader->id);
-        shader = nullptr;
+        shader->id = 0;
     }
 
     void Bind() const
@@ -554,17 +526,51 @@ public:
         glUseProgram(0);
     }
 
-    template <typename T>
-    void SetUniform(const char* name, const T& data)
+    // -1 if the shader doesn't have it, which glUniform* ignores.
+    GLint GetUniformLocation(UniformId uniform) const
     {
+        for (std::size_t i = 0; i < this->uniform_hashes.size(); ++i)
+            if (this->uniform_hashes[i] == uniform.hash)
+                return this->uniform_locations[i];
+        return -1;
+    }
 
+    // The shader has to be bound.
+    void SetUniform(UniformId uniform, int value) const
+    {
+        glUniform1i(this->GetUniformLocation(uniform), value);
+    }
+    void SetUniform(UniformId uniform, float value) const
+    {
+        glUniform1f(this->GetUniformLocation(uniform), value);
+    }
+    void SetUniform(UniformId uniform, const glm::vec3& value) const
+    {
+        glUniform3f(this->GetUniformLocation(uniform), value.x, value.y, value.z);
+    }
+    void SetUniform(UniformId uniform, const glm::mat4& value) const
+    {
+        glUniformMatrix4fv(this->GetUniformLocation(uniform), 1, GL_FALSE, &value[0][0]);
     }
 
 private:
+    void AddUniformLocation(const char* uniform_name, std::size_t length, GLint location)
+    {
+        const auto hash = UniformId::Hash(uniform_name, length);
+        for (const auto existing : this->uniform_hashes)
+            ASSERT(existing != hash, "Uniform '%.*s' in shader '%s' has the same hash as another uniform.", int(length), uniform_name, this->name.data());
+        this->uniform_hashes.push_back(hash);
+        this->uniform_locations.push_back(location);
+    }
+
     std::uint32_t id;
     std::string   name;
     AttributeMap  attributes;
     UniformMap    uniforms;
+
+    // What GetUniformLocation looks in: uniform_locations[i] is where the uniform hashing to uniform_hashes[i] is.
+    std::vector<std::uint32_t> uniform_hashes;
+    std::vector<GLint>         uniform_locations;
 };
 
 class VertexBuffer
@@ -574,27 +580,28 @@ public:
 
     static VertexBuffer Create(std::size_t size)
     {
-        std::uint32_t id;
-        glGenBuffers(1, &id);
+        std::uint32_t id = CreateGpuObject(GpuObject::BUFFER);
         glBindBuffer(GL_ARRAY_BUFFER, id);
         glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+        ResizeGpuObject(GpuObject::BUFFER, id, size);
 
         return { id };
     }
     static VertexBuffer Create(float* vertices, std::size_t size)
     {
-        std::uint32_t id;
-        glGenBuffers(1, &id);
+        std::uint32_t id = CreateGpuObject(GpuObject::BUFFER);
         glBindBuffer(GL_ARRAY_BUFFER, id);
         glBufferData(GL_ARRAY_BUFFER, size, vertices, GL_STATIC_DRAW);
+        ResizeGpuObject(GpuObject::BUFFER, id, size);
 
         return { id };
     }
 
+    // The buffer is deleted once the GPU is done with it (see gpu.h). Copies of it are left dangling.
     static void Destroy(VertexBuffer* buffer)
     {
-        glDeleteBuffers(1, &buffer->id);
-        buffer = nullptr;
+        ReleaseGpuObject(GpuObject::BUFFER, buffer->id);
+        buffer->id = 0;
     }
 
     void Bind() const
@@ -627,19 +634,8 @@ public:
         glBufferSubData(GL_ARRAY_BUFFER, from, to, data);
     }
 
-    void SetLayout(const BufferLayout& layout)
-    {
-        this->layout = layout;
-    }
-
-    const BufferLayout& GetLayout() const
-    {
-        return this->layout;
-    }
-
 private:
     std::uint32_t id;
-    BufferLayout layout;
 };
 
 class IndexBuffer
@@ -649,30 +645,31 @@ public:
 
     static IndexBuffer Create(std::size_t size)
     {
-        std::uint32_t id;
-        glGenBuffers(1, &id);
+        std::uint32_t id = CreateGpuObject(GpuObject::BUFFER);
         glBindBuffer(GL_ARRAY_BUFFER, id);
         glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+        ResizeGpuObject(GpuObject::BUFFER, id, size);
 
         return { id, 0 };
     }
     static IndexBuffer Create(const std::uint32_t* indices, std::size_t size)
     {
-        std::uint32_t id;
-        glGenBuffers(1, &id);
+        std::uint32_t id = CreateGpuObject(GpuObject::BUFFER);
 
         // GL_ELEMENT_ARRAY_BUFFER is not valid without an actively bound VAO
         // Binding with GL_ARRAY_BUFFER allows the data to be loaded regardless of VAO state.
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices, GL_STATIC_DRAW);
+        ResizeGpuObject(GpuObject::BUFFER, id, size);
 
         return { id, std::uint32_t(size / sizeof(std::uint32_t)) };
     }
 
     static void Destroy(IndexBuffer* buffer)
     {
-        glDeleteBuffers(1, &buffer->id);
-        buffer = nullptr;
+        ReleaseGpuObject(GpuObject::BUFFER, buffer->id);
+        buffer->id    = 0;
+        buffer->count = 0;
     }
 
     void Bind() const
@@ -700,6 +697,128 @@ private:
 };
 
 
+// A vertex buffer for data that's written anew every frame. It's split into REGION_COUNT regions that are used in turn,
+// so the GPU can still be drawing from the last ones while the CPU writes the next.
+//   * With glBufferStorage (GL 4.4 or ARB_buffer_storage), the buffer is mapped once, persistently. A fence after the
+//     draws from a region guards it; with three regions it has almost always passed by the time the region comes back.
+//   * Without it (GL 3.3, e.g. macOS), the buffer is orphaned every time the regions wrap around, so the driver hands
+//     out fresh memory instead of waiting, and each region is mapped unsynchronized for its write.
+// Data written in one Map/Unmap starts at the offset Unmap returns, which is a multiple of region_size. Keep that a
+// multiple of the vertex size, so the offset is a whole number of vertices.
+class StreamBuffer
+{
+public:
+    static constexpr std::size_t REGION_COUNT = 3;
+
+    StreamBuffer(VertexBuffer buffer, std::size_t region_size, std::uint8_t* persistent)
+        : buffer{buffer}, region_size{region_size}, persistent{persistent} {}
+
+    static StreamBuffer Create(std::size_t region_size)
+    {
+        std::uint32_t id = CreateGpuObject(GpuObject::BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, id);
+
+        const std::size_t size = region_size * REGION_COUNT;
+        std::uint8_t* persistent = nullptr;
+        if ((GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage) && glad_glBufferStorage)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+            persistent = static_cast<std::uint8_t*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags));
+            ASSERT(persistent, "Couldn't map stream buffer %u.", id);
+        }
+        else
+        {
+            glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        ResizeGpuObject(GpuObject::BUFFER, id, size);
+
+        return { VertexBuffer { id }, region_size, persistent };
+    }
+
+    static void Destroy(StreamBuffer* buffer)
+    {
+        for (auto& fence : buffer->fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+        if (buffer->persistent)
+        {
+            buffer->buffer.Bind();
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            buffer->persistent = nullptr;
+        }
+        VertexBuffer::Destroy(&buffer->buffer);
+    }
+
+    // Memory for the next region_size bytes. Write only; it may be uncached.
+    std::uint8_t* Map()
+    {
+        this->region = (this->region + 1) % REGION_COUNT;
+        const std::size_t offset = this->region * this->region_size;
+
+        if (this->persistent)
+        {
+            auto& fence = this->fences[this->region];
+            if (fence)
+            {
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+            return this->persistent + offset;
+        }
+
+        // NOTE(ted): Invalidating the whole buffer is what orphans it. It does the same as glBufferData with no data,
+        //            without respecifying the storage.
+        const GLbitfield invalidate = (this->region == 0) ? GL_MAP_INVALIDATE_BUFFER_BIT : GL_MAP_INVALIDATE_RANGE_BIT;
+        this->buffer.Bind();
+        auto* memory = static_cast<std::uint8_t*>(glMapBufferRange(GL_ARRAY_BUFFER, offset, this->region_size, GL_MAP_WRITE_BIT | invalidate | GL_MAP_UNSYNCHRONIZED_BIT));
+        ASSERT(memory, "Couldn't map stream buffer region %zu.", this->region);
+        return memory;
+    }
+
+    // Done writing. Returns where in the buffer the data is, in bytes.
+    std::size_t Unmap()
+    {
+        if (!this->persistent)
+        {
+            this->buffer.Bind();
+            if (!glUnmapBuffer(GL_ARRAY_BUFFER))
+                WARNING("Lost the contents of stream buffer region %zu.", this->region);
+        }
+        return this->region * this->region_size;
+    }
+
+    // Call after the draws that read what was written since Map.
+    void Fence()
+    {
+        if (this->persistent)
+            this->fences[this->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    const VertexBuffer& GetBuffer() const
+    {
+        return this->buffer;
+    }
+
+    std::size_t GetRegionSize() const
+    {
+        return this->region_size;
+    }
+
+private:
+    VertexBuffer  buffer;
+    std::size_t   region_size;
+    std::size_t   region = REGION_COUNT - 1;
+    std::uint8_t* persistent;                      // Whole buffer, if mapped persistently.
+    GLsync        fences[REGION_COUNT] = {};
+};
+
+
 class VertexArray
 {
 public:
@@ -707,15 +826,16 @@ public:
 
     static VertexArray Create()
     {
-        std::uint32_t id;
-        glGenVertexArrays(1, &id);
-        return { id };
+        return { CreateGpuObject(GpuObject::VERTEX_ARRAY) };
     }
 
+    // Only the vertex array. The buffers added to it are still owned by whoever created them.
     static void Destroy(VertexArray* array)
     {
-        glDeleteBuffers(1, &array->id);
-        array = nullptr;
+        ReleaseGpuObject(GpuObject::VERTEX_ARRAY, array->id);
+        array->id = 0;
+        array->index_buffer.reset();
+        array->vertex_buffers.clear();
     }
 
     void Bind() const
@@ -728,69 +848,31 @@ public:
         glBindVertexArray(0);
     }
 
-    void AddVertexBuffer(const Shader& shader, const VertexBuffer& buffer)
+    // The attributes go to the next free locations, in the order of the layout.
+    template <std::size_t N>
+    void AddVertexBuffer(const Shader& shader, const VertexBuffer& buffer, const VertexLayout<N>& layout)
     {
-        ASSERT(buffer.GetLayout().GetElements().size(), "Vertex Buffer has no layout!");
-
         glBindVertexArray(this->id);
         buffer.Bind();
 
-        auto attributes = shader.GetAttributes();
+        const GLuint first = this->index;
+        this->index = SetVertexAttributes(layout, first);
 
-        const auto& layout = buffer.GetLayout();
-        for (const auto& element : layout)
+        if constexpr (DEBUG)
         {
-            switch (element.type)
+            auto attributes = shader.GetAttributes();
+
+            GLuint location = first;
+            for (const auto& attribute : layout.attributes)
             {
-                case ShaderDataType::Float1:
-                case ShaderDataType::Float2:
-                case ShaderDataType::Float3:
-                case ShaderDataType::Float4:
-                case ShaderDataType::Int:
-                case ShaderDataType::Int2:
-                case ShaderDataType::Int3:
-                case ShaderDataType::Int4:
-                case ShaderDataType::Bool:
-                {
-                    auto index = this->index++;
-                    bool is_valid = shader.Validate(index, element);
-                    attributes.erase(element.name);
-
-                    glEnableVertexAttribArray(index);
-                    glVertexAttribPointer(index,
-                                          GetComponentCount(element.type),
-                                          ShaderDataTypeToOpenGLBaseType(element.type),
-                                          element.normalized ? GL_TRUE : GL_FALSE,
-                                          layout.GetStride(),
-                                          (const void*)element.offset);
-                    break;
-                }
-                case ShaderDataType::Mat3:
-                case ShaderDataType::Mat4:
-                {
-//                    uint8_t count = element.GetComponentCount();
-//                    for (uint8_t i = 0; i < count; i++)
-//                    {
-//                        glEnableVertexAttribArray(m_VertexBufferIndex);
-//                        glVertexAttribPointer(m_VertexBufferIndex,
-//                                              count,
-//                                              ShaderDataTypeToOpenGLBaseType(element.Type),
-//                                              element.Normalized ? GL_TRUE : GL_FALSE,
-//                                              layout.GetStride(),
-//                                              (const void*)(element.Offset + sizeof(float) * count * i));
-//                        glVertexAttribDivisor(m_VertexBufferIndex, 1);
-//                        m_VertexBufferIndex++;
-//                    }
-                    break;
-                }
-                default:
-                    ASSERT(false, "Unknown ShaderDataType!");
+                shader.Validate(int(location), attribute);
+                attributes.erase(attribute.name);
+                location += GLuint(attribute.columns);
             }
-        }
 
-        if (attributes.size() > 0)
             for (const auto& key : attributes)
                 WARNING("Vertex buffer doesn't 'contain' %s!", key.first.data());
+        }
 
         this->vertex_buffers.push_back(buffer);
     }
@@ -861,51 +943,220 @@ public:
 
 
 
-class Texture2D
+// Uploads texture data through a ring of pixel buffer objects, so neither the GL thread nor the driver has to wait on
+// client memory. Pixels are written into a mapped PBO, on the shared ThreadPool when they come from a callback, and the
+// GL thread only unmaps it and issues the copy into the texture, which the GPU then does on its own time. A fence per
+// slot tells when the GPU is done reading it, after which the slot is reused. Copies are issued in the order they were
+// asked for, so later data for the same texture always lands last.
+class PixelUploadRing
 {
 public:
+    static constexpr std::size_t SLOT_COUNT = 8;
 
-    Texture2D() : id{0} {}
+    // What a copy goes into: level 0 of a 2D texture.
+    struct Target
+    {
+        std::uint32_t texture;
+        GLenum        target;
+        std::uint32_t width;
+        std::uint32_t height;
+        GLenum        data_format;
+        GLenum        data_type;
+    };
 
-    Texture2D(std::uint32_t id, std::uint32_t width, std::uint32_t height, GLenum target, GLenum data_type, GLenum data_format)
-        : id{id}, width{width}, height{height}, target{target}, data_type{data_type}, data_format{data_format} {}
+    static PixelUploadRing Create()
+    {
+        PixelUploadRing ring;
+        ring.slots.resize(SLOT_COUNT);
+        for (auto& slot : ring.slots)
+            slot.buffer = CreateGpuObject(GpuObject::BUFFER);
+        return ring;
+    }
 
-    static Texture2D Create(std::uint32_t width, std::uint32_t height, const std::uint8_t* data)
+    // Waits for every upload to finish.
+    static void Destroy(PixelUploadRing* ring)
     {
-        std::uint32_t id;
+        ring->Flush();
+        for (auto& slot : ring->slots)
+            ReleaseGpuObject(GpuObject::BUFFER, slot.buffer);
+        ring->slots.clear();
+    }
 
-        GLenum target = GL_TEXTURE_2D;
-        GLenum data_format = GL_RGBA;
-        GLenum data_type   = GL_UNSIGNED_BYTE;
-        GLenum internal_format = GL_RGBA;
+    // Copies 'data' into a PBO right away, so it doesn't have to outlive the call.
+    void Upload(const Target& target, const void* data, std::size_t size)
+    {
+        auto& slot = this->Acquire(target, size);
+        std::memcpy(slot.memory, data, size);
 
-        glGenTextures(1, &id);
-        glBindTexture(target, id);
+        std::promise<void> written;
+        written.set_value();
+        slot.ready = written.get_future();
+        this->Update();
+    }
 
-//        glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
-//        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL,  1000);  // 1000 is the default.
-//        glTexParameterf(target, GL_TEXTURE_LOD_BIAS,   0.0f);
+    // Lets 'write' fill in the 'size' bytes of pixels on a worker thread. Whatever it reads has to stay alive until then.
+    void Upload(const Target& target, std::size_t size, std::function<void(std::uint8_t* memory)> write)
+    {
+        auto& slot = this->Acquire(target, size);
+        slot.ready = ThreadPool::shared().submit([write = std::move(write), memory = slot.memory]() { write(memory); });
+    }
 
-        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // Issues the copies whose pixels are written and takes back the slots the GPU is done with. Call once per frame.
+    void Update()
+    {
+        while (!this->queue.empty())
+        {
+            auto& slot = this->slots[this->queue.front()];
+            if (slot.ready.wait_for(std::chrono::seconds(0)) == std::future_status::timeout)
+                break;
+            slot.ready.get();
+            this->queue.pop_front();
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+            if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+            {
+                const auto& target = slot.target;
+                glBindTexture(target.target, target.texture);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                glTexSubImage2D(target.target, 0, 0, 0, target.width, target.height, target.data_format, target.data_type, nullptr);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            }
+            else
+            {
+                WARNING("Lost the pixels of an upload to texture %u.", slot.target.texture);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            slot.memory = nullptr;
+            slot.fence  = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
 
-        glTexImage2D(target, 0, internal_format, width, height, 0, data_format, data_type, data);
+        for (auto& slot : this->slots)
+        {
+            if (!slot.fence)
+                continue;
+            const auto status = glClientWaitSync(slot.fence, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            {
+                glDeleteSync(slot.fence);
+                slot.fence = nullptr;
+            }
+        }
+    }
 
-        return { id, width, height, target, data_type, data_format };
+    // Waits until every upload so far has been copied into its texture.
+    void Flush()
+    {
+        for (const auto i : this->queue)
+            this->slots[i].ready.wait();
+        this->Update();
+        this->WaitForGPU();
     }
 
+private:
+    struct Slot
+    {
+        std::uint32_t     buffer   = 0;
+        std::size_t       capacity = 0;
+        std::uint8_t*     memory   = nullptr;   // Mapped while its pixels are being written.
+        GLsync            fence    = nullptr;   // Set while the GPU may still read from it.
+        std::future<void> ready    = {};
+        Target            target   = {};
+    };
 
-    static Texture2D Create(const Image& image)
+    void WaitForGPU()
     {
-        std::uint32_t id;
+        for (auto& slot : this->slots)
+        {
+            if (!slot.fence)
+                continue;
+            glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+    }
 
-        GLenum target = GL_TEXTURE_2D;
-        GLenum data_type = GL_UNSIGNED_BYTE;
-        GLenum internal_format = GL_RGBA;
+    [[nodiscard]] bool IsFree(const Slot& slot) const
+    {
+        return !slot.memory && !slot.fence;
+    }
+
+    // A free slot, mapped and big enough for 'size' bytes. Waits for the oldest upload if every slot is busy.
+    Slot& Acquire(const Target& target, std::size_t size)
+    {
+        ASSERT(!this->slots.empty(), "Upload ring wasn't created.");
 
+        this->Update();
+        while (true)
+        {
+            for (std::size_t i = 0; i < this->slots.size(); ++i)
+            {
+                const auto index = (this->next + i) % this->slots.size();
+                if (this->IsFree(this->slots[index]))
+                {
+                    this->next = (index + 1) % this->slots.size();
+                    return this->Map(index, target, size);
+                }
+            }
+
+            // NOTE(ted): Only happens when more than SLOT_COUNT uploads are asked for within a frame.
+            if (!this->queue.empty())
+                this->slots[this->queue.front()].ready.wait();
+            this->Update();
+            this->WaitForGPU();
+        }
+    }
+
+    Slot& Map(std::size_t index, const Target& target, std::size_t size)
+    {
+        auto& slot = this->slots[index];
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        if (slot.capacity < size)
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            ResizeGpuObject(GpuObject::BUFFER, slot.buffer, size);
+            slot.capacity = size;
+        }
+
+        // The fence said the GPU is done with it, so there's nothing for the driver to synchronize.
+        slot.memory = static_cast<std::uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        ASSERT(slot.memory, "Couldn't map pixel buffer %u.", slot.buffer);
+
+        slot.target = target;
+        this->queue.push_back(index);
+        return slot;
+    }
+
+    std::vector<Slot>       slots {};
+    std::deque<std::size_t> queue {};   // Slots being written, in the order they were asked for.
+    std::size_t             next  = 0;
+};
+
+
+
+
+class Texture2D
+{
+public:
+
+    Texture2D() : id{0} {}
+
+    Texture2D(std::uint32_t id, std::uint32_t width, std::uint32_t height, GLenum target, GLenum data_type, GLenum data_format)
+        : id{id}, width{width}, height{height}, target{target}, data_type{data_type}, data_format{data_format} {}
+
+    // The texture can be used right away, but its pixels only show up once 'uploads' has copied them over.
+    static Texture2D Create(std::uint32_t width, std::uint32_t height, const std::uint8_t* data, PixelUploadRing& uploads)
+    {
+        auto texture = Allocate(width, height, GL_RGBA);
+        texture.SetData(data, uploads);
+        return texture;
+    }
+
+    // The pixels are copied on a worker thread, so the image has to stay alive until 'uploads' is done with it.
+    static Texture2D Create(const Image& image, PixelUploadRing& uploads)
+    {
         GLenum data_format;
         if (image.channels == 4)
             data_format = GL_RGBA;
@@ -914,38 +1165,67 @@ public:
         else
             ERROR("Don't support image with %i channels.", image.channels);
 
-        glGenTextures(1, &id);
-        glBindTexture(target, id);
+        auto texture = Allocate(image.width, image.height, data_format);
 
-//        glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
-//        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL,  1000);  // 1000 is the default.
-//        glTexParameterf(target, GL_TEXTURE_LOD_BIAS,   0.0f);
+        const auto  size = std::size_t(image.width) * std::size_t(image.height) * std::size_t(image.channels);
+        const auto* data = image.data;
+        uploads.Upload(texture.GetUploadTarget(), size, [data, size](std::uint8_t* memory) { std::memcpy(memory, data, size); });
 
-        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return texture;
+    }
 
-        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // Decodes the file straight into the upload ring on a worker thread. Only its header is read here.
+    static Texture2D Load(const std::string& name, const std::string& directory, PixelUploadRing& uploads)
+    {
+        const auto path = directory + name;
 
-        glTexImage2D(target, 0, internal_format, image.width, image.height, 0, data_format, data_type, image.data);
+        int width, height, channels;
+        if (!stbi_info(path.data(), &width, &height, &channels))
+        {
+            WARNING("Couldn't load %s.", path.data());
+            return Create(Image::empty(), uploads);
+        }
 
-        return { id, std::uint32_t(image.width), std::uint32_t(image.height), target, data_type, data_format };
+        // Anything but RGB is decoded as RGBA.
+        if (channels != 3)
+            channels = 4;
+
+        auto texture = Allocate(width, height, (channels == 4) ? GL_RGBA : GL_RGB);
+
+        const auto size = std::size_t(width) * std::size_t(height) * std::size_t(channels);
+        uploads.Upload(texture.GetUploadTarget(), size, [path, size, channels](std::uint8_t* memory) {
+            int width, height, ignored;
+            auto* data = stbi_load(path.data(), &width, &height, &ignored, channels);
+            if (data && std::size_t(width) * std::size_t(height) * std::size_t(channels) == size)
+                std::memcpy(memory, data, size);
+            else
+                std::memset(memory, 0, size);
+            stbi_image_free(data);
+        });
+
+        return texture;
     }
 
     static void Destroy(Texture2D* texture)
     {
-        glDeleteTextures(1, &texture->id);
-        texture = nullptr;
+        ReleaseGpuObject(GpuObject::TEXTURE, texture->id);
+        texture->id = 0;
     }
 
-    void SetData(const std::uint8_t* data)
+    // Goes through 'uploads', so 'data' can be let go of as soon as this returns.
+    void SetData(const std::uint8_t* data, PixelUploadRing& uploads)
     {
         // this->dirty = true;
         // memcpy(this->data, data, this->width * this->height * sizeof(std::uint8_t));
         ASSERT(this->data_type == GL_UNSIGNED_BYTE, "Wrong data type!");
 
-        glBindTexture(this->target, this->id);
-        glTexSubImage2D(this->target, 0, 0, 0, this->width, this->height, this->data_format, this->data_type, data);
+        const std::size_t channels = (this->data_format == GL_RGBA) ? 4 : 3;
+        uploads.Upload(this->GetUploadTarget(), data, std::size_t(this->width) * std::size_t(this->height) * channels);
+    }
+
+    PixelUploadRing::Target GetUploadTarget() const
+    {
+        return { this->id, this->target, this->width, this->height, this->data_format, this->data_type };
     }
 
     void Bind(std::uint32_t unit) const
@@ -967,6 +1247,34 @@ public:
     GLenum target;
     GLenum data_type;
     GLenum data_format;
+
+private:
+    // Storage only. The pixels come through the upload ring.
+    static Texture2D Allocate(std::uint32_t width, std::uint32_t height, GLenum data_format)
+    {
+        GLenum target = GL_TEXTURE_2D;
+        GLenum data_type = GL_UNSIGNED_BYTE;
+        // NOTE(ted): A sized format, so RGB images don't get an alpha channel they never use.
+        GLenum internal_format = (data_format == GL_RGB) ? GL_RGB8 : GL_RGBA8;
+
+        std::uint32_t id = CreateGpuObject(GpuObject::TEXTURE);
+        glBindTexture(target, id);
+
+//        glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+//        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL,  1000);  // 1000 is the default.
+//        glTexParameterf(target, GL_TEXTURE_LOD_BIAS,   0.0f);
+
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+        glTexImage2D(target, 0, internal_format, width, height, 0, data_format, data_type, nullptr);
+        ResizeGpuObject(GpuObject::TEXTURE, id, std::size_t(width) * std::size_t(height) * ((data_format == GL_RGB) ? 3 : 4));
+
+        return { id, width, height, target, data_type, data_format };
+    }
 };
 
 
@@ -1145,13 +1453,23 @@ public:
         glm::vec2 uv_coord;
         glm::vec3 normal;
         float texture_index;
+
+        static constexpr auto Layout()
+        {
+            return MakeVertexLayout<Vertex>(
+                VERTEX_ATTRIBUTE(Vertex, position),
+                VERTEX_ATTRIBUTE(Vertex, uv_coord),
+                VERTEX_ATTRIBUTE(Vertex, normal),
+                VERTEX_ATTRIBUTE(Vertex, texture_index)
+            );
+        }
     };
     using Index = std::uint32_t;
 
     enum Color { Default = 0, Red, Green, Blue };
 
-    Renderer2D(VertexArray vertex_array, VertexBuffer vertex_buffer,
-             Shader shader, Index* quad_index, Vertex* quad_vertex, Texture2D* textures, std::size_t texture_count)
+    Renderer2D(VertexArray vertex_array, StreamBuffer vertex_buffer,
+             Shader shader, Index* quad_index, Vertex* quad_vertex, Texture2D* textures, std::size_t texture_count, PixelUploadRing uploads)
             : vertex_array{vertex_array},
               vertex_buffer{vertex_buffer},
               shader{shader},
@@ -1159,7 +1477,8 @@ public:
               quad_indices{quad_index},
               quad_vertex{quad_vertex},
               texture_count{texture_count},
-              textures{textures}
+              textures{textures},
+              uploads{std::move(uploads)}
     {}
 
     static constexpr std::size_t MAX_QUADS = 1000;
@@ -1180,13 +1499,20 @@ public:
              ReadFile("../resources/shaders/batch.fs.glsl").data()
          );
 
-        auto vertex_buffer = VertexBuffer::Create(MAX_VERTICES);
-        vertex_buffer.SetLayout({
-            { ShaderDataType::Float3, "position" },
-            { ShaderDataType::Float2, "uv_coord" },
-            { ShaderDataType::Float3, "normal" },
-            { ShaderDataType::Float1, "texture_index" },
-        });
+        // Texture i is always bound to unit i, so the samplers are pointed at their units once, here, instead of looked up
+        // by name on every flush.
+        static constexpr UniformId TEXTURE_UNIFORMS[MAX_TEXTURES] = {
+            UNIFORM("texture0"), UNIFORM("texture1"), UNIFORM("texture2"), UNIFORM("texture3"),
+            UNIFORM("texture4"), UNIFORM("texture5"), UNIFORM("texture6"), UNIFORM("texture7"),
+            UNIFORM("texture8"), UNIFORM("texture9"), UNIFORM("texture10"), UNIFORM("texture11"),
+            UNIFORM("texture12"), UNIFORM("texture13"), UNIFORM("texture14"), UNIFORM("texture15"),
+        };
+        color_shader.Bind();
+        for (std::size_t i = 0; i < MAX_TEXTURES; ++i)
+            color_shader.SetUniform(TEXTURE_UNIFORMS[i], int(i));
+
+        // A frame's worth of quads per region.
+        auto vertex_buffer = StreamBuffer::Create(MAX_QUADS * 4 * sizeof(Vertex));
 
         uint32_t offset = 0;
         for (uint32_t i = 0; i < MAX_INDICES; i += 6)
@@ -1201,23 +1527,26 @@ public:
 
             offset += 4;
         }
-        auto index_buffer = IndexBuffer::Create(quad_indices, MAX_INDICES);
+        auto index_buffer = IndexBuffer::Create(quad_indices, MAX_INDICES * sizeof(Index));
 
         auto vertex_array = VertexArray::Create();
-        vertex_array.AddVertexBuffer(color_shader, vertex_buffer);
+        static constexpr auto LAYOUT = Vertex::Layout();
+        vertex_array.AddVertexBuffer(color_shader, vertex_buffer.GetBuffer(), LAYOUT);
         vertex_array.SetIndexBuffer(index_buffer);
 
+        auto uploads = PixelUploadRing::Create();
+
         const std::uint8_t pink[] = {255, 0, 255, 0};
-        auto default_texture = Texture2D::Create(1, 1, pink);
+        auto default_texture = Texture2D::Create(1, 1, pink, uploads);
 
         const std::uint8_t red[] = {255, 0, 0, 255};
-        auto texture0 = Texture2D::Create(1, 1, red);
+        auto texture0 = Texture2D::Create(1, 1, red, uploads);
 
         const std::uint8_t green[] = {0, 255, 0, 255};
-        auto texture1 = Texture2D::Create(1, 1, green);
+        auto texture1 = Texture2D::Create(1, 1, green, uploads);
 
         const std::uint8_t blue[] = {0, 0, 255, 255};
-        auto texture2 = Texture2D::Create(1, 1, blue);
+        auto texture2 = Texture2D::Create(1, 1, blue, uploads);
 
         textures[Color::Default] = default_texture;
         textures[Color::Red]     = texture0;
@@ -1225,11 +1554,35 @@ public:
         textures[Color::Blue]    = texture2;
         std::size_t texture_count  = 4;
 
-        return {vertex_array, vertex_buffer, color_shader, quad_indices, quad_vertices, textures, texture_count };
+        return {vertex_array, vertex_buffer, color_shader, quad_indices, quad_vertices, textures, texture_count, std::move(uploads) };
+    }
+
+    static void Destroy(Renderer2D* renderer)
+    {
+        PixelUploadRing::Destroy(&renderer->uploads);
+        for (std::size_t i = 0; i < renderer->texture_count; ++i)
+            Texture2D::Destroy(&renderer->textures[i]);
+        renderer->texture_count = 0;
+        renderer->images.clear();
+
+        auto index_buffer = renderer->vertex_array.GetIndexBuffer();
+        IndexBuffer::Destroy(&index_buffer);
+        VertexArray::Destroy(&renderer->vertex_array);
+        StreamBuffer::Destroy(&renderer->vertex_buffer);
+        Shader::Destroy(&renderer->shader);
+
+        delete[] renderer->quad_vertex;
+        delete[] renderer->quad_indices;
+        delete[] renderer->textures;
+        renderer->quad_vertex  = nullptr;
+        renderer->quad_indices = nullptr;
+        renderer->textures     = nullptr;
     }
 
     void BeginScene(const Camera& camera)
     {
+        this->uploads.Update();
+
         this->view_matrix = camera.ViewMatrix();
         this->proj_matrix = camera.ProjectionMatrix();
         this->quad_count  = 0;
@@ -1239,7 +1592,7 @@ public:
         auto it = this->images.find(image.name);
         if (it == this->images.end())
         {
-            auto texture = Texture2D::Create(image);
+            auto texture = Texture2D::Create(image, this->uploads);
             this->textures[this->texture_count] = texture;
             this->images[image.name] = this->texture_count;
             this->DrawQuad(position, scale, this->texture_count);
@@ -1288,30 +1641,30 @@ public:
             return;
 
         this->shader.Bind();
-        this->shader.SetUniform("view",       this->view_matrix);
-        this->shader.SetUniform("projection", this->proj_matrix);
+        this->shader.SetUniform(UNIFORM("view"),       this->view_matrix);
+        this->shader.SetUniform(UNIFORM("projection"), this->proj_matrix);
 
-        this->vertex_buffer.SetData(this->quad_vertex, this->quad_count * 4 * sizeof(Vertex));
-        this->vertex_buffer.Unbind();
+        ASSERT(this->quad_count <= MAX_QUADS, "%zu quads don't fit in a batch of %zu.", this->quad_count, MAX_QUADS);
 
+        // Never touches memory the GPU may still be reading, so this doesn't wait on it (see StreamBuffer).
+        const std::size_t size = this->quad_count * 4 * sizeof(Vertex);
+        std::memcpy(this->vertex_buffer.Map(), this->quad_vertex, size);
+        const auto base_vertex = GLint(this->vertex_buffer.Unmap() / sizeof(Vertex));
+
+        // https://www.khronos.org/opengl/wiki/Array_Texture
         for (int i = 0; i < this->texture_count; i++)
-        {
-            // https://www.khronos.org/opengl/wiki/Array_Texture
-            auto texture  = std::string("texture") + std::to_string(i);
-            auto location = this->shader.GetUniforms().at(texture).index;
             this->textures[i].Bind(i);
-            glUniform1i(location, i);
-        }
 
         this->vertex_array.Bind();
-        glDrawElements(GL_TRIANGLES, this->quad_count * 12, GL_UNSIGNED_INT, nullptr);
+        glDrawElementsBaseVertex(GL_TRIANGLES, GLsizei(this->quad_count * 6), GL_UNSIGNED_INT, nullptr, base_vertex);
+        this->vertex_buffer.Fence();
 
         this->quad_count = 0;
     }
 
 private:
     VertexArray  vertex_array;
-    VertexBuffer vertex_buffer;
+    StreamBuffer vertex_buffer;
     Shader       shader;
 
     std::size_t  quad_count;
@@ -1325,6 +1678,8 @@ private:
     mat4 proj_matrix {};
 
     std::unordered_map<std::string, std::uint32_t> images;
+
+    PixelUploadRing uploads;
 };
 
 
@@ -1337,10 +1692,25 @@ public:
         glm::vec3 position;
         glm::vec2 uv_coord;
         glm::vec3 normal;
+
+        static constexpr auto Layout()
+        {
+            return MakeVertexLayout<Vertex>(
+                VERTEX_ATTRIBUTE(Vertex, position),
+                VERTEX_ATTRIBUTE(Vertex, uv_coord),
+                VERTEX_ATTRIBUTE(Vertex, normal)
+            );
+        }
     };
     using Index = std::uint32_t;
 
-    Renderer3D(Shader shader) : shader{shader} {}
+    // Meshes are drawn every frame from when they're added. A handle stays valid for as long as the renderer.
+    using MeshHandle = std::uint32_t;
+
+    Renderer3D(Shader shader, PixelUploadRing uploads) : shader{shader}, uploads{std::move(uploads)}
+    {
+        this->diffuse_location = this->shader.GetUniformLocation(UNIFORM("diffuse"));
+    }
 
     static constexpr std::size_t MAX_VERTICES = 32768;
     static constexpr std::size_t MAX_INDICES  = 1024 * 6;
@@ -1350,63 +1720,87 @@ public:
     {
         ASSERT(context_created, "No.");
 
+        // The meshes here have a Texture2D each, rather than a layer in a texture array.
         auto mesh_shader = Shader::Create("mesh_shader",
             ReadFile("../resources/shaders/basic.vs.glsl").data(),
-            ReadFile("../resources/shaders/basic.fs.glsl").data()
+            ReadFile("../resources/shaders/mesh.fs.glsl").data()
         );
 
-        return { mesh_shader };
+        return { mesh_shader, PixelUploadRing::Create() };
+    }
+
+    // Handles from DrawMeshes are invalid afterwards.
+    static void Destroy(Renderer3D* renderer)
+    {
+        PixelUploadRing::Destroy(&renderer->uploads);
+        for (auto& render_data : renderer->render_data)
+        {
+            // The empty texture is shared, so it's only destroyed once.
+            if (!renderer->empty_texture || render_data.texture.id != renderer->empty_texture->id)
+                Texture2D::Destroy(&render_data.texture);
+            VertexArray::Destroy(&render_data.vertex_array);
+            VertexBuffer::Destroy(&render_data.vertex_buffer);
+        }
+        renderer->render_data.clear();
+        renderer->draw_order.clear();
+
+        if (renderer->empty_texture)
+            Texture2D::Destroy(&renderer->empty_texture.value());
+        renderer->empty_texture.reset();
+        Shader::Destroy(&renderer->shader);
     }
 
     void BeginScene(const Camera& camera)
     {
+        this->uploads.Update();
+
         this->view_matrix = camera.ViewMatrix();
         this->proj_matrix = camera.ProjectionMatrix();
     }
-    void DrawMeshes(const std::vector<SoftwareMesh>& meshes, const std::vector<SoftwareMaterial>& materials)
+
+    // Uploads the meshes and their textures. This is the only time they're sent to the GPU; Flush only draws them.
+    std::vector<MeshHandle> DrawMeshes(const std::vector<SoftwareMesh>& meshes, const std::vector<SoftwareMaterial>& materials)
     {
-        const auto empty_texture = Texture2D::Create(Image::empty());
+        if (!this->empty_texture)
+            this->empty_texture = Texture2D::Create(Image::empty(), this->uploads);
 
+        std::vector<MeshHandle> handles;
+        handles.reserve(meshes.size());
         for (const auto& data : meshes)
         {
-            std::string name =
-                    (data.material && data.material->diffuse_map) ?
-                    data.material->name :
-                    "Unnamed";
-
             Texture2D texture =
                     (data.material && data.material->diffuse_map) ?
-                    Texture2D::Create(data.material->diffuse_map.value()) :
-                    empty_texture;   // TODO(ted): Colored material;
+                    Texture2D::Create(data.material->diffuse_map.value(), this->uploads) :
+                    this->empty_texture.value();   // TODO(ted): Colored material;
 
-            std::vector<Vertex> new_vertices;
+            std::vector<Vertex> vertices;
+            vertices.reserve(data.vertices.size());
             for (const auto& mesh_vertex : data.vertices)
-            {
-                new_vertices.emplace_back(
-                    Vertex{
-                        mesh_vertex.position,
-                        mesh_vertex.uv_coord,
-                        mesh_vertex.normal
-                    }
-                );
-            }
+                vertices.push_back({ mesh_vertex.position, mesh_vertex.uv_coord, mesh_vertex.normal });
 
-            auto vertex_buffer = VertexBuffer::Create(2 * new_vertices.size() * sizeof(Vertex));
-            vertex_buffer.SetLayout({
-                    { ShaderDataType::Float3, "position" },
-                    { ShaderDataType::Float2, "uv_coord" },
-                    { ShaderDataType::Float3, "normal" },
-            });
+            auto vertex_buffer = VertexBuffer::Create((float*) vertices.data(), vertices.size() * sizeof(Vertex));
+            static constexpr auto LAYOUT = Vertex::Layout();
             auto vertex_array = VertexArray::Create();
-            vertex_array.AddVertexBuffer(this->shader, vertex_buffer);
+            vertex_array.AddVertexBuffer(this->shader, vertex_buffer, LAYOUT);
 
-            this->render_data.emplace(name, RenderData {
-                std::move(new_vertices),
+            handles.push_back(MeshHandle(this->render_data.size()));
+            this->render_data.push_back(RenderData {
                 std::move(texture),
                 vertex_array,
-                vertex_buffer
+                vertex_buffer,
+                GLsizei(vertices.size())
             });
         }
+
+        // Fewer texture binds when drawn in this order.
+        this->draw_order.resize(this->render_data.size());
+        for (std::size_t i = 0; i < this->draw_order.size(); ++i)
+            this->draw_order[i] = MeshHandle(i);
+        std::stable_sort(this->draw_order.begin(), this->draw_order.end(), [this](MeshHandle a, MeshHandle b) {
+            return this->render_data[a].texture.id < this->render_data[b].texture.id;
+        });
+
+        return handles;
     }
     void EndScene()
     {
@@ -1416,55 +1810,42 @@ public:
     {
         this->shader.Bind();
 
-        auto model = glm::mat4();
-        model = glm::translate(model, vec3(0));
-        this->shader.SetUniform("model",      model);
-        this->shader.SetUniform("view",       this->view_matrix);
-        this->shader.SetUniform("projection", this->proj_matrix);
-
-        for (auto& [name, render_data] : this->render_data)
-        {
-//            render_data.vertex_buffer.SetData(render_data.vertices.data(), render_data.vertices.size() * sizeof(Vertex));
+        // basic.vs.glsl reads the model matrix as an attribute, at locations 3 to 6. The vertex arrays here don't have it,
+        // so every vertex gets this one.
+        const auto model = glm::translate(glm::mat4(1.0f), vec3(0));
+        for (GLuint column = 0; column < 4; ++column)
+            glVertexAttrib4fv(3 + column, &model[column][0]);
+        this->shader.SetUniform(UNIFORM("view"),       this->view_matrix);
+        this->shader.SetUniform(UNIFORM("projection"), this->proj_matrix);
 
-            const auto& vertices = render_data.vertices;
+        // The vertices here are full floats, not packed, so they're unpacked with the identity.
+        this->shader.SetUniform(UNIFORM("position_offset"), vec3(0.0f));
+        this->shader.SetUniform(UNIFORM("position_scale"),  vec3(1.0f));
 
-            GLuint vao;
-            glGenVertexArrays(1, &vao);
-            glBindVertexArray(vao);
+        glUniform1i(this->diffuse_location, 0);
 
-            // Create vertex buffer to put our data into video memory.
-            GLuint vbo;
-            glGenBuffers(1, &vbo);
-            glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
-
-            // Tell OpenGL the data's format.
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, position));
-            glEnableVertexAttribArray(1);
-            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, uv_coord));
-            glEnableVertexAttribArray(2);
-            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, normal));
-
-
-            auto texture  = std::string("diffuse");
-            auto location = this->shader.GetUniforms().at(texture).index;
-            render_data.texture.Bind(0);
-            glUniform1i(location, 0);
+        std::uint32_t bound_texture = 0;
+        for (const auto handle : this->draw_order)
+        {
+            const auto& render_data = this->render_data[handle];
+            if (render_data.texture.id != bound_texture)
+            {
+                render_data.texture.Bind(0);
+                bound_texture = render_data.texture.id;
+            }
 
-            glBindVertexArray(vao);
-            glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+            render_data.vertex_array.Bind();
+            glDrawArrays(GL_TRIANGLES, 0, render_data.vertex_count);
         }
     }
 
 private:
     struct RenderData
     {
-        std::vector<Vertex> vertices;
-        Texture2D texture;
-
+        Texture2D    texture;
         VertexArray  vertex_array;
         VertexBuffer vertex_buffer;
+        GLsizei      vertex_count;
     };
 
 
@@ -1477,15 +1858,115 @@ private:
     mat4 view_matrix {};
     mat4 proj_matrix {};
 
-    std::unordered_map<std::string, RenderData> render_data {};
+    std::vector<RenderData>  render_data {};    // Indexed by MeshHandle.
+    std::vector<MeshHandle>  draw_order  {};
+    std::optional<Texture2D> empty_texture {};
+    GLint                    diffuse_location = -1;
+
+    PixelUploadRing uploads;
 };
 
 
 
 
 
-int main()
+#ifdef FRAME_CHECK
+// Regression check for Renderer3D, built as its own target (check_frames). Draws the scene in a hidden window and fails
+// if a frame after the first, which may still finish uploads, creates or reallocates GL objects, if anything is leaked,
+// or if frames take longer than '--max-frame-ms' of CPU time on average (no limit by default). Run from the build
+// directory.
+//
+//   check_frames [--frames 300] [--max-frame-ms 0]
+static int CheckFrames(int argc, char* argv[])
+{
+    std::size_t frames         = 300;
+    double      max_frame_time = 0.0;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument = argv[i];
+        if (argument == "--frames" && i + 1 < argc)
+            frames = std::max<std::size_t>(2, std::strtoull(argv[++i], nullptr, 10));
+        else if (argument == "--max-frame-ms" && i + 1 < argc)
+            max_frame_time = std::atof(argv[++i]);
+    }
+
+    stbi_set_flip_vertically_on_load(true);
+
+    auto window      = Window::Create(1280, 720, "check_frames", false);
+    auto renderer_3d = Renderer3D::Create();
+
+    // Counted whether or not this is a debug build, and without vsync so frame times are the renderer's.
+    glad_set_pre_callback(CountGLObjects);
+    glfwSwapInterval(0);
+
+    Camera camera;
+    camera.position = vec3{0, 2.0f, 3.0f};
+    glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+
+    auto [all_meshes, all_materials] = LoadScene("../resources/models/cube.obj", "../resources/models/");
+    renderer_3d.DrawMeshes(all_meshes, all_materials);
+
+    int result = 0;
+    double total_frame_time = 0.0;
+    double worst_frame_time = 0.0;
+    for (std::size_t frame = 0; frame < frames; ++frame)
+    {
+        const auto frame_start   = std::chrono::steady_clock::now();
+        const auto objects_start = gl_objects_created;
+
+        glClear(GL_COLOR_BUFFER_BIT);
+        renderer_3d.BeginScene(camera);
+        renderer_3d.EndScene();
+
+        const double frame_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+        if (frame > 0)
+        {
+            total_frame_time += frame_time;
+            worst_frame_time  = std::max(worst_frame_time, frame_time);
+            if (gl_objects_created != objects_start)
+            {
+                ERROR("Frame %zu created or reallocated %zu GL objects.", frame, gl_objects_created - objects_start);
+                result = 1;
+            }
+        }
+
+        window.Update();
+        EndGpuFrame();
+    }
+
+    const double average_frame_time = total_frame_time / double(frames - 1);
+    INFO("Frames 1-%zu: %.3f ms of CPU time on average, %.3f ms at worst.", frames - 1, average_frame_time, worst_frame_time);
+    if (max_frame_time > 0.0 && average_frame_time > max_frame_time)
+    {
+        ERROR("Frames took %.3f ms on average, more than the %.3f ms allowed.", average_frame_time, max_frame_time);
+        result = 1;
+    }
+
+    Renderer3D::Destroy(&renderer_3d);
+    FlushGpuReleases();
+
+    const auto leaked = GetGpuMemory();
+    for (std::size_t i = 0; i < std::size_t(GpuObject::COUNT); ++i)
+    {
+        if (leaked.count[i])
+        {
+            ERROR("Leaked %zu GPU objects of type %zu (%zu bytes).", leaked.count[i], i, leaked.bytes[i]);
+            result = 1;
+        }
+    }
+
+    INFO("Frame check %s.", result == 0 ? "passed" : "failed");
+    return result;
+}
+#endif
+
+
+int main(int argc, char* argv[])
 {
+#ifdef FRAME_CHECK
+    return CheckFrames(argc, argv);
+#endif
+
     stbi_set_flip_vertically_on_load(true);
 
     auto window      = Window::Create(2880, 1710, "Game");
@@ -1500,19 +1981,34 @@ int main()
     auto [all_meshes, all_materials] = LoadScene("../resources/models/cube.obj", "../resources/models/");
 
     renderer_3d.DrawMeshes(all_meshes, all_materials);
+
     while (window.Continue())
     {
         glClear(GL_COLOR_BUFFER_BIT);
 
         renderer_3d.BeginScene(camera);
         renderer_3d.EndScene();
+
 //        renderer_2d.DrawQuad(vec3{ -0.5f,  0.5f, 0.0f }, 0.1f, image1);
 //        renderer_2d.DrawQuad(vec3{  0.5f,  0.5f, 0.0f }, 0.1f, image2);
 //        renderer_2d.DrawQuad(vec3{ -0.5f, -0.5f, 0.0f }, 0.1f, Renderer::Color::Blue);
 //        renderer_2d.DrawQuad(vec3{  0.5f, -0.5f, 0.0f }, 0.1f, Renderer::Color::Green);
 
         window.Update();
+        EndGpuFrame();
     }
+
+    ReportGpuMemory();
+
+//    Renderer2D::Destroy(&renderer_2d);
+    Renderer3D::Destroy(&renderer_3d);
+    FlushGpuReleases();
+
+    // Everything the renderers made should be gone now.
+    const auto leaked = GetGpuMemory();
+    for (std::size_t i = 0; i < std::size_t(GpuObject::COUNT); ++i)
+        if (leaked.count[i])
+            WARNING("Leaked %zu GPU objects of type %zu (%zu bytes).", leaked.count[i], i, leaked.bytes[i]);
 }
 
 
@@ -1,6 +1,85 @@
 #include "maths.h"
 
+#include <glm/gtc/packing.hpp>
+
 //vec3 RotationToHeading(const vec3& rotation)
 //{
 //
-//}
\ No newline at end of file
+//}
+
+
+Quantization ComputeQuantization(const Vertex* vertices, usize vertex_count)
+{
+    if (vertex_count == 0)
+        return {};
+
+    vec3 min = vertices[0].position;
+    vec3 max = vertices[0].position;
+    for (usize i = 1; i < vertex_count; ++i)
+    {
+        min = glm::min(min, vertices[i].position);
+        max = glm::max(max, vertices[i].position);
+    }
+
+    return { min, max - min };
+}
+
+
+PackedVertex PackVertex(const Vertex& vertex, const Quantization& quantization)
+{
+    PackedVertex packed = {};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        // A flat axis has nothing to quantize.
+        const f32 scale = quantization.scale[axis];
+        const f32 t     = (scale > 0.0f) ? (vertex.position[axis] - quantization.offset[axis]) / scale : 0.0f;
+        packed.position[axis] = u16(glm::round(glm::clamp(t, 0.0f, 1.0f) * 65535.0f));
+    }
+
+    packed.uv_coord[0] = glm::packHalf1x16(vertex.uv_coord.x);
+    packed.uv_coord[1] = glm::packHalf1x16(vertex.uv_coord.y);
+
+    // Same bit layout as GL_INT_2_10_10_10_REV.
+    const f32 length = glm::length(vertex.normal);
+    packed.normal = glm::packSnorm3x10_1x2(glm::vec4((length > 0.0f) ? vertex.normal / length : vec3(0.0f), 0.0f));
+
+    return packed;
+}
+
+
+Vertex UnpackVertex(const PackedVertex& vertex, const Quantization& quantization)
+{
+    const vec3 position = vec3(vertex.position[0], vertex.position[1], vertex.position[2]) / 65535.0f;
+
+    return {
+        quantization.offset + quantization.scale * position,
+        vec2(glm::unpackHalf1x16(vertex.uv_coord[0]), glm::unpackHalf1x16(vertex.uv_coord[1])),
+        vec3(glm::unpackSnorm3x10_1x2(vertex.normal)),
+    };
+}
+
+
+QuantizationError MeasureQuantization(const Vertex* vertices, usize vertex_count, const Quantization& quantization)
+{
+    QuantizationError error;
+    for (usize i = 0; i < vertex_count; ++i)
+    {
+        const auto& original = vertices[i];
+        const auto  unpacked = UnpackVertex(PackVertex(original, quantization), quantization);
+
+        const vec3 position = glm::abs(unpacked.position - original.position);
+        const vec2 uv_coord = glm::abs(unpacked.uv_coord - original.uv_coord);
+        error.position = glm::max(error.position, glm::max(position.x, glm::max(position.y, position.z)));
+        error.uv_coord = glm::max(error.uv_coord, glm::max(uv_coord.x, uv_coord.y));
+
+        const f32 a = glm::length(original.normal);
+        const f32 b = glm::length(unpacked.normal);
+        if (a > 0.0f && b > 0.0f)
+        {
+            const f32 cosine = glm::clamp(glm::dot(original.normal / a, unpacked.normal / b), -1.0f, 1.0f);
+            error.normal = glm::max(error.normal, glm::degrees(glm::acos(cosine)));
+        }
+    }
+
+    return error;
+}
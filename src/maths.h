@@ -4,8 +4,11 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "types.h"
+
 using glm::vec3;
 using glm::vec2;
+using glm::mat4;
 
 
 struct Vertex
@@ -13,4 +16,42 @@ struct Vertex
     vec3 position;
     vec2 uv_coord;
     vec3 normal;
-};
\ No newline at end of file
+};
+
+
+// Half the size of a Vertex: 16-bit positions relative to the bounds of the mesh (see Quantization), half float uv
+// coordinates and 10-10-10-2 signed normalized normals.
+struct PackedVertex
+{
+    u16 position[4];    // The last one is padding.
+    u16 uv_coord[2];
+    u32 normal;
+};
+
+// Maps quantized positions back into the bounds of their mesh: offset + scale * (position / 65535).
+struct Quantization
+{
+    vec3 offset = vec3(0.0f);
+    vec3 scale  = vec3(1.0f);
+};
+
+// Largest error introduced by packing, in model units, uv units and degrees.
+struct QuantizationError
+{
+    f32 position = 0.0f;
+    f32 uv_coord = 0.0f;
+    f32 normal   = 0.0f;
+
+    QuantizationError& operator+= (const QuantizationError& other) noexcept
+    {
+        this->position = glm::max(this->position, other.position);
+        this->uv_coord = glm::max(this->uv_coord, other.uv_coord);
+        this->normal   = glm::max(this->normal,   other.normal);
+        return *this;
+    }
+};
+
+Quantization      ComputeQuantization(const Vertex* vertices, usize vertex_count);
+PackedVertex      PackVertex(const Vertex& vertex, const Quantization& quantization);
+Vertex            UnpackVertex(const PackedVertex& vertex, const Quantization& quantization);
+QuantizationError MeasureQuantization(const Vertex* vertices, usize vertex_count, const Quantization& quantization);
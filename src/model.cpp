@@ -1,110 +1,451 @@
 #include "model.h"
 
+#include <algorithm>
 #include <cstddef>
 
 #include "maths.h"
+#include "debug.h"
+#include "renderer/opengl/buffer.h"
 
 
-Mesh CreateMesh(const std::vector<Vertex>& vertices)
+// Room for this many vertices, and words of indices, in the first buffers of each format. They double from there.
+static constexpr size_t MESH_ARENA_FIRST_VERTICES    = 64 * 1024;
+static constexpr size_t MESH_ARENA_FIRST_INDEX_WORDS = 128 * 1024;
+
+
+RangeAllocator::RangeAllocator(size_t capacity)
+{
+    this->grow(capacity);
+}
+
+size_t RangeAllocator::allocate(size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    auto it = this->by_size.lower_bound(size);
+    if (it == this->by_size.end())
+        return INVALID;
+
+    const size_t offset = it->second;
+    const size_t free   = it->first;
+    this->by_size.erase(it);
+    this->by_offset.erase(offset);
+
+    if (free > size)
+        this->insert(offset + size, free - size);
+
+    this->in_use += size;
+    return offset;
+}
+
+void RangeAllocator::free(size_t offset, size_t size)
+{
+    if (size == 0)
+        return;
+
+    ASSERT(this->in_use >= size, "Freeing %zu, but only %zu is allocated.", size, this->in_use);
+    this->in_use -= size;
+    this->insert(offset, size);
+}
+
+void RangeAllocator::grow(size_t capacity)
+{
+    if (capacity <= this->total)
+        return;
+
+    const size_t start = this->total;
+    this->total = capacity;
+    this->insert(start, capacity - start);
+}
+
+void RangeAllocator::insert(size_t offset, size_t size)
+{
+    // Merge with the free ranges right after and right before.
+    auto next = this->by_offset.lower_bound(offset);
+    if (next != this->by_offset.end() && offset + size == next->first)
+    {
+        size += next->second;
+        next  = this->erase(next);
+    }
+    if (next != this->by_offset.begin())
+    {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset)
+        {
+            offset = previous->first;
+            size  += previous->second;
+            this->erase(previous);
+        }
+    }
+
+    this->by_offset.emplace(offset, size);
+    this->by_size.emplace(size, offset);
+}
+
+std::map<size_t, size_t>::iterator RangeAllocator::erase(std::map<size_t, size_t>::iterator range)
+{
+    auto [first, last] = this->by_size.equal_range(range->second);
+    for (auto it = first; it != last; ++it)
+    {
+        if (it->second == range->first)
+        {
+            this->by_size.erase(it);
+            break;
+        }
+    }
+    return this->by_offset.erase(range);
+}
+
+
+// Positions of packed vertices come out in [0, 1] and are mapped back to the mesh bounds by the vertex shader. The last
+// of their four shorts is padding.
+static constexpr auto VERTEX_LAYOUT = MakeVertexLayout<Vertex>(
+    VERTEX_ATTRIBUTE(Vertex, position),
+    VERTEX_ATTRIBUTE(Vertex, uv_coord),
+    VERTEX_ATTRIBUTE(Vertex, normal)
+);
+static constexpr auto PACKED_VERTEX_LAYOUT = MakeVertexLayout<PackedVertex>(
+    VERTEX_ATTRIBUTE_AS(PackedVertex, position, Normalized<u16, 3>),
+    VERTEX_ATTRIBUTE_AS(PackedVertex, uv_coord, HalfFloat<2>),
+    VERTEX_ATTRIBUTE_AS(PackedVertex, normal,   Snorm2_10_10_10)
+);
+
+// Tells the bound vertex array where the attributes are in the bound vertex buffer.
+static void SetVertexAttributes(VertexFormat format)
+{
+    if (format == VertexFormat::PACKED)
+        SetVertexAttributes(PACKED_VERTEX_LAYOUT);
+    else
+        SetVertexAttributes(VERTEX_LAYOUT);
+}
+
+static size_t IndexWords(size_t index_count, GLenum index_type)
 {
-    // Create vertex array buffer to store vertex buffers and element buffers.
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    const size_t bytes = index_count * ((index_type == GL_UNSIGNED_SHORT) ? 2 : 4);
+    return (bytes + 3) / 4;
+}
+
+
+void MeshArena::create(Pool& pool, VertexFormat format)
+{
+    pool.vao = GpuVertexArray::create();
+    pool.vbo = GpuBuffer::create();
+    pool.ibo = GpuBuffer::create();
 
-    // Create vertex buffer to put our data into video memory.
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+    // The vertex array records the element buffer binding, so it has to be bound first.
+    glBindVertexArray(pool.vao.get());
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vbo.get());
+    glBufferData(GL_ARRAY_BUFFER, MESH_ARENA_FIRST_VERTICES * VertexSize(format), nullptr, GL_STATIC_DRAW);
+    pool.vbo.resize(MESH_ARENA_FIRST_VERTICES * VertexSize(format));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.ibo.get());
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, MESH_ARENA_FIRST_INDEX_WORDS * 4, nullptr, GL_STATIC_DRAW);
+    pool.ibo.resize(MESH_ARENA_FIRST_INDEX_WORDS * 4);
+    SetVertexAttributes(format);
 
-    // Tell OpenGL the data's format.
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, position));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, uv_coord));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, normal));
+    pool.vertices = RangeAllocator(MESH_ARENA_FIRST_VERTICES);
+    pool.indices  = RangeAllocator(MESH_ARENA_FIRST_INDEX_WORDS);
+}
 
-    return { vao, vertices.size() };
+void MeshArena::reclaim()
+{
+    const u64 retired = GetRetiredGpuFrame();
+    while (!this->removed.empty() && this->removed.front().frame <= retired)
+    {
+        const auto& range = this->removed.front();
+        auto& pool = this->pools[size_t(range.format)];
+        pool.vertices.free(range.first_vertex, range.vertex_count);
+        if (range.words)
+            pool.indices.free(range.first_word, range.words);
+        this->removed.pop_front();
+    }
 }
 
+void MeshArena::grow(GpuBuffer& buffer, RangeAllocator& ranges, size_t unit, size_t needed)
+{
+    const size_t old_capacity = ranges.capacity();
+    size_t capacity = std::max<size_t>(2 * old_capacity, 1);
+    while (capacity - old_capacity < needed)
+        capacity *= 2;
+
+    // The copy binding points don't disturb what any vertex array is bound to. The old buffer is released once the
+    // frames drawing from it are done.
+    auto grown = GpuBuffer::create();
+    glBindBuffer(GL_COPY_WRITE_BUFFER, grown.get());
+    glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(capacity * unit), nullptr, GL_STATIC_DRAW);
+    grown.resize(capacity * unit);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer.get());
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GLsizeiptr(old_capacity * unit));
 
-Mesh CreateMesh(const vec3* positions, const vec2* uv_coords, const vec3* normals, size_t vertex_count)
+    buffer = std::move(grown);
+    ranges.grow(capacity);
+}
+
+Mesh MeshArena::add(VertexFormat format, const void* vertices, size_t vertex_count, const void* indices, size_t index_count, GLenum index_type)
 {
-    size_t position_size = vertex_count * sizeof(*positions);
-    size_t texture_size  = vertex_count * sizeof(*uv_coords);
-    size_t normal_size   = vertex_count * sizeof(*normals);
-    size_t total_size    = position_size + texture_size + normal_size;
+    auto& pool = this->pools[size_t(format)];
+    if (!pool.vao)
+        this->create(pool, format);
+    this->reclaim();
+
+    const size_t stride = VertexSize(format);
+    size_t first_vertex = pool.vertices.allocate(vertex_count);
+    if (first_vertex == RangeAllocator::INVALID)
+    {
+        grow(pool.vbo, pool.vertices, stride, vertex_count);
+        first_vertex = pool.vertices.allocate(vertex_count);
+
+        // The attributes point into the old buffer.
+        glBindVertexArray(pool.vao.get());
+        glBindBuffer(GL_ARRAY_BUFFER, pool.vbo.get());
+        SetVertexAttributes(format);
+    }
+
+    glBindVertexArray(pool.vao.get());
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vbo.get());
+    glBufferSubData(GL_ARRAY_BUFFER, GLintptr(first_vertex * stride), GLsizeiptr(vertex_count * stride), vertices);
+
+    Mesh mesh;
+    mesh.id           = pool.vao.get();
+    mesh.count        = vertex_count;
+    mesh.base_vertex  = GLint(first_vertex);
+    mesh.vertex_count = vertex_count;
+    mesh.format       = format;
+
+    if (indices)
+    {
+        ASSERT(index_type == GL_UNSIGNED_SHORT || index_type == GL_UNSIGNED_INT, "Unsupported index type %i.", index_type);
+
+        const size_t words = IndexWords(index_count, index_type);
+        size_t first_word  = pool.indices.allocate(words);
+        if (first_word == RangeAllocator::INVALID)
+        {
+            grow(pool.ibo, pool.indices, 4, words);
+            first_word = pool.indices.allocate(words);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.ibo.get());    // The vertex array is still bound.
+        }
 
-    // Create vertex array buffer to store vertex buffers and element buffers.
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+        const size_t size = index_count * ((index_type == GL_UNSIGNED_SHORT) ? 2 : 4);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, GLintptr(first_word * 4), GLsizeiptr(size), indices);
 
-    // Create vertex buffer to put our data into video memory.
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        mesh.count        = index_count;
+        mesh.index_type   = index_type;
+        mesh.index_offset = first_word * 4;
+    }
 
-    // Allocate a buffer and then insert data.
-    glBufferData(GL_ARRAY_BUFFER, total_size, nullptr, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, position_size, positions);
-    glBufferSubData(GL_ARRAY_BUFFER, position_size, texture_size,  uv_coords);
-    glBufferSubData(GL_ARRAY_BUFFER, position_size + texture_size, normal_size, normals);
+    this->meshes += 1;
+    return mesh;
+}
+
+void MeshArena::remove(const Mesh& mesh)
+{
+    Removed range;
+    range.frame        = GetGpuFrame();
+    range.format       = mesh.format;
+    range.first_vertex = size_t(mesh.base_vertex);
+    range.vertex_count = mesh.vertex_count;
+    if (mesh.index_type)
+    {
+        range.first_word = mesh.index_offset / 4;
+        range.words      = IndexWords(mesh.count, mesh.index_type);
+    }
+    this->removed.push_back(range);
+    this->meshes -= 1;
+}
 
-    // Tell OpenGL the data's format.
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(*positions), (void *) nullptr);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(*uv_coords), (void *) position_size);
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(*normals),   (void *) (position_size + texture_size));
+size_t MeshArena::bytes_used() const noexcept
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < size_t(VertexFormat::COUNT); ++i)
+        bytes += this->pools[i].vertices.used() * VertexSize(VertexFormat(i)) + this->pools[i].indices.used() * 4;
+    return bytes;
+}
 
-    return { vao, vertex_count };
+size_t MeshArena::bytes_reserved() const noexcept
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < size_t(VertexFormat::COUNT); ++i)
+        bytes += this->pools[i].vertices.capacity() * VertexSize(VertexFormat(i)) + this->pools[i].indices.capacity() * 4;
+    return bytes;
 }
 
 
+Mesh CreateMesh(MeshArena& arena, const SoftwareMesh& mesh, VertexFormat format)
+{
+    GLenum index_type = (mesh.index_type == IndexType::U16) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    if (format == VertexFormat::PACKED)
+        return CreateMesh(arena, mesh, ComputeQuantization(mesh.vertices, mesh.vertex_count));
+
+    if (mesh.index_count == 0)
+        return CreateMesh(arena, mesh.vertices, mesh.vertex_count);
+    return CreateMesh(arena, mesh.vertices, mesh.vertex_count, mesh.indices, mesh.index_count, index_type);
+}
+
 
-Mesh CreateMesh(const std::vector<float>& positions, const std::vector<float>& texture_coordinates, const std::vector<float>& normals, const std::vector<GLuint>& indices)
+Mesh CreateMesh(MeshArena& arena, const SoftwareMesh& mesh, const Quantization& quantization)
+{
+    GLenum index_type = (mesh.index_type == IndexType::U16) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    std::vector<PackedVertex> packed(mesh.vertex_count);
+    for (size_t i = 0; i < mesh.vertex_count; ++i)
+        packed[i] = PackVertex(mesh.vertices[i], quantization);
+
+    if (mesh.index_count == 0)
+        return CreateMesh(arena, packed.data(), packed.size(), quantization);
+    return CreateMesh(arena, packed.data(), packed.size(), quantization, mesh.indices, mesh.index_count, index_type);
+}
+
+
+Mesh CreateMesh(MeshArena& arena, const std::vector<Vertex>& vertices)
+{
+    return CreateMesh(arena, vertices.data(), vertices.size());
+}
+
+
+Mesh CreateMesh(MeshArena& arena, const Vertex* vertices, size_t vertex_count, const void* indices, size_t index_count, GLenum index_type)
+{
+    return arena.add(VertexFormat::FULL, vertices, vertex_count, indices, index_count, index_type);
+}
+
+
+Mesh CreateMesh(MeshArena& arena, const Vertex* vertices, size_t vertex_count)
+{
+    return arena.add(VertexFormat::FULL, vertices, vertex_count);
+}
+
+
+Mesh CreateMesh(MeshArena& arena, const PackedVertex* vertices, size_t vertex_count, const Quantization& quantization, const void* indices, size_t index_count, GLenum index_type)
+{
+    Mesh mesh = arena.add(VertexFormat::PACKED, vertices, vertex_count, indices, index_count, index_type);
+    mesh.quantization = quantization;
+    return mesh;
+}
+
+
+Mesh CreateMesh(MeshArena& arena, const PackedVertex* vertices, size_t vertex_count, const Quantization& quantization)
+{
+    Mesh mesh = arena.add(VertexFormat::PACKED, vertices, vertex_count);
+    mesh.quantization = quantization;
+    return mesh;
+}
+
+
+Mesh CreateMesh(MeshArena& arena, const vec3* positions, const vec2* uv_coords, const vec3* normals, size_t vertex_count)
+{
+    // The arena only holds interleaved vertices.
+    std::vector<Vertex> vertices(vertex_count);
+    for (size_t i = 0; i < vertex_count; ++i)
+        vertices[i] = { positions[i], uv_coords[i], normals[i] };
+
+    return CreateMesh(arena, vertices);
+}
+
+
+
+Mesh CreateMesh(MeshArena& arena, const std::vector<float>& positions, const std::vector<float>& texture_coordinates, const std::vector<float>& normals, const std::vector<GLuint>& indices)
 {
     // TODO(ted): Maybe use some of these tips https://www.khronos.org/opengl/wiki/VertexSpecification_Best_Practices.
 
-    size_t position_size = positions.size();
-    size_t texture_size  = texture_coordinates.size();
-    size_t normal_size   = normals.size();
-    size_t total_size    = position_size + texture_size + normal_size;
-
-    // Create vertex array buffer to store vertex buffers and element buffers.
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-
-    // Create an element buffer to put our data into video memory.
-    GLuint ebo;
-    glGenBuffers(1, &ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
-
-    // Create vertex buffer to put our data into video memory.
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-    // Allocate a buffer and then insert data.
-    glBufferData(GL_ARRAY_BUFFER, total_size, nullptr, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, position_size, positions.data());
-    glBufferSubData(GL_ARRAY_BUFFER, position_size, texture_size,  texture_coordinates.data());
-    glBufferSubData(GL_ARRAY_BUFFER, position_size + texture_size, normal_size, normals.data());
-
-    // Tell OpenGL the data's format.
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *) nullptr);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *) position_size);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *) (position_size + texture_size));
-
-    return { vao, indices.size() };
-}
\ No newline at end of file
+    std::vector<Vertex> vertices(positions.size() / 3);
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        vertices[i].position = { positions[3*i + 0], positions[3*i + 1], positions[3*i + 2] };
+        vertices[i].uv_coord = { texture_coordinates[2*i + 0], texture_coordinates[2*i + 1] };
+        vertices[i].normal   = { normals[3*i + 0], normals[3*i + 1], normals[3*i + 2] };
+    }
+
+    return CreateMesh(arena, vertices.data(), vertices.size(), indices.data(), indices.size(), GL_UNSIGNED_INT);
+}
+
+
+void DrawMesh(const Mesh& mesh)
+{
+    if (mesh.index_type)
+        glDrawElementsBaseVertex(GL_TRIANGLES, GLsizei(mesh.count), mesh.index_type, (const void*) mesh.index_offset, mesh.base_vertex);
+    else
+        glDrawArrays(GL_TRIANGLES, mesh.base_vertex, GLsizei(mesh.count));
+}
+
+
+
+void InstanceBuffer::upload(const mat4* models, size_t count)
+{
+    if (!this->buffer)
+        this->buffer = GpuBuffer::create();
+
+    // Grows to the largest frame so far, so it's only ever orphaned, never resized, once the scene is loaded.
+    if (count > this->capacity)
+    {
+        this->capacity = std::max(count, 2 * this->capacity);
+        this->buffer.resize(this->capacity * sizeof(mat4));
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, this->buffer.get());
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(this->capacity * sizeof(mat4)), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(count * sizeof(mat4)), models);
+}
+
+void InstanceBuffer::bind(size_t first) const
+{
+    // NOTE(ted): Without base instances (GL 4.2), where a draw's instances start is part of the attribute pointers.
+    glBindBuffer(GL_ARRAY_BUFFER, this->buffer.get());
+    for (GLuint column = 0; column < INSTANCE_MODEL_COLUMNS; ++column)
+    {
+        const GLuint location = INSTANCE_MODEL_LOCATION + column;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void *) (first * sizeof(mat4) + column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(location, 1);
+    }
+}
+
+void DrawMeshInstanced(const Mesh& mesh, GLsizei instances)
+{
+    if (mesh.index_type)
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, GLsizei(mesh.count), mesh.index_type, (const void*) mesh.index_offset, instances, mesh.base_vertex);
+    else
+        glDrawArraysInstanced(GL_TRIANGLES, mesh.base_vertex, GLsizei(mesh.count), instances);
+}
+
+void SetModelMatrix(const mat4& model)
+{
+    for (GLuint column = 0; column < INSTANCE_MODEL_COLUMNS; ++column)
+    {
+        glDisableVertexAttribArray(INSTANCE_MODEL_LOCATION + column);
+        glVertexAttrib4fv(INSTANCE_MODEL_LOCATION + column, &model[column][0]);
+    }
+}
+
+
+bool DrawBatch::fits(const Mesh& mesh) const noexcept
+{
+    return this->counts.empty() || (mesh.id == this->vao && mesh.index_type == this->index_type);
+}
+
+void DrawBatch::add(const Mesh& mesh)
+{
+    ASSERT(this->fits(mesh), "Mesh doesn't fit in the batch.");
+
+    this->vao        = mesh.id;
+    this->index_type = mesh.index_type;
+    this->counts.push_back(GLsizei(mesh.count));
+    this->firsts.push_back(mesh.base_vertex);
+    if (mesh.index_type)
+        this->offsets.push_back((const void*) mesh.index_offset);
+}
+
+void DrawBatch::draw()
+{
+    const auto size = GLsizei(this->counts.size());
+    if (size == 0)
+        return;
+
+    if (this->index_type)
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, this->counts.data(), this->index_type, this->offsets.data(), size, this->firsts.data());
+    else
+        glMultiDrawArrays(GL_TRIANGLES, this->firsts.data(), this->counts.data(), size);
+
+    this->counts.clear();
+    this->offsets.clear();
+    this->firsts.clear();
+}
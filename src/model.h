@@ -1,25 +1,191 @@
 #pragma once
 
+#include <deque>
+#include <map>
 #include <vector>
 
 #include <glad/glad.h>
 
+#include "gpu.h"
 #include "maths.h"
 #include "texture.h"
+#include "loader.h"
 
 
+// What CreateMesh uploads: Vertex as is, or PackedVertex at half the size.
+enum class VertexFormat { FULL, PACKED, COUNT };
+
+constexpr size_t VertexSize(VertexFormat format)
+{
+    return (format == VertexFormat::PACKED) ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+
+// A range of the vertex and index buffers of a MeshArena.
 struct Mesh
 {
-    GLuint  id      = 0;
-    size_t  count   = 0;
-    Texture texture = {};
+    GLuint        id           = 0;   // Vertex array, shared by all meshes of the same format in the arena.
+    size_t        count        = 0;   // Number of indices if indexed, otherwise number of vertices.
+    GLenum        index_type   = 0;   // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT if indexed, otherwise 0.
+    GLint         base_vertex  = 0;   // Of the mesh's first vertex in the arena.
+    size_t        index_offset = 0;   // In bytes, into the arena's index buffer.
+    size_t        vertex_count = 0;
+    VertexFormat  format       = VertexFormat::FULL;
+    TextureHandle texture      = {};
+    Quantization  quantization = {};  // Identity unless the vertices are packed.
+};
+
+
+// Hands out ranges of [0, capacity) in some unit. Free ranges are kept both by offset, so neighbours merge again when
+// freed, and by size, so the smallest one that fits is used (best fit). Both take O(log n) in the number of free ranges.
+class RangeAllocator
+{
+public:
+    static constexpr size_t INVALID = size_t(-1);
+
+    explicit RangeAllocator(size_t capacity = 0);
+
+    // INVALID if there's no free range that large.
+    size_t allocate(size_t size);
+    void   free(size_t offset, size_t size);
+
+    // Adds [capacity(), capacity) at the end.
+    void   grow(size_t capacity);
+
+    [[nodiscard]] size_t capacity() const noexcept { return this->total; }
+    [[nodiscard]] size_t used()     const noexcept { return this->in_use; }
+
+private:
+    void insert(size_t offset, size_t size);
+    std::map<size_t, size_t>::iterator erase(std::map<size_t, size_t>::iterator range);
+
+    std::map<size_t, size_t>      by_offset;   // Offset to size.
+    std::multimap<size_t, size_t> by_size;     // Size to offset.
+    size_t                        total  = 0;
+    size_t                        in_use = 0;
+};
+
+
+// Vertices and indices of all meshes, in one vertex buffer, index buffer and vertex array per VertexFormat. Meshes are
+// ranges of them, so switching between meshes of the same format needs no binds, and consecutive draws can be merged
+// (see DrawBatch). Buffers double when full; the old contents are copied over on the GPU. Owns the buffers.
+class MeshArena
+{
+public:
+    MeshArena() = default;
+    MeshArena(const MeshArena&) = delete;
+    MeshArena& operator= (const MeshArena&) = delete;
+
+    // 'vertices' are of 'format'. 'indices' may be null, in which case 'index_count' and 'index_type' are ignored.
+    Mesh add(VertexFormat format, const void* vertices, size_t vertex_count, const void* indices = nullptr, size_t index_count = 0, GLenum index_type = 0);
+
+    // The mesh's ranges are only handed out again once the GPU has retired the frame it was removed in (see gpu.h), so
+    // uploading a new mesh never waits on draws of the old one. They count as used until then.
+    void remove(const Mesh& mesh);
+
+    [[nodiscard]] size_t mesh_count()     const noexcept { return this->meshes; }
+    [[nodiscard]] size_t bytes_used()     const noexcept;
+    [[nodiscard]] size_t bytes_reserved() const noexcept;
+
+private:
+    // Vertices are allocated in vertices, indices in 4 byte words, so both kinds of index stay aligned.
+    struct Pool
+    {
+        GpuVertexArray vao      = {};
+        GpuBuffer      vbo      = {};
+        GpuBuffer      ibo      = {};
+        RangeAllocator vertices {};   // Direct-initialized, as the constructor is explicit.
+        RangeAllocator indices  {};
+    };
+
+    struct Removed
+    {
+        u64          frame        = 0;
+        VertexFormat format       = VertexFormat::FULL;
+        size_t       first_vertex = 0;
+        size_t       vertex_count = 0;
+        size_t       first_word   = 0;
+        size_t       words        = 0;   // 0 if the mesh has no indices.
+    };
+
+    void create(Pool& pool, VertexFormat format);
+    void reclaim();
+    static void grow(GpuBuffer& buffer, RangeAllocator& ranges, size_t unit, size_t needed);
+
+    Pool                pools[size_t(VertexFormat::COUNT)];
+    std::deque<Removed> removed;   // In the order they were removed.
+    size_t              meshes = 0;
+};
+
+
+Mesh CreateMesh(MeshArena& arena, const SoftwareMesh& mesh, VertexFormat format = VertexFormat::FULL);
+// Packs the mesh against 'quantization' rather than its own bounds, e.g. those of its scene, so meshes packed against
+// the same bounds unpack the same way. The vertices have to be within them.
+Mesh CreateMesh(MeshArena& arena, const SoftwareMesh& mesh, const Quantization& quantization);
+Mesh CreateMesh(MeshArena& arena, const std::vector<Vertex>& vertices);
+Mesh CreateMesh(MeshArena& arena, const Vertex* vertices, size_t vertex_count);
+Mesh CreateMesh(MeshArena& arena, const Vertex* vertices, size_t vertex_count, const void* indices, size_t index_count, GLenum index_type);
+Mesh CreateMesh(MeshArena& arena, const PackedVertex* vertices, size_t vertex_count, const Quantization& quantization);
+Mesh CreateMesh(MeshArena& arena, const PackedVertex* vertices, size_t vertex_count, const Quantization& quantization, const void* indices, size_t index_count, GLenum index_type);
+Mesh CreateMesh(MeshArena& arena, const vec3* positions, const vec2* uv_coords, const vec3* normals, size_t vertex_count);
+Mesh CreateMesh(MeshArena& arena, const std::vector<float>& positions, const std::vector<float>& texture_coordinates, const std::vector<float>& normals, const std::vector<GLuint>& indices);
+
+// Expects the mesh's vertex array to be bound. The model matrix comes from SetModelMatrix.
+void DrawMesh(const Mesh& mesh);
+
+
+// basic.vs.glsl reads a model matrix per instance from these attribute locations, one column each.
+constexpr GLuint INSTANCE_MODEL_LOCATION = 3;
+constexpr GLuint INSTANCE_MODEL_COLUMNS  = 4;
+
+// Model matrices of everything drawn instanced in a frame, in one buffer that's refilled every frame. The buffer is
+// orphaned on upload, so the GPU can go on reading last frame's matrices while this frame's are written.
+class InstanceBuffer
+{
+public:
+    void upload(const mat4* models, size_t count);
+
+    // Points the instance attributes of the bound vertex array at the matrices from 'first' on.
+    void bind(size_t first) const;
+
+private:
+    GpuBuffer buffer   = {};
+    size_t    capacity = 0;   // In matrices.
 };
 
+// Draws 'instances' copies of the mesh, each with the next model matrix. Expects the mesh's vertex array to be bound,
+// with an InstanceBuffer bound to it.
+void DrawMeshInstanced(const Mesh& mesh, GLsizei instances);
+
+// For draws without an InstanceBuffer: the bound vertex array stops reading instance attributes, and every vertex gets
+// 'model' instead.
+void SetModelMatrix(const mat4& model);
 
-Mesh CreateMesh(const std::vector<Vertex>& vertices);
-Mesh CreateMesh(const vec3* positions, const vec2* uv_coords, const vec3* normals, size_t vertex_count);
-Mesh CreateMesh(const std::vector<float>& positions, const std::vector<float>& texture_coordinates, const std::vector<float>& normals, const std::vector<GLuint>& indices);
 
+// Draws of meshes from the same vertex array and of the same index type, gathered so they go out as a single
+// glMultiDrawElementsBaseVertex (or glMultiDrawArrays). Everything else they use, like uniforms and textures, has to be
+// the same for all of them, including the model matrix (see SetModelMatrix, or InstanceBuffer::bind, whose first matrix
+// is the one draws that aren't instanced get), so it's up to the caller to draw() before changing any of it.
+class DrawBatch
+{
+public:
+    // Whether 'mesh' can be drawn along with the ones already added.
+    [[nodiscard]] bool fits(const Mesh& mesh) const noexcept;
+
+    void add(const Mesh& mesh);
+
+    // Draws and empties the batch. Expects its vertex array to be bound.
+    void draw();
+
+    [[nodiscard]] size_t size() const noexcept { return this->counts.size(); }
+
+private:
+    GLuint                   vao        = 0;
+    GLenum                   index_type = 0;
+    std::vector<GLsizei>     counts     = {};
+    std::vector<const void*> offsets    = {};   // Indexed meshes.
+    std::vector<GLint>       firsts     = {};   // Base vertices, or first vertices of meshes without indices.
+};
 
 
 struct Cube
@@ -0,0 +1,546 @@
+// The parser reuses tinyobj's internals (number parsing, triangulation, material files) so its output matches
+// tinyobj::ObjReader bit for bit, which is why the implementation lives in this file.
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "obj.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <utility>
+
+#include "utils.h"
+
+
+// Chunks smaller than this aren't worth the bookkeeping.
+constexpr usize OBJ_MIN_CHUNK_SIZE  = 64 * 1024;
+constexpr usize OBJ_CHUNKS_PER_THREAD = 4;
+
+
+// Everything in a line that depends on the lines before it. Faces and attributes are resolved during tokenizing; these
+// are replayed in file order afterwards.
+enum class ObjCommand : u8
+{
+    FACE, LINE, POINTS, USE_MATERIAL, MATERIAL_LIBRARY, GROUP, OBJECT, SMOOTHING, FAILURE
+};
+
+struct ObjRecord
+{
+    ObjCommand command;
+    u32 line;       // Within the chunk, 0-based.
+    u32 first;      // Corners for FACE, LINE and POINTS. A string for the rest. The smoothing group for SMOOTHING.
+    u32 count;      // Corners for FACE, LINE and POINTS. Non-zero for a GROUP without a name.
+};
+
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+
+    // Counted in the first pass, and turned into the offsets of this chunk before the second.
+    usize lines = 0, positions = 0, normals = 0, texcoords = 0;
+
+    std::vector<tinyobj::vertex_index_t> corners;
+    std::vector<ObjRecord>               records;
+    std::vector<std::string>             strings;
+
+    int greatest_v_idx  = -1;
+    int greatest_vn_idx = -1;
+    int greatest_vt_idx = -1;
+};
+
+// A face in the current group, pointing into the corners of its chunk.
+struct ObjFace
+{
+    const tinyobj::vertex_index_t* corners;
+    u32          count;
+    unsigned int smoothing_group_id;
+};
+
+
+// Lines end at '\n', '\r\n' or a lone '\r', like tinyobj's safeGetline.
+static const char* FindLineEnd(const char* at, const char* end)
+{
+    while (at < end && *at != '\n' && *at != '\r')
+        ++at;
+    return at;
+}
+
+static const char* SkipLineEnd(const char* at, const char* end)
+{
+    if (at < end && *at == '\r')
+        ++at;
+    else if (at < end && *at == '\n')
+        return at + 1;
+
+    if (at < end && *at == '\n')
+        ++at;
+    return at;
+}
+
+// Chunks start right after a '\n', so a '\r\n' is never split and every chunk starts at the beginning of a line.
+static std::vector<ObjChunk> SplitIntoChunks(const char* data, usize size, usize threads)
+{
+    const usize count = std::max<usize>(1, std::min(size / OBJ_MIN_CHUNK_SIZE, threads * OBJ_CHUNKS_PER_THREAD));
+
+    std::vector<ObjChunk> chunks;
+    chunks.reserve(count);
+
+    const char* end   = data + size;
+    const char* begin = data;
+    for (usize i = 1; i <= count && begin < end; ++i)
+    {
+        const char* split = (i == count) ? end : data + size / count * i;
+        if (split < begin)
+            split = begin;
+
+        const auto* newline = (const char*) std::memchr(split, '\n', usize(end - split));
+        split = newline ? newline + 1 : end;
+
+        auto& chunk = chunks.emplace_back();
+        chunk.begin = begin;
+        chunk.end   = split;
+        begin = split;
+    }
+    return chunks;
+}
+
+
+// First pass: count the lines and attributes of a chunk, so the second pass knows where its attributes go.
+static void CountChunk(ObjChunk& chunk)
+{
+    const char* at = chunk.begin;
+    while (at < chunk.end)
+    {
+        const char* line_end = FindLineEnd(at, chunk.end);
+
+        const char* token = at;
+        while (token < line_end && IS_SPACE(*token))
+            ++token;
+
+        auto peek = [token, line_end](usize i) { return (token + i < line_end) ? token[i] : '\0'; };
+        if (peek(0) == 'v')
+        {
+            if (IS_SPACE(peek(1)))
+                ++chunk.positions;
+            else if (peek(1) == 'n' && IS_SPACE(peek(2)))
+                ++chunk.normals;
+            else if (peek(1) == 't' && IS_SPACE(peek(2)))
+                ++chunk.texcoords;
+        }
+
+        ++chunk.lines;
+        at = SkipLineEnd(line_end, chunk.end);
+    }
+}
+
+
+// Parses 'l', 'p' and 'f' corners the way LoadObj does. Returns false on a zero index.
+static bool ParseCorners(ObjChunk& chunk, const char* token, int positions, int normals, int texcoords)
+{
+    while (!IS_NEW_LINE(token[0]))
+    {
+        tinyobj::vertex_index_t corner;
+        if (!tinyobj::parseTriple(&token, positions, normals, texcoords, &corner))
+            return false;
+
+        chunk.greatest_v_idx  = std::max(chunk.greatest_v_idx,  corner.v_idx);
+        chunk.greatest_vn_idx = std::max(chunk.greatest_vn_idx, corner.vn_idx);
+        chunk.greatest_vt_idx = std::max(chunk.greatest_vt_idx, corner.vt_idx);
+
+        chunk.corners.push_back(corner);
+        token += strspn(token, " \t\r");
+    }
+    return true;
+}
+
+// Second pass: parse the attributes straight into their final place and resolve all face indices. Mirrors the line
+// handling of tinyobj::LoadObj.
+static void TokenizeChunk(ObjChunk& chunk, tinyobj::attrib_t& attrib)
+{
+    auto* positions = attrib.vertices.data()  + 3 * chunk.positions;
+    auto* colors    = attrib.colors.data()    + 3 * chunk.positions;
+    auto* normals   = attrib.normals.data()   + 3 * chunk.normals;
+    auto* texcoords = attrib.texcoords.data() + 2 * chunk.texcoords;
+
+    // Relative indices are resolved against everything before the line, including earlier chunks.
+    int position_count = int(chunk.positions);
+    int normal_count   = int(chunk.normals);
+    int texcoord_count = int(chunk.texcoords);
+
+    // tinyobj's parsing helpers expect null-terminated lines.
+    std::string line;
+
+    u32 line_number = 0;
+    const char* at  = chunk.begin;
+    for (; at < chunk.end; at = SkipLineEnd(at, chunk.end), ++line_number)
+    {
+        const char* line_end = FindLineEnd(at, chunk.end);
+        line.assign(at, line_end);
+        at = line_end;
+
+        const char* token = line.c_str();
+        token += strspn(token, " \t");
+
+        if (token[0] == '\0' || token[0] == '#')
+            continue;
+
+        if (token[0] == 'v' && IS_SPACE(token[1]))
+        {
+            token += 2;
+            tinyobj::parseVertexWithColor(&positions[0], &positions[1], &positions[2], &colors[0], &colors[1], &colors[2], &token);
+            positions += 3;
+            colors    += 3;
+            ++position_count;
+            continue;
+        }
+
+        if (token[0] == 'v' && token[1] == 'n' && IS_SPACE(token[2]))
+        {
+            token += 3;
+            tinyobj::parseReal3(&normals[0], &normals[1], &normals[2], &token);
+            normals += 3;
+            ++normal_count;
+            continue;
+        }
+
+        if (token[0] == 'v' && token[1] == 't' && IS_SPACE(token[2]))
+        {
+            token += 3;
+            tinyobj::parseReal2(&texcoords[0], &texcoords[1], &token);
+            texcoords += 2;
+            ++texcoord_count;
+            continue;
+        }
+
+        // Skin weights ('vw') and tags ('t') aren't supported.
+        if (token[0] == 'v' && token[1] == 'w' && IS_SPACE(token[2]))
+            continue;
+
+        const bool is_line   = token[0] == 'l' && IS_SPACE(token[1]);
+        const bool is_points = token[0] == 'p' && IS_SPACE(token[1]);
+        const bool is_face   = token[0] == 'f' && IS_SPACE(token[1]);
+        if (is_line || is_points || is_face)
+        {
+            token += 2;
+            if (is_face)
+                token += strspn(token, " \t");
+
+            const auto first = u32(chunk.corners.size());
+            if (!ParseCorners(chunk, token, position_count, normal_count, texcoord_count))
+            {
+                chunk.corners.resize(first);
+                chunk.records.push_back({ ObjCommand::FAILURE, line_number, u32(is_line ? 'l' : is_points ? 'p' : 'f'), 0 });
+                return;
+            }
+
+            const auto command = is_line ? ObjCommand::LINE : is_points ? ObjCommand::POINTS : ObjCommand::FACE;
+            chunk.records.push_back({ command, line_number, first, u32(chunk.corners.size()) - first });
+            continue;
+        }
+
+        if (0 == strncmp(token, "usemtl", 6))
+        {
+            token += 6;
+            chunk.records.push_back({ ObjCommand::USE_MATERIAL, line_number, u32(chunk.strings.size()), 0 });
+            chunk.strings.push_back(tinyobj::parseString(&token));
+            continue;
+        }
+
+        if (0 == strncmp(token, "mtllib", 6) && IS_SPACE(token[6]))
+        {
+            token += 7;
+            chunk.records.push_back({ ObjCommand::MATERIAL_LIBRARY, line_number, u32(chunk.strings.size()), 0 });
+            chunk.strings.emplace_back(token);
+            continue;
+        }
+
+        if (token[0] == 'g' && IS_SPACE(token[1]))
+        {
+            // The first name is the 'g' itself. Multiple names are joined with a space.
+            std::vector<std::string> names;
+            while (!IS_NEW_LINE(token[0]))
+            {
+                names.push_back(tinyobj::parseString(&token));
+                token += strspn(token, " \t\r");
+            }
+
+            std::string name;
+            for (usize i = 1; i < names.size(); ++i)
+                name += ((i > 1) ? " " : "") + names[i];
+
+            chunk.records.push_back({ ObjCommand::GROUP, line_number, u32(chunk.strings.size()), u32(names.size() < 2) });
+            chunk.strings.push_back(std::move(name));
+            continue;
+        }
+
+        if (token[0] == 'o' && IS_SPACE(token[1]))
+        {
+            token += 2;
+            chunk.records.push_back({ ObjCommand::OBJECT, line_number, u32(chunk.strings.size()), 0 });
+            chunk.strings.emplace_back(token);
+            continue;
+        }
+
+        if (token[0] == 's' && IS_SPACE(token[1]))
+        {
+            token += 2;
+            token += strspn(token, " \t");
+
+            if (token[0] == '\0' || token[0] == '\r' || token[1] == '\n')
+                continue;
+
+            unsigned int id = 0;
+            if (!(strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' && token[2] == 'f'))
+                id = unsigned(std::max(0, tinyobj::parseInt(&token)));
+
+            chunk.records.push_back({ ObjCommand::SMOOTHING, line_number, id, 0 });
+            continue;
+        }
+    }
+}
+
+
+// exportGroupsToShape, but triangles are emitted directly instead of going through a face_t each. Polygons, lines and
+// points are still handed to tinyobj so they come out exactly the same.
+static bool ExportGroup(tinyobj::shape_t& shape, const std::vector<ObjFace>& faces, const tinyobj::PrimGroup& others, int material, const std::string& name, const std::vector<tinyobj::real_t>& positions)
+{
+    static const std::vector<tinyobj::tag_t> no_tags;
+
+    if (faces.empty() && others.IsEmpty())
+        return false;
+
+    shape.name = name;
+
+    tinyobj::PrimGroup polygon;
+    polygon.faceGroup.resize(1);
+
+    auto& mesh = shape.mesh;
+    for (const auto& face : faces)
+    {
+        if (face.count == 3)
+        {
+            for (u32 i = 0; i < 3; ++i)
+                mesh.indices.push_back({ face.corners[i].v_idx, face.corners[i].vn_idx, face.corners[i].vt_idx });
+            mesh.num_face_vertices.push_back(3);
+            mesh.material_ids.push_back(material);
+            mesh.smoothing_group_ids.push_back(face.smoothing_group_id);
+        }
+        else if (face.count > 3)
+        {
+            auto& polygon_face = polygon.faceGroup[0];
+            polygon_face.smoothing_group_id = face.smoothing_group_id;
+            polygon_face.vertex_indices.assign(face.corners, face.corners + face.count);
+            tinyobj::exportGroupsToShape(&shape, polygon, no_tags, material, name, true, positions);
+        }
+    }
+
+    if (!others.IsEmpty())
+        tinyobj::exportGroupsToShape(&shape, others, no_tags, material, name, true, positions);
+
+    return true;
+}
+
+
+bool ParseObj(const std::string& input_file, const std::string& mtl_search_path, ObjContents& contents, ThreadPool& pool)
+{
+    contents.attrib = {};
+    contents.shapes.clear();
+    contents.material_files.clear();
+
+    // Empty files can't be mapped, but are fine to parse.
+    auto file = MappedFile::open(input_file);
+    const auto info = GetFileInfo(input_file);
+    if (!file && (!info.exists || info.size > 0))
+    {
+        contents.error += "Cannot open file [" + input_file + "]\n";
+        return false;
+    }
+
+    // Same material directory as ObjReader::ParseFromFile and LoadObj would pick.
+    std::string base_directory = mtl_search_path;
+    if (base_directory.empty())
+    {
+        const auto slash = input_file.find_last_of("/\\");
+        if (slash != std::string::npos)
+            base_directory = input_file.substr(0, slash);
+    }
+    if (!base_directory.empty() && base_directory.back() != '/')
+        base_directory += '/';
+    tinyobj::MaterialFileReader material_reader(base_directory);
+
+
+    auto chunks = SplitIntoChunks((const char*) file.data, file.size, pool.size() + 1);
+
+    pool.parallel_for(chunks.size(), [&chunks](usize i) { CountChunk(chunks[i]); });
+
+    usize lines = 0, positions = 0, normals = 0, texcoords = 0;
+    for (auto& chunk : chunks)
+    {
+        lines     += std::exchange(chunk.lines,     lines);
+        positions += std::exchange(chunk.positions, positions);
+        normals   += std::exchange(chunk.normals,   normals);
+        texcoords += std::exchange(chunk.texcoords, texcoords);
+    }
+
+    auto& attrib = contents.attrib;
+    attrib.vertices.resize(3 * positions);
+    attrib.colors.resize(3 * positions);
+    attrib.normals.resize(3 * normals);
+    attrib.texcoords.resize(2 * texcoords);
+
+    pool.parallel_for(chunks.size(), [&chunks, &attrib](usize i) { TokenizeChunk(chunks[i], attrib); });
+
+
+    // Replay everything that depends on order, as LoadObj does while it reads.
+    auto& shapes    = contents.shapes;
+    auto& materials = contents.materials;
+    auto& warning   = contents.warning;
+    auto& error     = contents.error;
+
+    std::map<std::string, int> material_map;
+    int material = -1;
+    unsigned int smoothing_group_id = 0;
+
+    std::string          name;
+    tinyobj::shape_t     shape;
+    std::vector<ObjFace> faces;
+    tinyobj::PrimGroup   others;
+
+    for (const auto& chunk : chunks)
+    {
+        for (const auto& record : chunk.records)
+        {
+            const usize line_number = chunk.lines + record.line + 1;
+            switch (record.command)
+            {
+                case ObjCommand::FACE:
+                    faces.push_back({ chunk.corners.data() + record.first, record.count, smoothing_group_id });
+                    break;
+
+                case ObjCommand::LINE:
+                    others.lineGroup.emplace_back();
+                    others.lineGroup.back().vertex_indices.assign(chunk.corners.data() + record.first, chunk.corners.data() + record.first + record.count);
+                    break;
+
+                case ObjCommand::POINTS:
+                    others.pointsGroup.emplace_back();
+                    others.pointsGroup.back().vertex_indices.assign(chunk.corners.data() + record.first, chunk.corners.data() + record.first + record.count);
+                    break;
+
+                case ObjCommand::USE_MATERIAL:
+                {
+                    const auto& material_name = chunk.strings[record.first];
+
+                    int new_material = -1;
+                    auto it = material_map.find(material_name);
+                    if (it != material_map.end())
+                        new_material = it->second;
+                    else
+                        warning += "material [ '" + material_name + "' ] not found in .mtl\n";
+
+                    // Faces get the material they were declared with, so the current ones are flushed into the same
+                    // shape before switching.
+                    if (new_material != material)
+                    {
+                        ExportGroup(shape, faces, others, material, name, attrib.vertices);
+                        faces.clear();
+                        material = new_material;
+                    }
+                } break;
+
+                case ObjCommand::MATERIAL_LIBRARY:
+                {
+                    std::vector<std::string> filenames;
+                    tinyobj::SplitString(chunk.strings[record.first], ' ', '\\', filenames);
+
+                    if (filenames.empty())
+                    {
+                        warning += "Looks like empty filename for mtllib. Use default material (line " + std::to_string(line_number) + ".)\n";
+                        break;
+                    }
+
+                    bool found = false;
+                    for (const auto& filename : filenames)
+                    {
+                        std::string material_warning;
+                        std::string material_error;
+                        found = material_reader(filename, &materials, &material_map, &material_warning, &material_error);
+                        warning += material_warning;
+                        error   += material_error;
+                        if (found)
+                        {
+                            contents.material_files.push_back(base_directory + filename);
+                            break;
+                        }
+                    }
+
+                    if (!found)
+                        warning += "Failed to load material file(s). Use default material.\n";
+                } break;
+
+                case ObjCommand::GROUP:
+                    ExportGroup(shape, faces, others, material, name, attrib.vertices);
+                    if (!shape.mesh.indices.empty())
+                        shapes.push_back(std::move(shape));
+
+                    shape = {};
+                    faces.clear();
+                    others.clear();
+
+                    name = chunk.strings[record.first];
+                    if (record.count)
+                        warning += "Empty group name. line: " + std::to_string(line_number) + "\n";
+                    break;
+
+                case ObjCommand::OBJECT:
+                    ExportGroup(shape, faces, others, material, name, attrib.vertices);
+                    if (!shape.mesh.indices.empty() || !shape.lines.indices.empty() || !shape.points.indices.empty())
+                        shapes.push_back(std::move(shape));
+
+                    shape = {};
+                    faces.clear();
+                    others.clear();
+
+                    name = chunk.strings[record.first];
+                    break;
+
+                case ObjCommand::SMOOTHING:
+                    smoothing_group_id = record.first;
+                    break;
+
+                case ObjCommand::FAILURE:
+                {
+                    const char  type = char(record.first);
+                    const char* what = (type == 'f') ? "face" : "vertex";
+                    error += std::string("Failed parse `") + type + "' line(e.g. zero value for " + what + " index. line " + std::to_string(line_number) + ".)\n";
+
+                    // tinyobj bails out before handing over any attributes.
+                    attrib = {};
+                    return false;
+                }
+            }
+        }
+    }
+
+    int greatest_v_idx = -1, greatest_vn_idx = -1, greatest_vt_idx = -1;
+    for (const auto& chunk : chunks)
+    {
+        greatest_v_idx  = std::max(greatest_v_idx,  chunk.greatest_v_idx);
+        greatest_vn_idx = std::max(greatest_vn_idx, chunk.greatest_vn_idx);
+        greatest_vt_idx = std::max(greatest_vt_idx, chunk.greatest_vt_idx);
+    }
+
+    if (greatest_v_idx >= int(positions))
+        warning += "Vertex indices out of bounds (line " + std::to_string(lines) + ".)\n\n";
+    if (greatest_vn_idx >= int(normals))
+        warning += "Vertex normal indices out of bounds (line " + std::to_string(lines) + ".)\n\n";
+    if (greatest_vt_idx >= int(texcoords))
+        warning += "Vertex texcoord indices out of bounds (line " + std::to_string(lines) + ".)\n\n";
+
+    // Unlike 'g' and 'o', the last shape is kept even when it ended up without any triangles.
+    const bool exported = ExportGroup(shape, faces, others, material, name, attrib.vertices);
+    if (exported || !shape.mesh.indices.empty())
+        shapes.push_back(std::move(shape));
+
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <tiny_obj_loader.h>
+
+#include "jobs.h"
+#include "types.h"
+
+
+struct ObjContents
+{
+    tinyobj::attrib_t                attrib;
+    std::vector<tinyobj::shape_t>    shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::vector<std::string>         material_files;    // The .mtl files the materials were read from.
+    std::string                      warning;
+    std::string                      error;
+};
+
+
+// Drop-in for tinyobj::ObjReader::ParseFromFile (triangulated, with vertex colors) that tokenizes the file on all
+// threads of 'pool'. The result is identical to what tinyobj produces, except that tags ('t') and skin weights ('vw')
+// are ignored. An empty 'mtl_search_path' means the directory of 'input_file'.
+bool ParseObj(const std::string& input_file, const std::string& mtl_search_path, ObjContents& contents, ThreadPool& pool = ThreadPool::shared());
@@ -0,0 +1,313 @@
+#include "optimize.h"
+
+#include <algorithm>
+
+
+VertexCacheStats AnalyzeVertexCache(const u32* indices, usize index_count, usize vertex_count, usize cache_size)
+{
+    VertexCacheStats stats;
+    stats.triangles = index_count / 3;
+
+    // A vertex is in the FIFO as long as fewer than 'cache_size' misses happened since it was loaded.
+    std::vector<usize> loaded_at(vertex_count, 0);
+    usize time = cache_size + 1;
+    for (usize i = 0; i < stats.triangles * 3; ++i)
+    {
+        const auto vertex = indices[i];
+        if (loaded_at[vertex] == 0)
+            stats.vertices += 1;
+
+        if (time - loaded_at[vertex] > cache_size)
+        {
+            loaded_at[vertex] = time++;
+            stats.misses += 1;
+        }
+    }
+
+    return stats;
+}
+
+
+std::vector<usize> OptimizeVertexCache(u32* indices, usize index_count, usize vertex_count, usize cache_size)
+{
+    const usize triangle_count = index_count / 3;
+
+    std::vector<usize> clusters;
+    if (triangle_count == 0)
+        return clusters;
+
+    // Number of triangles not yet emitted that use each vertex, and the triangles using each vertex.
+    std::vector<u32> live(vertex_count, 0);
+    for (usize i = 0; i < triangle_count * 3; ++i)
+        live[indices[i]] += 1;
+
+    std::vector<usize> first_adjacent(vertex_count + 1, 0);
+    for (usize vertex = 0; vertex < vertex_count; ++vertex)
+        first_adjacent[vertex + 1] = first_adjacent[vertex] + live[vertex];
+
+    std::vector<u32> adjacency(triangle_count * 3);
+    {
+        std::vector<usize> cursor(first_adjacent.begin(), first_adjacent.end() - 1);
+        for (usize triangle = 0; triangle < triangle_count; ++triangle)
+            for (usize k = 0; k < 3; ++k)
+                adjacency[cursor[indices[3 * triangle + k]]++] = u32(triangle);
+    }
+
+    std::vector<usize> loaded_at(vertex_count, 0);
+    std::vector<bool>  emitted(triangle_count, false);
+    std::vector<u32>   dead_ends;
+    std::vector<u32>   candidates;
+    std::vector<u32>   output;
+    output.reserve(triangle_count * 3);
+
+    usize time       = cache_size + 1;
+    usize next_input = 0;
+
+    // Recently used vertices with triangles left first, then whatever comes next in the input.
+    auto skip_dead_end = [&]() -> s64
+    {
+        while (!dead_ends.empty())
+        {
+            const auto vertex = dead_ends.back();
+            dead_ends.pop_back();
+            if (live[vertex] > 0)
+                return vertex;
+        }
+
+        for (; next_input < vertex_count; ++next_input)
+            if (live[next_input] > 0)
+                return s64(next_input++);
+
+        return -1;
+    };
+
+    s64 fan = skip_dead_end();
+    clusters.push_back(0);
+    while (fan >= 0)
+    {
+        // Emit every remaining triangle around the fanning vertex.
+        candidates.clear();
+        for (usize a = first_adjacent[fan]; a < first_adjacent[fan + 1]; ++a)
+        {
+            const auto triangle = adjacency[a];
+            if (emitted[triangle])
+                continue;
+
+            for (usize k = 0; k < 3; ++k)
+            {
+                const auto vertex = indices[3 * triangle + k];
+                output.push_back(vertex);
+                dead_ends.push_back(vertex);
+                candidates.push_back(vertex);
+                live[vertex] -= 1;
+
+                if (time - loaded_at[vertex] > cache_size)
+                    loaded_at[vertex] = time++;
+            }
+            emitted[triangle] = true;
+        }
+
+        // Continue with the oldest candidate that'll still be in the cache once its own triangles are emitted.
+        s64 best          = -1;
+        s64 best_priority = -1;
+        for (const auto vertex : candidates)
+        {
+            if (live[vertex] == 0)
+                continue;
+
+            s64 priority = 0;
+            if (time - loaded_at[vertex] + 2 * live[vertex] <= cache_size)
+                priority = s64(time - loaded_at[vertex]);
+
+            if (priority > best_priority)
+            {
+                best_priority = priority;
+                best          = vertex;
+            }
+        }
+
+        if (best < 0)
+        {
+            best = skip_dead_end();
+            if (best >= 0)
+                clusters.push_back(output.size() / 3);
+        }
+        fan = best;
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+    return clusters;
+}
+
+
+// Splits each cluster wherever the cache has done about as well as it does over the whole cluster. Every cluster starts
+// with a cold cache, as it may end up anywhere. Returns the first triangle of each of the new clusters.
+static std::vector<usize> SplitClusters(const u32* indices, usize triangle_count, usize vertex_count, const std::vector<usize>& clusters, f32 threshold, usize cache_size)
+{
+    // NOTE(ted): One time-stamped cache for everything. Bumping the time by more than the cache size empties it, so
+    //  clusters cost what they're long rather than what the whole mesh is.
+    std::vector<usize> starts;
+    std::vector<usize> loaded_at(vertex_count, 0);
+    usize time = cache_size + 1;
+
+    auto load = [&loaded_at, &time, cache_size](u32 vertex) {
+        if (time - loaded_at[vertex] <= cache_size)
+            return false;
+        loaded_at[vertex] = time++;
+        return true;
+    };
+
+    for (usize c = 0; c < clusters.size(); ++c)
+    {
+        const usize first = clusters[c];
+        const usize end   = (c + 1 < clusters.size()) ? clusters[c + 1] : triangle_count;
+
+        usize misses = 0;
+        time += cache_size + 1;
+        for (usize i = 3 * first; i < 3 * end; ++i)
+            misses += load(indices[i]);
+        const f32 target = f32(misses) / f32(end - first) * threshold;
+
+        usize start = first;
+        misses = 0;
+        starts.push_back(start);
+        time += cache_size + 1;
+
+        for (usize triangle = first; triangle < end; ++triangle)
+        {
+            for (usize k = 0; k < 3; ++k)
+                misses += load(indices[3 * triangle + k]);
+
+            if (triangle + 1 < end && f32(misses) <= target * f32(triangle + 1 - start))
+            {
+                start  = triangle + 1;
+                misses = 0;
+                starts.push_back(start);
+                time  += cache_size + 1;
+            }
+        }
+    }
+
+    return starts;
+}
+
+// Orders the clusters starting at 'starts' so the ones facing away from the center of the mesh come first.
+static void SortClusters(const u32* indices, usize triangle_count, const Vertex* vertices, const std::vector<usize>& starts, std::vector<u32>& output)
+{
+    // Area weighted centroid and normal of each cluster and of the whole mesh.
+    struct Cluster { usize start, end; vec3 centroid, normal; f32 area; f32 key; };
+    std::vector<Cluster> sorted(starts.size());
+
+    vec3 mesh_centroid = vec3(0.0f);
+    f32  mesh_area     = 0.0f;
+    for (usize c = 0; c < starts.size(); ++c)
+    {
+        auto& cluster  = sorted[c];
+        cluster.start  = starts[c];
+        cluster.end    = (c + 1 < starts.size()) ? starts[c + 1] : triangle_count;
+        cluster.centroid = vec3(0.0f);
+        cluster.normal   = vec3(0.0f);
+        cluster.area     = 0.0f;
+
+        for (usize triangle = cluster.start; triangle < cluster.end; ++triangle)
+        {
+            const auto& a = vertices[indices[3 * triangle + 0]].position;
+            const auto& b = vertices[indices[3 * triangle + 1]].position;
+            const auto& c = vertices[indices[3 * triangle + 2]].position;
+
+            const vec3 normal = glm::cross(b - a, c - a);
+            const f32  area   = glm::length(normal);
+
+            cluster.centroid += (a + b + c) * (area / 3.0f);
+            cluster.normal   += normal;
+            cluster.area     += area;
+        }
+
+        mesh_centroid += cluster.centroid;
+        mesh_area     += cluster.area;
+
+        if (cluster.area > 0.0f)
+            cluster.centroid /= cluster.area;
+    }
+    if (mesh_area > 0.0f)
+        mesh_centroid /= mesh_area;
+
+    for (auto& cluster : sorted)
+    {
+        const f32 length = glm::length(cluster.normal);
+        cluster.key = (length > 0.0f) ? glm::dot(cluster.centroid - mesh_centroid, cluster.normal / length) : 0.0f;
+    }
+
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) { return a.key > b.key; });
+
+    output.clear();
+    output.reserve(triangle_count * 3);
+    for (const auto& cluster : sorted)
+        output.insert(output.end(), indices + 3 * cluster.start, indices + 3 * cluster.end);
+}
+
+void OptimizeOverdraw(u32* indices, usize index_count, const Vertex* vertices, usize vertex_count, const std::vector<usize>& clusters, f32 threshold, usize cache_size)
+{
+    const usize triangle_count = index_count / 3;
+    if (triangle_count == 0 || clusters.empty())
+        return;
+
+    const f32 limit = AnalyzeVertexCache(indices, index_count, vertex_count, cache_size).acmr() * threshold;
+
+    // Smaller clusters sort better, but each one starts with a cold cache. If splitting costs more than 'threshold',
+    // only the clusters we were given are sorted, and if even that does, the order is left alone.
+    const auto split = SplitClusters(indices, triangle_count, vertex_count, clusters, threshold, cache_size);
+
+    std::vector<u32> output;
+    for (const auto* starts : { &split, &clusters })
+    {
+        SortClusters(indices, triangle_count, vertices, *starts, output);
+        if (AnalyzeVertexCache(output.data(), output.size(), vertex_count, cache_size).acmr() <= limit)
+        {
+            std::copy(output.begin(), output.end(), indices);
+            return;
+        }
+    }
+}
+
+
+void OptimizeVertexFetch(Vertex* vertices, usize vertex_count, u32* indices, usize index_count)
+{
+    constexpr u32 UNUSED = u32(-1);
+
+    std::vector<u32> remap(vertex_count, UNUSED);
+    u32 next = 0;
+    for (usize i = 0; i < index_count; ++i)
+    {
+        auto& vertex = remap[indices[i]];
+        if (vertex == UNUSED)
+            vertex = next++;
+        indices[i] = vertex;
+    }
+
+    // Anything unreferenced goes last.
+    for (auto& vertex : remap)
+        if (vertex == UNUSED)
+            vertex = next++;
+
+    std::vector<Vertex> reordered(vertex_count);
+    for (usize vertex = 0; vertex < vertex_count; ++vertex)
+        reordered[remap[vertex]] = vertices[vertex];
+
+    std::copy(reordered.begin(), reordered.end(), vertices);
+}
+
+
+void OptimizeMesh(Vertex* vertices, usize vertex_count, u32* indices, usize index_count)
+{
+    // Small meshes are sometimes already in a better order than Tipsify's, which is then kept.
+    const std::vector<u32> input(indices, indices + index_count);
+    const auto before = AnalyzeVertexCache(indices, index_count, vertex_count);
+
+    const auto clusters = OptimizeVertexCache(indices, index_count, vertex_count);
+    OptimizeOverdraw(indices, index_count, vertices, vertex_count, clusters);
+    if (AnalyzeVertexCache(indices, index_count, vertex_count).misses > before.misses)
+        std::copy(input.begin(), input.end(), indices);
+
+    OptimizeVertexFetch(vertices, vertex_count, indices, index_count);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+#include "maths.h"
+#include "types.h"
+
+
+// Post-transform cache size we optimize for. Real hardware varies; 16 is a safe middle ground.
+constexpr usize VERTEX_CACHE_SIZE = 16;
+
+// How much worse than its best the vertex cache may get to allow better triangle order for overdraw.
+constexpr f32 OVERDRAW_THRESHOLD = 1.05f;
+
+
+// Simulated FIFO cache misses of an indexed triangle list.
+struct VertexCacheStats
+{
+    usize triangles = 0;
+    usize vertices  = 0;    // Vertices actually referenced.
+    usize misses    = 0;
+
+    // Average cache miss ratio: transformed vertices per triangle. 0.5 is the best possible, 3.0 the worst.
+    [[nodiscard]] f32 acmr() const noexcept { return this->triangles ? f32(this->misses) / f32(this->triangles) : 0.0f; }
+    // Average transform to vertex ratio: transformed vertices per vertex. 1.0 is the best possible.
+    [[nodiscard]] f32 atvr() const noexcept { return this->vertices ? f32(this->misses) / f32(this->vertices) : 0.0f; }
+
+    VertexCacheStats& operator+= (const VertexCacheStats& other) noexcept
+    {
+        this->triangles += other.triangles;
+        this->vertices  += other.vertices;
+        this->misses    += other.misses;
+        return *this;
+    }
+};
+
+VertexCacheStats AnalyzeVertexCache(const u32* indices, usize index_count, usize vertex_count, usize cache_size = VERTEX_CACHE_SIZE);
+
+
+// Reorders the triangles for the post-transform cache (Tipsify, Sander et al. 2007). Returns the first triangle of each
+// cluster, i.e. each place the algorithm had to jump to an unrelated part of the mesh.
+std::vector<usize> OptimizeVertexCache(u32* indices, usize index_count, usize vertex_count, usize cache_size = VERTEX_CACHE_SIZE);
+
+// Splits the clusters further wherever the cache is doing well enough ('threshold'), then orders them so the ones
+// facing away from the center of the mesh are drawn first, as they're the ones most likely to occlude the others.
+// The new order is only kept if its ACMR is within 'threshold' of the order it started from.
+void OptimizeOverdraw(u32* indices, usize index_count, const Vertex* vertices, usize vertex_count, const std::vector<usize>& clusters, f32 threshold = OVERDRAW_THRESHOLD, usize cache_size = VERTEX_CACHE_SIZE);
+
+// Reorders the vertices in the order they're first used, so fetching them walks memory linearly.
+void OptimizeVertexFetch(Vertex* vertices, usize vertex_count, u32* indices, usize index_count);
+
+// All of the above, in that order. The triangles keep their input order if it has fewer cache misses.
+void OptimizeMesh(Vertex* vertices, usize vertex_count, u32* indices, usize index_count);
@@ -13,8 +13,8 @@ void Renderer:::begin_scene(const Camera& camera)
     auto view       = ViewMatrix(camera.position, camera.forward);
     auto projection = camera.perspective_projection();
 
-    SetUniform(shader, "view",       view);
-    SetUniform(shader, "projection", projection);
+    SetUniform(shader, UNIFORM("view"),       view);
+    SetUniform(shader, UNIFORM("projection"), projection);
 };
 void Renderer:::render_mesh(const Software& mesh)
 {
@@ -27,6 +27,6 @@ void Renderer:::end_scene()
 void Renderer:::flush()
 {
     glBindVertexArray(renderable.mesh->id);
-    SetTexture2D(shader, "diffuse", 0, renderable.mesh->texture);
+    SetTexture2D(shader, UNIFORM("diffuse"), 0, renderable.mesh->texture);
     glDrawArrays(GL_TRIANGLES, 0, renderable.mesh->count);
 };
\ No newline at end of file
@@ -1,113 +1,182 @@
 #pragma once
 
-#include "types.h"
-
-
-enum class ShaderDataType
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+
+// Vertex layouts, described at compile time by the members of a vertex struct:
+//
+//     struct Vertex
+//     {
+//         glm::vec3 position;
+//         glm::vec2 uv_coord;
+//
+//         static constexpr auto Layout()
+//         {
+//             return MakeVertexLayout<Vertex>(VERTEX_ATTRIBUTE(Vertex, position), VERTEX_ATTRIBUTE(Vertex, uv_coord));
+//         }
+//     };
+//
+// Types and offsets are taken from the members, so they can't disagree with the struct, and the attributes have to
+// cover all of it in order, so a member that's left out, given out of order, or padding is a compile error rather than
+// a wrong stride. Layout() is a function since offsetof needs the struct to be complete.
+//
+// Members stored in a smaller form than the shader reads them name that form with VERTEX_ATTRIBUTE_AS:
+//
+//     VERTEX_ATTRIBUTE_AS(PackedVertex, uv_coord, HalfFloat<2>)
+
+
+// How a member of type T is read by the vertex shader. Types without one can't be attributes.
+template <typename T> struct AttributeTraits;
+
+template <GLenum Type, GLenum BaseType, GLint Components, GLint Columns = 1, GLboolean Normalized = GL_FALSE>
+struct AttributeTraitsOf
 {
-    None = 0, Float, Float2, Float3, Float4, Mat3, Mat4, Int, Int2, Int3, Int4, Bool
+    static constexpr GLenum    type       = Type;         // As glGetActiveAttrib reports it.
+    static constexpr GLenum    base_type  = BaseType;     // Of each component.
+    static constexpr GLint     components = Components;   // Per column.
+    static constexpr GLint     columns    = Columns;      // Matrices take up a location per column.
+    static constexpr GLboolean normalized = Normalized;   // Integers the shader reads as floats in [0, 1] or [-1, 1].
 };
 
-
-struct BufferElement
+template <> struct AttributeTraits<float>      : AttributeTraitsOf<GL_FLOAT,      GL_FLOAT, 1>    {};
+template <> struct AttributeTraits<glm::vec2>  : AttributeTraitsOf<GL_FLOAT_VEC2, GL_FLOAT, 2>    {};
+template <> struct AttributeTraits<glm::vec3>  : AttributeTraitsOf<GL_FLOAT_VEC3, GL_FLOAT, 3>    {};
+template <> struct AttributeTraits<glm::vec4>  : AttributeTraitsOf<GL_FLOAT_VEC4, GL_FLOAT, 4>    {};
+template <> struct AttributeTraits<glm::mat3>  : AttributeTraitsOf<GL_FLOAT_MAT3, GL_FLOAT, 3, 3> {};
+template <> struct AttributeTraits<glm::mat4>  : AttributeTraitsOf<GL_FLOAT_MAT4, GL_FLOAT, 4, 4> {};
+template <> struct AttributeTraits<int>        : AttributeTraitsOf<GL_INT,        GL_INT,   1>    {};
+template <> struct AttributeTraits<glm::ivec2> : AttributeTraitsOf<GL_INT_VEC2,   GL_INT,   2>    {};
+template <> struct AttributeTraits<glm::ivec3> : AttributeTraitsOf<GL_INT_VEC3,   GL_INT,   3>    {};
+template <> struct AttributeTraits<glm::ivec4> : AttributeTraitsOf<GL_INT_VEC4,   GL_INT,   4>    {};
+
+// Packed forms, which the shader reads as floats. They stand for how a member is stored (see VERTEX_ATTRIBUTE_AS), so
+// they're never instantiated.
+template <typename T, GLint N> struct Normalized;   // N integers of type T, mapped to [0, 1] if unsigned, else [-1, 1].
+template <GLint N>             struct HalfFloat;    // N 16-bit floats.
+struct Snorm2_10_10_10;                             // x, y and z in 10 signed normalized bits each from the lowest, w in 2.
+
+template <typename T> constexpr GLenum COMPONENT_TYPE = 0;
+template <> constexpr GLenum COMPONENT_TYPE<std::int8_t>   = GL_BYTE;
+template <> constexpr GLenum COMPONENT_TYPE<std::uint8_t>  = GL_UNSIGNED_BYTE;
+template <> constexpr GLenum COMPONENT_TYPE<std::int16_t>  = GL_SHORT;
+template <> constexpr GLenum COMPONENT_TYPE<std::uint16_t> = GL_UNSIGNED_SHORT;
+
+constexpr GLenum FLOAT_VECTOR_TYPES[] = { 0, GL_FLOAT, GL_FLOAT_VEC2, GL_FLOAT_VEC3, GL_FLOAT_VEC4 };
+
+template <typename T, GLint N> struct AttributeTraits<Normalized<T, N>> : AttributeTraitsOf<FLOAT_VECTOR_TYPES[N], COMPONENT_TYPE<T>, N, 1, GL_TRUE>
 {
-    std::string Name;
-    ShaderDataType Type;
-    u32    size;
-    usize  offset;
-    bool   normalized;
-
-    BufferElement() = default;
-
-    BufferElement(ShaderDataType type, const std::string& name, bool normalized = false)
-    : Name(name), Type(type), Size(ShaderDataTypeSize(type)), Offset(0), Normalized(normalized)
-    {
-    }
+    static_assert(COMPONENT_TYPE<T> != 0 && N >= 1 && N <= 4, "Only 1 to 4 8- or 16-bit integers can be normalized.");
+    static constexpr std::size_t stored_size = sizeof(T) * N;
+};
+template <GLint N> struct AttributeTraits<HalfFloat<N>> : AttributeTraitsOf<FLOAT_VECTOR_TYPES[N], GL_HALF_FLOAT, N>
+{
+    static_assert(N >= 1 && N <= 4, "Only 1 to 4 half floats make an attribute.");
+    static constexpr std::size_t stored_size = 2 * N;
+};
+template <> struct AttributeTraits<Snorm2_10_10_10> : AttributeTraitsOf<GL_FLOAT_VEC4, GL_INT_2_10_10_10_REV, 4, 1, GL_TRUE>
+{
+    static constexpr std::size_t stored_size = 4;
+};
 
-    uint32_t GetComponentCount() const
-    {
-        switch (Type)
-        {
-            case ShaderDataType::Float:   return 1;
-            case ShaderDataType::Float2:  return 2;
-            case ShaderDataType::Float3:  return 3;
-            case ShaderDataType::Float4:  return 4;
-            case ShaderDataType::Mat3:    return 3;  // 3* float3
-            case ShaderDataType::Mat4:    return 4;  // 4* float4
-            case ShaderDataType::Int:     return 1;
-            case ShaderDataType::Int2:    return 2;
-            case ShaderDataType::Int3:    return 3;
-            case ShaderDataType::Int4:    return 4;
-            case ShaderDataType::Bool:    return 1;
-        }
 
-        HZ_CORE_ASSERT(false, "Unknown ShaderDataType!");
-        return 0;
-    }
+struct VertexAttribute
+{
+    const char*   name;
+    GLenum        type;
+    GLenum        base_type;
+    GLint         components;
+    GLint         columns;
+    GLboolean     normalized;
+    std::uint32_t offset;      // In bytes, from the start of the vertex.
+    std::uint32_t size;        // In bytes, of the member.
 };
 
-class BufferLayout
+// An attribute that still knows its member's type and offset, so MakeVertexLayout can check them. Made by
+// VERTEX_ATTRIBUTE and VERTEX_ATTRIBUTE_AS.
+template <typename T, std::size_t Offset>
+struct TypedVertexAttribute
 {
-public:
-    BufferLayout() {}
+    using Member = T;
+    static constexpr std::size_t offset = Offset;
 
-    BufferLayout(std::initializer_list<BufferElement> elements)
-            : m_Elements(elements)
-    {
-        CalculateOffsetsAndStride();
-    }
-
-    uint32_t GetStride() const { return m_Stride; }
-    const std::vector<BufferElement>& GetElements() const { return m_Elements; }
-
-    std::vector<BufferElement>::iterator begin() { return m_Elements.begin(); }
-    std::vector<BufferElement>::iterator end() { return m_Elements.end(); }
-    std::vector<BufferElement>::const_iterator begin() const { return m_Elements.begin(); }
-    std::vector<BufferElement>::const_iterator end() const { return m_Elements.end(); }
-private:
-    void CalculateOffsetsAndStride()
-    {
-        size_t offset = 0;
-        m_Stride = 0;
-        for (auto& element : m_Elements)
-        {
-            element.Offset = offset;
-            offset += element.Size;
-            m_Stride += element.Size;
-        }
-    }
-private:
-    std::vector<BufferElement> m_Elements;
-    uint32_t m_Stride = 0;
+    VertexAttribute attribute;
 };
 
-
-class VertexBuffer
+// A member of type T at 'Offset', read as 'As' describes.
+template <typename T, std::size_t Offset, typename As = T>
+constexpr TypedVertexAttribute<T, Offset> MakeVertexAttribute(const char* name)
 {
-public:
-    VertexBuffer() = default;
+    using Traits = AttributeTraits<As>;
+    if constexpr (!std::is_same_v<T, As>)
+        static_assert(Traits::stored_size <= sizeof(T), "The member is smaller than the form it's read as.");
+    return { { name, Traits::type, Traits::base_type, Traits::components, Traits::columns, Traits::normalized, std::uint32_t(Offset), std::uint32_t(sizeof(T)) } };
+}
 
-    void Bind() const = 0;
-    void Unbind() const = 0;
+#define VERTEX_ATTRIBUTE(Vertex, member)        MakeVertexAttribute<decltype(Vertex::member), offsetof(Vertex, member)>(#member)
+#define VERTEX_ATTRIBUTE_AS(Vertex, member, ...) MakeVertexAttribute<decltype(Vertex::member), offsetof(Vertex, member), __VA_ARGS__>(#member)
 
-    void SetData(const void* data, uint32_t size) = 0;
 
-    const BufferLayout& GetLayout() const = 0;
-    void SetLayout(const BufferLayout& layout) = 0;
-
-    static VertexBuffer Create(uint32_t size);
-    static VertexBuffer Create(float* vertices, uint32_t size);
+template <std::size_t N>
+struct VertexLayout
+{
+    std::array<VertexAttribute, N> attributes;
+    GLsizei                        stride;
 };
 
-class IndexBuffer
+// Whether each member starts where the one before it ends, the first at 0.
+template <typename... Attributes>
+constexpr bool AreContiguous()
 {
-public:
-    IndexBuffer() = default;
+    constexpr std::size_t offsets[] = { Attributes::offset..., 0 };
+    constexpr std::size_t sizes[]   = { sizeof(typename Attributes::Member)..., 0 };
 
-    void Bind() const = 0;
-    void Unbind() const = 0;
+    std::size_t end = 0;
+    for (std::size_t i = 0; i < sizeof...(Attributes); ++i)
+    {
+        if (offsets[i] != end)
+            return false;
+        end += sizes[i];
+    }
+    return true;
+}
 
-    uint32_t GetCount() const = 0;
+// Attributes go to consecutive locations, in the order they're given.
+template <typename Vertex, typename... Attributes>
+constexpr VertexLayout<sizeof...(Attributes)> MakeVertexLayout(Attributes... attributes)
+{
+    static_assert(std::is_standard_layout_v<Vertex>, "Offsets of members are only defined for standard layout types.");
+    static_assert(AreContiguous<Attributes...>(), "The attributes aren't given in the order of the members, or there's padding between them.");
+    static_assert((sizeof(typename Attributes::Member) + ... + 0) == sizeof(Vertex), "The attributes don't add up to the whole vertex, so the stride would be wrong. Is a member left out, or is there padding?");
+    return { { attributes.attribute... }, GLsizei(sizeof(Vertex)) };
+}
 
-    static Ref<IndexBuffer> Create(uint32_t* indices, uint32_t count);
-};
\ No newline at end of file
+
+// Points the bound vertex array's attributes, from 'first_location' on, at the vertices in the bound GL_ARRAY_BUFFER.
+// Returns the location after the last one.
+template <std::size_t N>
+GLuint SetVertexAttributes(const VertexLayout<N>& layout, GLuint first_location = 0)
+{
+    GLuint location = first_location;
+    for (const auto& attribute : layout.attributes)
+    {
+        for (GLint column = 0; column < attribute.columns; ++column, ++location)
+        {
+            const auto  offset  = attribute.offset + std::uint32_t(column) * (attribute.size / std::uint32_t(attribute.columns));
+            const auto* pointer = reinterpret_cast<const void*>(std::uintptr_t(offset));
+
+            // Everything but plain integers is read as floats.
+            glEnableVertexAttribArray(location);
+            if (attribute.base_type == GL_FLOAT || attribute.base_type == GL_HALF_FLOAT || attribute.normalized)
+                glVertexAttribPointer(location, attribute.components, attribute.base_type, attribute.normalized, layout.stride, pointer);
+            else
+                glVertexAttribIPointer(location, attribute.components, attribute.base_type, layout.stride, pointer);
+        }
+    }
+    return location;
+}
@@ -1,5 +1,13 @@
 #include "shader.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <thread>
+
 #include <glm/gtc/type_ptr.hpp>
 
 #include "utils.h"
@@ -14,69 +22,61 @@
 
 
 // -------- SHADERS --------
-GLuint GetUniformLocation(const Shader& shader, const char* name)
+GLint MissingUniform(const Shader& shader, UniformId uniform)
 {
-    const auto& it = shader.uniforms.find(name);
-    if (it == shader.uniforms.end())
-    {
-        INFO("Uniform '%s' doesn't exist for shader '%s'", name, shader.name.get());
-        return 0;
-    }
-    else
-    {
-        return it->second.index;
-    }
+    INFO("Uniform '%s' doesn't exist for shader '%s'", uniform.name, shader.name.get());
+    return -1;
 }
-void SetUniform(const Shader& shader, const char* name, bool value)
+void SetUniform(const Shader& shader, UniformId uniform, bool value)
 {
     ASSERT_BOUND_SHADER(shader);
 
-    GLuint location = GetUniformLocation(shader, name);
+    GLint location = GetUniformLocation(shader, uniform);
     glUniform1i(location, value);
 }
-void SetUniform(const Shader& shader, const char* name, unsigned value)
+void SetUniform(const Shader& shader, UniformId uniform, unsigned value)
 {
     ASSERT_BOUND_SHADER(shader);
 
-    GLuint location = GetUniformLocation(shader, name);
+    GLint location = GetUniformLocation(shader, uniform);
     glUniform1ui(location, value);
 }
-void SetUniform(const Shader& shader, const char* name, float value)
+void SetUniform(const Shader& shader, UniformId uniform, float value)
 {
     ASSERT_BOUND_SHADER(shader);
 
-    GLuint location = GetUniformLocation(shader, name);
+    GLint location = GetUniformLocation(shader, uniform);
     glUniform1f(location, value);
 }
-void SetUniform(const Shader& shader, const char* name, const vec3& value)
+void SetUniform(const Shader& shader, UniformId uniform, const vec3& value)
 {
     ASSERT_BOUND_SHADER(shader);
 
-    GLuint location = GetUniformLocation(shader, name);
+    GLint location = GetUniformLocation(shader, uniform);
     glUniform3f(location, value.x, value.y, value.z);
 }
-void SetUniform(const Shader& shader, const char* name, const vec4& value)
+void SetUniform(const Shader& shader, UniformId uniform, const vec4& value)
 {
     ASSERT_BOUND_SHADER(shader);
 
-    GLuint location = GetUniformLocation(shader, name);
+    GLint location = GetUniformLocation(shader, uniform);
     glUniform4f(location, value.x, value.y, value.z, value.w);
 }
-void SetUniform(const Shader& shader, const char* name, const mat4& value)
+void SetUniform(const Shader& shader, UniformId uniform, const mat4& value)
 {
     ASSERT_BOUND_SHADER(shader);
 
-    GLuint location = GetUniformLocation(shader, name);
+    GLint location = GetUniformLocation(shader, uniform);
     glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
 }
-void SetUniformArray(const Shader& shader, const char* name, const mat4* value, int count)
+void SetUniformArray(const Shader& shader, UniformId uniform, const mat4* value, int count)
 {
     ASSERT_BOUND_SHADER(shader);
 
-    GLuint location = GetUniformLocation(shader, name);
+    GLint location = GetUniformLocation(shader, uniform);
     glUniformMatrix4fv(location, count, GL_FALSE, (const GLfloat *) value);
 }
-void SetTexture2D(const Shader& shader, const char* name, GLint index, const Texture& texture)
+void SetTexture2D(const Shader& shader, UniformId uniform, GLint index, const Texture& texture)
 {
     ASSERT_BOUND_SHADER(shader);
     ASSERT(texture.dimension == 2, "Texture '%s' has wrong dimension (%d).", texture.name.c_str(), texture.dimension);
@@ -84,12 +84,21 @@ void SetTexture2D(const Shader& shader, const char* name, GLint index, const Tex
     // NOTE(ted): We MUST bind a texture for all samplers before drawing.
 //    ASSERT(shader.samplers.size() > index, "Index %i specify a greater number than the amount of samplers (%i) for program '%s'.", index, shader.samplers.size(), shader.name);
 
-    GLuint location = GetUniformLocation(shader, name);
+    GLint location = GetUniformLocation(shader, uniform);
     glActiveTexture(GL_TEXTURE0 + index);
     glBindTexture(GL_TEXTURE_2D, texture.id);
     glUniform1i(location, index);
 }
-//void SetTexture3D(const Shader& shader, const char* name, GLint index, const Texture& texture)
+void SetTextureArray(const Shader& shader, UniformId uniform, GLint index, GLuint array)
+{
+    ASSERT_BOUND_SHADER(shader);
+
+    GLint location = GetUniformLocation(shader, uniform);
+    glActiveTexture(GL_TEXTURE0 + index);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+    glUniform1i(location, index);
+}
+//void SetTexture3D(const Shader& shader, UniformId uniform, GLint index, const Texture& texture)
 //{
 //    ASSERT_BOUND_SHADER(shader);
 //    ASSERT(texture.dimension == 3, "Texture '%s' has wrong dimension (%d).", texture.name.c_str(), texture.dimension);
@@ -97,7 +106,7 @@ void SetTexture2D(const Shader& shader, const char* name, GLint index, const Tex
 //    // NOTE(ted): We MUST bind a texture for all samplers before drawing.
 ////    ASSERT(shader.samplers.size() > index, "Index %i specify a greater number than the amount of samplers (%i) for program '%s'.", index, shader.samplers.size(), shader.name);
 //
-//    GLuint location = GetUniformLocation(shader, name);
+//    GLint location = GetUniformLocation(shader, uniform);
 //    glActiveTexture(GL_TEXTURE0 + index);
 //    glBindTexture(GL_TEXTURE_CUBE_MAP, texture.id);
 //    glUniform1i(location, index);
@@ -118,36 +127,339 @@ void BindUniformBuffer(Shader& shader, const char* name, GLuint binding)
     shader.uniform_buffers[name] = UniformBufferInfo{ .index = index, .binding = binding, .name = std::move(uniform_buffer_name) };
 }
 
-Shader CreateShader(const char* name, const char* vertex_source, const char* fragment_source, const char* geometry_source)
+void BuildUniformTable(Shader* shader)
 {
-    ASSERT(*vertex_source != 0,   "Vertex source cannot be empty");
-    ASSERT(*fragment_source != 0, "Fragment source cannot be empty");
-    if (geometry_source)
-        ASSERT(*geometry_source != 0, "Geometry source cannot be empty");
+    shader->uniform_hashes.clear();
+    shader->uniform_locations.clear();
 
-    constexpr int log_size = 512;
+    const auto add = [shader](const char* name, usize length, GLint location)
+    {
+        const u32 hash = UniformId::Hash(name, length);
+        for (const auto existing : shader->uniform_hashes)
+            ASSERT(existing != hash, "Uniform '%s' in shader '%s' has the same hash as another uniform. Rename one of them.", name, shader->name.get());
+        shader->uniform_hashes.push_back(hash);
+        shader->uniform_locations.push_back(location);
+    };
+
+    for (const auto& [name, uniform] : shader->uniforms)
+    {
+        add(name.data(), name.size(), uniform.index);
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            add(name.data(), name.size() - 3, uniform.index);
+    }
+}
 
-    GLint success;
-    char  info_log[log_size];
+static bool IsSampler(GLenum type)
+{
+    return type == GL_SAMPLER_2D || type == GL_SAMPLER_CUBE;  // NOTE(ted): We only support two types for now.
+}
+
+static std::unique_ptr<GLchar[]> CopyName(const char* name, usize length)
+{
+    auto copy = std::make_unique<GLchar[]>(length + 1);
+    std::memcpy(copy.get(), name, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+
+// ---- PROGRAM BINARY CACHE ----
+// Linked programs are kept in SHADER_CACHE_DIRECTORY (relative to the working directory) as the driver's own binary,
+// together with their attributes and uniforms, so a warm start skips compiling, linking and querying. A file per program:
+//
+//   CachedProgramHeader
+//   CachedVariable attributes[attribute_count]
+//   CachedVariable uniforms[uniform_count]
+//   char strings[strings_size]         (names, not null-terminated)
+//   u8 binary[binary_size]
+//
+// A binary is only good for the driver that made it, so the key hashes the driver's vendor, renderer and version along
+// with the sources. The driver can still reject it, in which case the program is compiled from source and cached again.
+// Bump CACHED_PROGRAM_VERSION whenever any of these change.
+static const char* const SHADER_CACHE_DIRECTORY = "shader_cache";
+constexpr u32 CACHED_PROGRAM_MAGIC   = 0x47525043;  // "CPRG"
+constexpr u32 CACHED_PROGRAM_VERSION = 1;
+
+struct CachedString
+{
+    u32 offset;
+    u32 length;
+};
+
+struct CachedProgramHeader
+{
+    u32 magic;
+    u32 version;
+    u64 key;
+    u32 binary_format;      // As glGetProgramBinary reported it.
+    u32 attribute_count;
+    u32 uniform_count;
+    u32 strings_size;
+    u64 binary_size;
+
+    u64 attributes_offset;
+    u64 uniforms_offset;
+    u64 strings_offset;
+    u64 binary_offset;
+};
+
+// An AttributeInfo or UniformInfo.
+struct CachedVariable
+{
+    CachedString name;
+    s32 size;
+    u32 type;
+    s32 index;
+    u32 padding;
+};
+
+
+static bool ProgramBinariesSupported()
+{
+    if (!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary)
+        return false;
+
+    GLint format_count = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+    return format_count > 0;
+}
+
+// Checked before handing a binary to the driver, since an unknown format is a GL error rather than a failed link.
+static bool ProgramBinaryFormatSupported(GLenum format)
+{
+    GLint format_count = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+    std::vector<GLint> formats(usize(std::max(format_count, 0)));
+    glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+    return std::find(formats.begin(), formats.end(), GLint(format)) != formats.end();
+}
+
+// Changes with the driver, so a cache made by another one (or another version of it) is never loaded.
+static u64 DriverCacheKey()
+{
+    const char* parts[] = { (const char*) glGetString(GL_VENDOR), (const char*) glGetString(GL_RENDERER), (const char*) glGetString(GL_VERSION) };
+
+    u64 key = FNV_OFFSET_BASIS;
+    for (const auto part : parts)
+        key = part ? HashBytes(part, std::strlen(part) + 1, key) : HashBytes("", 1, key);
+    return key;
+}
+
+static u64 ProgramCacheKey(const ShaderSource& source, u64 driver_key)
+{
+    const char* parts[] = { source.vertex, source.fragment, source.geometry };
+
+    // The terminators are hashed too, so text moving from one part to the next changes the key.
+    u64 key = driver_key;
+    for (const auto part : parts)
+        key = part ? HashBytes(part, std::strlen(part) + 1, key) : HashBytes("", 1, key);
+    return key;
+}
+
+static std::string ProgramCachePath(const char* name)
+{
+    return std::string(SHADER_CACHE_DIRECTORY) + "/" + name + ".program";
+}
+
+// Returns nothing if the file is missing, damaged, from another version, made for other sources or another driver, or
+// if the driver rejects the binary.
+static std::optional<Shader> LoadCachedProgram(const char* name, const std::string& cache_file, u64 key)
+{
+    auto file = MappedFile::open(cache_file);
+    if (!file || file.size < sizeof(CachedProgramHeader))
+        return {};
+
+    CachedProgramHeader header;
+    std::memcpy(&header, file.data, sizeof(header));
+
+    if (header.magic != CACHED_PROGRAM_MAGIC || header.version != CACHED_PROGRAM_VERSION || header.key != key)
+        return {};
+
+    // Everything is checked before the driver sees any of it, so a damaged file is compiled again like a rejected one.
+    const bool sections_fit =
+        FitsIn(header.attributes_offset, header.attribute_count, sizeof(CachedVariable), file.size) && header.attributes_offset % alignof(CachedVariable) == 0 &&
+        FitsIn(header.uniforms_offset,   header.uniform_count,   sizeof(CachedVariable), file.size) && header.uniforms_offset   % alignof(CachedVariable) == 0 &&
+        FitsIn(header.strings_offset,    header.strings_size,    1,                      file.size) &&
+        FitsIn(header.binary_offset,     header.binary_size,     1,                      file.size) && header.binary_size <= u64(INT32_MAX);
+    if (!sections_fit)
+    {
+        WARNING("Cached program '%s' is truncated or corrupted.", cache_file.data());
+        return {};
+    }
+
+    const auto* cached_attributes = (const CachedVariable*) (file.data + header.attributes_offset);
+    const auto* cached_uniforms   = (const CachedVariable*) (file.data + header.uniforms_offset);
+    const auto* strings           = (const char*) (file.data + header.strings_offset);
+
+    auto names_fit = [&header](const CachedVariable* variables, u32 count) {
+        for (u32 i = 0; i < count; ++i)
+            if (!FitsIn(variables[i].name.offset, variables[i].name.length, 1, header.strings_size))
+                return false;
+        return true;
+    };
+    if (!names_fit(cached_attributes, header.attribute_count) || !names_fit(cached_uniforms, header.uniform_count))
+    {
+        WARNING("Cached program '%s' is corrupted.", cache_file.data());
+        return {};
+    }
+
+    if (!ProgramBinaryFormatSupported(header.binary_format))
+        return {};
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.binary_format, file.data + header.binary_offset, GLsizei(header.binary_size));
+
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        INFO("The driver rejected the cached binary of program '%s'. Compiling it from source.", name);
+        glDeleteProgram(program);
+        return {};
+    }
+
+    std::unordered_map<std::string, AttributeInfo> attributes;
+    attributes.reserve(header.attribute_count);
+    for (u32 i = 0; i < header.attribute_count; ++i)
+    {
+        const auto& attribute = cached_attributes[i];
+        std::string attribute_name(strings + attribute.name.offset, attribute.name.length);
+        attributes[attribute_name] = AttributeInfo{ attribute.size, attribute.type, attribute.index, CopyName(attribute_name.data(), attribute_name.size()) };
+    }
+
+    std::unordered_map<std::string, UniformInfo>  uniforms;
+    std::unordered_map<std::string, UniformInfo*> samplers;
+    uniforms.reserve(header.uniform_count);
+    for (u32 i = 0; i < header.uniform_count; ++i)
+    {
+        const auto& uniform = cached_uniforms[i];
+        std::string uniform_name(strings + uniform.name.offset, uniform.name.length);
+        uniforms[uniform_name] = UniformInfo{ uniform.size, uniform.type, uniform.index, CopyName(uniform_name.data(), uniform_name.size()) };
+        if (IsSampler(uniform.type))
+            samplers[uniform_name] = &uniforms[uniform_name];
+    }
+
+    Shader shader(program, CopyName(name, strnlen(name, 255)), std::move(attributes), std::move(uniforms), std::move(samplers));
+    BuildUniformTable(&shader);
+    return std::optional<Shader>(std::move(shader));
+}
+
+// The program has to have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+static bool CacheProgram(const Shader& shader, const std::string& cache_file, u64 key)
+{
+    GLint binary_size = 0;
+    glGetProgramiv(shader.id, GL_PROGRAM_BINARY_LENGTH, &binary_size);
+    if (binary_size <= 0)
+        return false;
+
+    std::vector<u8> binary(static_cast<usize>(binary_size));
+    GLsizei length = 0;
+    GLenum  format = 0;
+    glGetProgramBinary(shader.id, binary_size, &length, &format, binary.data());
+    if (length <= 0)
+        return false;
+
+    std::string strings;
+    auto add_string = [&strings](const std::string& string) {
+        CachedString result { u32(strings.size()), u32(string.size()) };
+        strings += string;
+        return result;
+    };
+
+    std::vector<CachedVariable> attributes;
+    attributes.reserve(shader.attributes.size());
+    for (const auto& [attribute_name, attribute] : shader.attributes)
+        attributes.push_back({ add_string(attribute_name), attribute.size, attribute.type, attribute.index, 0 });
+
+    std::vector<CachedVariable> uniforms;
+    uniforms.reserve(shader.uniforms.size());
+    for (const auto& [uniform_name, uniform] : shader.uniforms)
+        uniforms.push_back({ add_string(uniform_name), uniform.size, uniform.type, uniform.index, 0 });
+
+    CachedProgramHeader header {};
+    header.magic           = CACHED_PROGRAM_MAGIC;
+    header.version         = CACHED_PROGRAM_VERSION;
+    header.key             = key;
+    header.binary_format   = format;
+    header.attribute_count = u32(attributes.size());
+    header.uniform_count   = u32(uniforms.size());
+    header.strings_size    = u32(strings.size());
+    header.binary_size     = u64(length);
+
+    header.attributes_offset = sizeof(CachedProgramHeader);
+    header.uniforms_offset   = header.attributes_offset + attributes.size() * sizeof(CachedVariable);
+    header.strings_offset    = header.uniforms_offset   + uniforms.size()   * sizeof(CachedVariable);
+    header.binary_offset     = header.strings_offset    + strings.size();
+
+    std::error_code error;
+    std::filesystem::create_directories(SHADER_CACHE_DIRECTORY, error);
+
+    // Write to a temporary file first so a crash halfway never leaves a truncated cache behind.
+    const auto temporary_file = cache_file + ".tmp";
+    {
+        std::ofstream out(temporary_file, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+
+        out.write((const char*) &header, sizeof(header));
+        out.write((const char*) attributes.data(), std::streamsize(attributes.size() * sizeof(CachedVariable)));
+        out.write((const char*) uniforms.data(),   std::streamsize(uniforms.size()   * sizeof(CachedVariable)));
+        out.write(strings.data(), std::streamsize(strings.size()));
+        out.write((const char*) binary.data(), std::streamsize(length));
+
+        if (!out)
+            return false;
+    }
+
+    if (std::rename(temporary_file.data(), cache_file.data()) != 0)
+    {
+        std::remove(temporary_file.data());
+        return false;
+    }
+
+    INFO("Cached program '%s' (%d bytes).", shader.name.get(), length);
+    return true;
+}
+
+
+// A program that has been submitted to the driver, but not asked about yet.
+struct PendingProgram
+{
+    usize       index;        // Of its source, and of its shader in what CreateShaders returns.
+    u64         cache_key;
+    std::string cache_file;
+    GLuint      program;
+    GLuint      vertex;
+    GLuint      fragment;
+    GLuint      geometry;     // 0 if it has none.
+};
+
+// Compiles the shaders and links the program without asking how it went, since asking makes the driver finish first.
+static PendingProgram SubmitProgram(const ShaderSource& source, bool cacheable)
+{
+    ASSERT(*source.vertex != 0,   "Vertex source cannot be empty");
+    ASSERT(*source.fragment != 0, "Fragment source cannot be empty");
+    if (source.geometry)
+        ASSERT(*source.geometry != 0, "Geometry source cannot be empty");
 
     // Allocate, assign and compile the vertex shader.
     GLuint vertex;
     vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vertex_source, nullptr);
+    glShaderSource(vertex, 1, &source.vertex, nullptr);
     glCompileShader(vertex);
 
     // Allocate, assign and compile the fragment shader.
     GLuint fragment;
     fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fragment_source, nullptr);
+    glShaderSource(fragment, 1, &source.fragment, nullptr);
     glCompileShader(fragment);
 
     GLuint geometry = 0;
-    if (geometry_source)
+    if (source.geometry)
     {
         // Allocate, assign and compile the geometry shader.
         geometry = glCreateShader(GL_GEOMETRY_SHADER);
-        glShaderSource(geometry, 1, &geometry_source, nullptr);
+        glShaderSource(geometry, 1, &source.geometry, nullptr);
         glCompileShader(geometry);
     }
 
@@ -158,8 +470,27 @@ Shader CreateShader(const char* name, const char* vertex_source, const char* fra
     glAttachShader(program, fragment);
     if (geometry)
         glAttachShader(program, geometry);
+    if (cacheable)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(program);
 
+    return PendingProgram{ 0, 0, {}, program, vertex, fragment, geometry };
+}
+
+// Checks how compiling and linking went and queries the program's attributes and uniforms. Blocks until the driver is
+// done with it.
+static Shader FinishProgram(const ShaderSource& source, const PendingProgram& pending, bool cacheable)
+{
+    const char*  name     = source.name;
+    const GLuint program  = pending.program;
+    const GLuint vertex   = pending.vertex;
+    const GLuint fragment = pending.fragment;
+    const GLuint geometry = pending.geometry;
+
+    constexpr int log_size = 512;
+
+    GLint success;
+    char  info_log[log_size];
 
     // ---- DEBUG ----
     // Check shaders compile status and programs link status (and validate status?).
@@ -182,15 +513,16 @@ Shader CreateShader(const char* name, const char* vertex_source, const char* fra
     }
     if (geometry)
     {
-        glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
+        glGetShaderiv(geometry, GL_COMPILE_STATUS, &success);
         if (!success)
         {
-            glGetShaderInfoLog(fragment, log_size, nullptr, info_log);
-            WARNING("Fragment shader compilation failed for program '%s'.\n%s", name, info_log);
+            glGetShaderInfoLog(geometry, log_size, nullptr, info_log);
+            WARNING("Geometry shader compilation failed for program '%s'.\n%s", name, info_log);
         }
     }
     glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success)
+    const bool linked = success;
+    if (!linked)
     {
         glGetProgramInfoLog(program, log_size, nullptr, info_log);
         WARNING("Shader program linking failed for program '%s'.\n%s", name, info_log);
@@ -222,10 +554,10 @@ Shader CreateShader(const char* name, const char* vertex_source, const char* fra
             attribute_name.get()[length] = '\0';
 
             attributes[buffer] = AttributeInfo{
-                .name  = std::move(attribute_name),
                 .size  = size,
                 .type  = type,
                 .index = index,
+                .name  = std::move(attribute_name),
             };
         }
 
@@ -258,13 +590,13 @@ Shader CreateShader(const char* name, const char* vertex_source, const char* fra
             uniform_name.get()[length] = '\0';
 
             uniforms[buffer] = UniformInfo{
-                    .name  = std::move(uniform_name),
                     .size  = size,
                     .type  = type,
                     .index = index,
+                    .name  = std::move(uniform_name),
             };
 
-            if (type == GL_SAMPLER_2D || type == GL_SAMPLER_CUBE)  // NOTE(ted): We only support two types for now.
+            if (IsSampler(type))
                 samplers[buffer] = &uniforms[buffer];
         }
 
@@ -275,16 +607,167 @@ Shader CreateShader(const char* name, const char* vertex_source, const char* fra
     // of the shaders to create a new program).
     glDeleteShader(vertex);
     glDeleteShader(fragment);
+    if (geometry)
+        glDeleteShader(geometry);
 
     auto name_length  = strnlen(name, 255);
     auto program_name = std::make_unique<GLchar[]>(name_length+1);
     strncpy(program_name.get(), name, name_length+1);
 
     Shader shader(program, std::move(program_name), std::move(attributes), std::move(uniforms), std::move(samplers));
+    BuildUniformTable(&shader);
+    if (cacheable && linked)
+        CacheProgram(shader, pending.cache_file, pending.cache_key);
     return shader;
 }
 
 
+std::vector<Shader> CreateShaders(const std::vector<ShaderSource>& sources)
+{
+    const bool cacheable  = ProgramBinariesSupported();
+    const u64  driver_key = cacheable ? DriverCacheKey() : 0;
+    const bool parallel   = GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile;
+
+    // Let the driver use as many compiler threads as it likes.
+    if (GLAD_GL_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    else if (GLAD_GL_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+    std::vector<std::optional<Shader>> shaders(sources.size());
+    std::vector<PendingProgram>        pending;
+    pending.reserve(sources.size());
+    for (usize i = 0; i < sources.size(); ++i)
+    {
+        const auto& source     = sources[i];
+        const u64   cache_key  = cacheable ? ProgramCacheKey(source, driver_key) : 0;
+        auto        cache_file = ProgramCachePath(source.name);
+        if (cacheable)
+        {
+            shaders[i] = LoadCachedProgram(source.name, cache_file, cache_key);
+            if (shaders[i])
+                continue;
+        }
+
+        auto program = SubmitProgram(source, cacheable);
+        program.index      = i;
+        program.cache_key  = cache_key;
+        program.cache_file = std::move(cache_file);
+        pending.push_back(std::move(program));
+    }
+
+    // NOTE(ted): Without the extension, the first status query waits for that program while the driver may still work
+    //  on the rest in the background. With it, only programs that say they're done are asked about, so one slow
+    //  program doesn't hold up reflecting (and caching) the others.
+    while (!pending.empty())
+    {
+        bool finished_any = false;
+        for (usize i = 0; i < pending.size(); )
+        {
+            if (parallel)
+            {
+                GLint completed = GL_FALSE;
+                glGetProgramiv(pending[i].program, GL_COMPLETION_STATUS_KHR, &completed);
+                if (!completed)
+                {
+                    ++i;
+                    continue;
+                }
+            }
+
+            shaders[pending[i].index] = FinishProgram(sources[pending[i].index], pending[i], cacheable);
+            std::swap(pending[i], pending.back());
+            pending.pop_back();
+            finished_any = true;
+        }
+
+        if (!finished_any)
+            std::this_thread::yield();
+    }
+
+    std::vector<Shader> result;
+    result.reserve(shaders.size());
+    for (auto& shader : shaders)
+        result.push_back(std::move(*shader));
+    return result;
+}
+
+Shader CreateShader(const char* name, const char* vertex_source, const char* fragment_source, const char* geometry_source)
+{
+    auto shaders = CreateShaders({ ShaderSource{ name, vertex_source, fragment_source, geometry_source } });
+    return std::move(shaders.front());
+}
+
+void DeleteShader(Shader* shader)
+{
+    glDeleteProgram(shader->id);
+    *shader = Shader();
+}
+
+
+ShaderMap LoadShaders(const std::vector<InParam>& program_parameters)
+{
+    // The files are all read first, so the programs can be created as one batch.
+    std::vector<std::unique_ptr<char>> files;
+    std::vector<ShaderSource>          sources;
+    for (const auto& parameters : program_parameters)
+    {
+        auto vertex   = LoadFileToString(parameters.vertex);
+        auto fragment = LoadFileToString(parameters.fragment);
+        auto geometry = parameters.geometry ? LoadFileToString(parameters.geometry) : nullptr;
+        if (!vertex || !fragment || (parameters.geometry && !geometry))
+        {
+            WARNING("Skipping program '%s', since its sources couldn't be read.", parameters.name);
+            continue;
+        }
+
+        sources.push_back({ parameters.name, vertex.get(), fragment.get(), geometry.get() });
+        files.push_back(std::move(vertex));
+        files.push_back(std::move(fragment));
+        files.push_back(std::move(geometry));
+    }
+
+    auto shaders = CreateShaders(sources);
+
+    ShaderMap result;
+    for (usize i = 0; i < shaders.size(); ++i)
+        result.emplace(sources[i].name, std::move(shaders[i]));
+    return result;
+}
+
+ShaderMap LoadPostProcessingShaders(const char* base, const std::vector<InParamPost>& program_parameters)
+{
+    auto vertex = LoadFileToString(base);
+    if (!vertex)
+    {
+        WARNING("Skipping all post processing programs, since '%s' couldn't be read.", base);
+        return {};
+    }
+
+    std::vector<std::unique_ptr<char>> files;
+    std::vector<ShaderSource>          sources;
+    for (const auto& parameters : program_parameters)
+    {
+        auto fragment = LoadFileToString(parameters.fragment);
+        if (!fragment)
+        {
+            WARNING("Skipping program '%s', since its sources couldn't be read.", parameters.name);
+            continue;
+        }
+
+        sources.push_back({ parameters.name, vertex.get(), fragment.get() });
+        files.push_back(std::move(fragment));
+    }
+
+    auto shaders = CreateShaders(sources);
+
+    ShaderMap result;
+    for (usize i = 0; i < shaders.size(); ++i)
+        result.emplace(sources[i].name, std::move(shaders[i]));
+    return result;
+}
+
+
 
 const char* TypeToString(GLenum type)
 {
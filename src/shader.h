@@ -9,6 +9,7 @@
 
 #include "debug.h"
 #include "texture.h"
+#include "uniform.h"
 
 
 using glm::vec2;
@@ -52,6 +53,10 @@ struct Shader
     std::unordered_map<std::string, UniformInfo*>  samplers;
     std::unordered_map<std::string, UniformBufferInfo>  uniform_buffers;
 
+    // What SetUniform and friends look in: uniform_locations[i] is where the uniform hashing to uniform_hashes[i] is.
+    std::vector<u32>   uniform_hashes;
+    std::vector<GLint> uniform_locations;
+
     Shader() : id(0), name(nullptr), attributes(), uniforms(), samplers() {}
 
     Shader(
@@ -72,10 +77,13 @@ struct Shader
     Shader(Shader&& other) noexcept
     {
         this->id         = other.id;
-        this->name       = std::move(name);
-        this->attributes = std::move(attributes);
-        this->uniforms   = std::move(uniforms);
-        this->samplers   = std::move(samplers);
+        this->name       = std::move(other.name);
+        this->attributes = std::move(other.attributes);
+        this->uniforms   = std::move(other.uniforms);
+        this->samplers   = std::move(other.samplers);
+        this->uniform_buffers   = std::move(other.uniform_buffers);
+        this->uniform_hashes    = std::move(other.uniform_hashes);
+        this->uniform_locations = std::move(other.uniform_locations);
     }
 
     Shader& operator= (Shader&& other) noexcept
@@ -85,6 +93,9 @@ struct Shader
         this->attributes = std::move(other.attributes);
         this->uniforms   = std::move(other.uniforms);
         this->samplers   = std::move(other.samplers);
+        this->uniform_buffers   = std::move(other.uniform_buffers);
+        this->uniform_hashes    = std::move(other.uniform_hashes);
+        this->uniform_locations = std::move(other.uniform_locations);
 
         return *this;
     }
@@ -95,15 +106,33 @@ using ShaderMap = std::unordered_map<const char*, Shader>;
 
 const char* TypeToString(GLenum type);
 
-GLuint GetUniformLocation(const Shader& shader, const char* name);
-void SetUniform(const Shader& shader, const char* name, bool value);
-void SetUniform(const Shader& shader, const char* name, unsigned value);
-void SetUniform(const Shader& shader, const char* name, float value);
-void SetUniform(const Shader& shader, const char* name, const vec3& value);
-void SetUniform(const Shader& shader, const char* name, const vec4& value);
-void SetUniform(const Shader& shader, const char* name, const mat4& value);
-void SetUniformArray(const Shader& shader, const char* name, const mat4* value, int count);
-void SetTexture2D(const Shader& shader, const char* name, GLint index, const Texture& texture);
+// Fills in the hashes and locations GetUniformLocation looks in, from shader->uniforms. CreateShader does it. Arrays are
+// reported as 'name[0]'; they can be found by 'name' as well, like with glGetUniformLocation.
+void BuildUniformTable(Shader* shader);
+// Logs that the shader doesn't have the uniform, and returns -1.
+GLint MissingUniform(const Shader& shader, UniformId uniform);
+
+// -1 if the shader doesn't have it, which glUniform* ignores.
+inline GLint GetUniformLocation(const Shader& shader, UniformId uniform)
+{
+    // NOTE(ted): Shaders have a handful of uniforms, so a linear scan over the hashes beats anything fancier. It's in
+    //  the header so the scan is inlined into the draw loops.
+    const u32*  hashes = shader.uniform_hashes.data();
+    const usize count  = shader.uniform_hashes.size();
+    for (usize i = 0; i < count; ++i)
+        if (hashes[i] == uniform.hash)
+            return shader.uniform_locations[i];
+    return MissingUniform(shader, uniform);
+}
+void SetUniform(const Shader& shader, UniformId uniform, bool value);
+void SetUniform(const Shader& shader, UniformId uniform, unsigned value);
+void SetUniform(const Shader& shader, UniformId uniform, float value);
+void SetUniform(const Shader& shader, UniformId uniform, const vec3& value);
+void SetUniform(const Shader& shader, UniformId uniform, const vec4& value);
+void SetUniform(const Shader& shader, UniformId uniform, const mat4& value);
+void SetUniformArray(const Shader& shader, UniformId uniform, const mat4* value, int count);
+void SetTexture2D(const Shader& shader, UniformId uniform, GLint index, const Texture& texture);
+void SetTextureArray(const Shader& shader, UniformId uniform, GLint index, GLuint array);
 //void SetTexture3D(const Shader& shader, const char* name, GLint index, const Texture& texture);
 void BindUniformBuffer(Shader& shader, const char* name, GLuint binding);
 
@@ -138,10 +167,19 @@ void SetUniformBuffer(UBO<T> ubo, const T& data, GLuint from_byte = 0, GLuint si
 
 
 
+struct ShaderSource { const char *name, *vertex, *fragment, *geometry = nullptr; };
+
+// Compiles and links every program before asking the driver about any of them, so it can work on them at the same time.
+// With GL_KHR_parallel_shader_compile the programs are polled, and each one is checked and queried once it's done. The
+// shaders are returned in the order of 'sources'.
+std::vector<Shader> CreateShaders(const std::vector<ShaderSource>& sources);
 Shader CreateShader(const char* name, const char* vertex_source, const char* fragment_source, const char* geometry_source = nullptr);
 void DeleteShader(Shader* shader);
 
+// Both read the files named by the parameters and create the programs as one batch with CreateShaders. A program whose
+// files can't be read is left out. The map is keyed by the 'name' pointers given.
 struct InParam { const char *name, *vertex, *fragment, *geometry = nullptr; };
 ShaderMap LoadShaders(const std::vector<InParam>& program_parameters);
+// Every program gets the vertex shader at 'base', and its own fragment shader.
 struct InParamPost { const char *name, *fragment; };
 ShaderMap LoadPostProcessingShaders(const char* base, const std::vector<InParamPost>& program_parameters);
@@ -5,11 +5,73 @@
 #include <stb_image.h>
 #include <stb_image_resize.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+
 #include <debug.h>
+#include "utils.h"
 
 
 static const unsigned char EMPTY_DATA[3] = {0, 0, 0};
 
+// Layers in the first array of each kind of texture. Later ones double.
+static constexpr GLint TEXTURE_ARRAY_FIRST_LAYERS = 4;
+
+
+// Keyed by canonical path. Entries don't keep their pixels alive; they're only reused while someone else still holds
+// on to them.
+struct CachedImage
+{
+    std::weak_ptr<const unsigned char> pixels;
+    int width;
+    int height;
+    int channels;
+};
+
+static std::mutex                                                    cache_mutex;
+static std::unordered_map<std::string, CachedImage>                  image_cache;
+static std::unordered_map<std::string, std::weak_ptr<const Texture>> texture_cache;
+static ResidencyStats                                                residency;
+
+// Pixels are freed from whichever thread drops the last copy, so this one is kept apart from the rest.
+static std::atomic<usize> image_bytes_live = 0;
+
+// Texture memory per TextureOptions::Type. Textures go away along with handles, which can be dropped anywhere.
+static std::atomic<usize> texture_bytes[usize(TextureOptions::Type::COUNT)];
+
+static void CountTextureBytes(TextureOptions::Type type, usize bytes)   { texture_bytes[usize(type)] += bytes; }
+static void UncountTextureBytes(TextureOptions::Type type, usize bytes) { texture_bytes[usize(type)] -= bytes; }
+
+
+// Entries whose contents are gone are dropped on a miss, once the cache has doubled since the last sweep. Paths that
+// aren't asked for again then don't pile up, and the sweeps cost O(1) per lookup on average.
+template <typename Cache, typename Expired>
+static void SweepExpired(Cache& cache, usize& sweep_at, Expired expired)
+{
+    if (cache.size() < sweep_at)
+        return;
+
+    for (auto it = cache.begin(); it != cache.end(); )
+        it = expired(it->second) ? cache.erase(it) : std::next(it);
+    sweep_at = std::max(usize(64), 2 * cache.size());
+}
+
+static usize image_cache_sweep_at   = 64;
+static usize texture_cache_sweep_at = 64;
+
+
+static std::string CanonicalPath(const std::string& path)
+{
+    std::error_code error;
+    auto canonical = std::filesystem::weakly_canonical(path, error);
+    return error ? path : canonical.string();
+}
+
 
 const Image Image::empty()
 {
@@ -27,31 +89,219 @@ const Image Image::empty()
 
 
 
-// TODO(ted): @LEAK We don't free this.
 const Image Image::from_path(const std::string& name, const std::string& directory)
 {
-    int width, height, channels;
+    const auto path = CanonicalPath(directory + name);
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = image_cache.find(path);
+        if (it != image_cache.end())
+        {
+            if (auto pixels = it->second.pixels.lock())
+            {
+                const auto& cached = it->second;
+                residency.images_shared     += 1;
+                residency.image_bytes_saved += usize(cached.width) * usize(cached.height) * usize(cached.channels);
+                return { cached.width, cached.height, cached.channels, pixels.get(), name, directory, std::move(pixels) };
+            }
+        }
+    }
+
+    int width = 0, height = 0, channels = 0;
     auto* data = stbi_load((directory + name).data(), &width, &height, &channels, 0);
     if (!data)
+    {
         WARNING("Couldn't load %s.", name.data());
+        return { 0, 0, 0, nullptr, name, directory };
+    }
 
-    return { width, height, channels, data, name, directory };
+    const usize size = usize(width) * usize(height) * usize(channels);
+    image_bytes_live += size;
+    std::shared_ptr<const unsigned char> pixels(data, [size](const unsigned char* data) {
+        stbi_image_free((void*) data);
+        image_bytes_live -= size;
+    });
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    SweepExpired(image_cache, image_cache_sweep_at, [](const CachedImage& cached) { return cached.pixels.expired(); });
+    auto& cached = image_cache[path];
+    if (auto existing = cached.pixels.lock())
+    {
+        // Someone else decoded it while we did. Keep theirs.
+        residency.images_shared     += 1;
+        residency.image_bytes_saved += size;
+        pixels = std::move(existing);
+    }
+    else
+    {
+        residency.images_decoded += 1;
+        cached = { pixels, width, height, channels };
+    }
+
+    return { cached.width, cached.height, cached.channels, pixels.get(), name, directory, std::move(pixels) };
 }
 
 
-Texture CreateTexture2D(const Image& image, TextureOptions options)
+void Image::release() noexcept
 {
-    GLenum format = 0;
-    if (image.channels == 4)
-        format = GL_RGBA;
-    else if (image.channels == 3)
-        format = GL_RGB;
-    else
+    this->data = nullptr;
+    this->pixels.reset();
+}
+
+
+Image GenerateMipmaps(const Image& image, bool srgb)
+{
+    if (!image.data || image.compression || !image.levels.empty() || image.width <= 0 || image.height <= 0 || image.channels < 1 || image.channels > 4)
+        return image;
+
+    std::vector<ImageLevel> levels;
+    {
+        int width  = image.width;
+        int height = image.height;
+
+        usize offset = 0;
+        while (true)
+        {
+            const usize size = usize(width) * usize(height) * usize(image.channels);
+            levels.push_back({ width, height, offset, size });
+            offset += size;
+
+            if (width == 1 && height == 1)
+                break;
+            width  = std::max(width  / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+    }
+
+    const usize total = levels.back().offset + levels.back().size;
+    std::shared_ptr<unsigned char> pixels(new unsigned char[total], std::default_delete<unsigned char[]>());
+    std::memcpy(pixels.get(), image.data, levels[0].size);
+
+    // Only colors have an alpha to weight by and convert around; the channels of data maps are filtered on their own.
+    int alpha = STBIR_ALPHA_CHANNEL_NONE;
+    if (srgb && image.channels == 4)
+        alpha = 3;
+    else if (srgb && image.channels == 2)
+        alpha = 1;
+    const auto colorspace = srgb ? STBIR_COLORSPACE_SRGB : STBIR_COLORSPACE_LINEAR;
+
+    // Each level is made from the previous one, which is what a 2x2 box filter over the base level would give anyway.
+    for (usize i = 1; i < levels.size(); ++i)
+    {
+        const auto& source = levels[i - 1];
+        const auto& level  = levels[i];
+        stbir_resize_uint8_generic(pixels.get() + source.offset, source.width, source.height, 0,
+                                   pixels.get() + level.offset,  level.width,  level.height,  0,
+                                   image.channels, alpha, 0, STBIR_EDGE_CLAMP, STBIR_FILTER_BOX, colorspace, nullptr);
+    }
+
+    Image result = image;
+    result.data   = pixels.get();
+    result.pixels = std::move(pixels);
+    result.levels = std::move(levels);
+    return result;
+}
+
+
+// Whether all pixels have red, green and blue equal.
+static bool IsGray(const Image& image)
+{
+    if (!image.data || image.compression || image.channels < 3)
+        return false;
+
+    const usize count = usize(image.width) * usize(image.height);
+    for (usize i = 0; i < count; ++i)
+    {
+        const auto* pixel = image.data + i * usize(image.channels);
+        if (pixel[0] != pixel[1] || pixel[0] != pixel[2])
+            return false;
+    }
+    return true;
+}
+
+TextureFormat ChooseTextureFormat(const Image& image, TextureOptions options)
+{
+    using Type = TextureOptions::Type;
+    const bool color = options.type == Type::DIFFUSE || options.type == Type::AMBIENT;
+
+    TextureFormat result;
+
+    // Gray lands in red, green and blue, and 'alpha' in alpha.
+    auto gray = [&result](GLint alpha) {
+        result.swizzle[1] = GL_RED;
+        result.swizzle[2] = GL_RED;
+        result.swizzle[3] = alpha;
+    };
+
+    if (image.compression)
+    {
+        // NOTE(ted): The sRGB formats decode the same blocks, so nothing has to be compressed again.
+        result.compressed = true;
+        result.internal   = image.compression;
+        if (color && image.compression == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+            result.internal = GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+        else if (color && image.compression == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+            result.internal = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+        result.format = result.internal;
+
+        if (color && image.compression == GL_COMPRESSED_RED_RGTC1)
+            gray(GL_ONE);
+        else if (color && image.compression == GL_COMPRESSED_RG_RGTC2)
+            gray(GL_GREEN);
+        return result;
+    }
+
+    if (image.channels < 1 || image.channels > 4)
+    {
         ERROR("Unsupported number of channels %i in image %s.", image.channels, image.name.data());
+        return result;
+    }
+
+    int channels = image.channels;
+    if ((options.type == Type::SPECULAR || options.type == Type::OPACITY) && (channels == 2 || IsGray(image)))
+        channels = 1;
+    else if (options.type == Type::NORMAL && channels >= 3)
+        channels = 2;
+
+    static const GLenum FORMATS[]  = { 0, GL_RED, GL_RG,  GL_RGB,  GL_RGBA  };
+    static const GLenum INTERNAL[] = { 0, GL_R8,  GL_RG8, GL_RGB8, GL_RGBA8 };
+    result.channels = channels;
+    result.format   = FORMATS[channels];
+    result.internal = INTERNAL[channels];
+
+    if (color && channels == 1)
+        gray(GL_ONE);
+    else if (color && channels == 2)
+        gray(GL_GREEN);
+    else if (color && channels == 3)
+        result.internal = GL_SRGB8;
+    else if (color && channels == 4)
+        result.internal = GL_SRGB8_ALPHA8;
+
+    if (options.internal)
+        result.internal = options.internal;
+    return result;
+}
+
+// The first 'to' of every 'from' channels of 'count' pixels. Returns 'pixels' as they are if nothing is dropped.
+static const unsigned char* PackChannels(const unsigned char* pixels, usize count, int from, int to, std::vector<unsigned char>& scratch)
+{
+    if (from == to)
+        return pixels;
+
+    scratch.resize(count * usize(to));
+    for (usize i = 0; i < count; ++i)
+        for (int c = 0; c < to; ++c)
+            scratch[i * usize(to) + usize(c)] = pixels[i * usize(from) + usize(c)];
+    return scratch.data();
+}
 
 
-    GLuint texture;
-    glGenTextures(1, &texture);
+Texture CreateTexture2D(const Image& image, TextureOptions options)
+{
+    const auto format = ChooseTextureFormat(image, options);
+
+    const GLuint texture = CreateGpuObject(GpuObject::TEXTURE);
     glBindTexture(GL_TEXTURE_2D, texture);
 
     // Strategies for sampling the texture when it's magnified and minimized.
@@ -89,8 +339,424 @@ Texture CreateTexture2D(const Image& image, TextureOptions options)
 //    vec4 border_color(1.0f, 1.0f, 0.0f, 1.0f);
 //    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, &border_color[0]);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, options.internal, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
-    glGenerateMipmap(GL_TEXTURE_2D);  // NOTE(ted): This has to be called after glTexImage2D!
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, format.swizzle);
+
+    usize bytes = 0;
+    std::vector<unsigned char> scratch;
+    if (format.compressed)
+    {
+        // Compressed images come with all their levels, as the driver can't generate mipmaps for them.
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(image.levels.size()) - 1);
+        for (usize i = 0; i < image.levels.size(); ++i)
+        {
+            const auto& level = image.levels[i];
+            glCompressedTexImage2D(GL_TEXTURE_2D, GLint(i), format.internal, level.width, level.height, 0, GLsizei(level.size), image.data + level.offset);
+            bytes += level.size;
+        }
+    }
+    else if (!image.levels.empty())
+    {
+        // A mip chain built offline (see GenerateMipmaps) is copied as it is. Levels are tightly packed, so rows of
+        // the small ones aren't 4 byte aligned.
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(image.levels.size()) - 1);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (usize i = 0; i < image.levels.size(); ++i)
+        {
+            const auto& level  = image.levels[i];
+            const usize count  = usize(level.width) * usize(level.height);
+            const auto* pixels = PackChannels(image.data + level.offset, count, image.channels, format.channels, scratch);
+            glTexImage2D(GL_TEXTURE_2D, GLint(i), GLint(format.internal), level.width, level.height, 0, format.format, GL_UNSIGNED_BYTE, pixels);
+            bytes += count * usize(format.channels);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    else
+    {
+        const usize count  = usize(image.width) * usize(image.height);
+        const auto* pixels = PackChannels(image.data, count, image.channels, format.channels, scratch);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GLint(format.internal), image.width, image.height, 0, format.format, GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_2D);  // NOTE(ted): This has to be called after glTexImage2D!
+    }
+
+    // Without a chain of its own, the driver made all of it.
+    int levels = int(image.levels.size());
+    if (levels == 0)
+    {
+        int width  = image.width;
+        int height = image.height;
+        while (true)
+        {
+            bytes  += usize(width) * usize(height) * usize(format.channels);
+            levels += 1;
+            if (width <= 1 && height <= 1)
+                break;
+            width  = std::max(width  / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+    }
+    CountTextureBytes(options.type, bytes);
+    ResizeGpuObject(GpuObject::TEXTURE, texture, bytes);
+
+    return { .id = texture, .width = image.width, .height = image.height, .type = options.type, .dimension = 2, .channels = image.channels, .name = image.name, .levels = levels, .bytes = bytes };
+}
+
+
+void DeleteTexture(const Texture& texture)
+{
+    ReleaseGpuObject(GpuObject::TEXTURE, texture.id);
+    UncountTextureBytes(texture.type, texture.bytes);
+}
+
+
+TextureHandle AcquireTexture2D(const Image& image, TextureOptions options)
+{
+    auto make_handle = [](const Texture& texture) {
+        return TextureHandle(new Texture(texture), [](const Texture* texture) {
+            DeleteTexture(*texture);
+            delete texture;
+        });
+    };
+
+    // Only images that came from a file can be told apart.
+    if (!image.pixels)
+        return make_handle(CreateTexture2D(image, options));
+
+    static_assert(sizeof(TextureOptions) == 8 * 4, "TextureOptions is hashed as bytes, so it must not have padding.");
+    const auto key = CanonicalPath(image.directory + image.name) + '#' + std::to_string(HashBytes((const char*) &options, sizeof(options)));
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = texture_cache.find(key);
+    if (it != texture_cache.end())
+    {
+        if (auto texture = it->second.lock())
+        {
+            residency.textures_shared     += 1;
+            residency.texture_bytes_saved += image.size();
+            return texture;
+        }
+    }
+
+    SweepExpired(texture_cache, texture_cache_sweep_at, [](const std::weak_ptr<const Texture>& texture) { return texture.expired(); });
+
+    auto texture = make_handle(CreateTexture2D(image, options));
+    residency.textures_created += 1;
+    texture_cache[key] = texture;
+    return texture;
+}
+
+
+TextureArrays::~TextureArrays()
+{
+    // The arrays themselves are released along with their handles.
+    for (const auto& array : this->arrays)
+    {
+        for (int level = array.base_level; level < array.levels; ++level)
+            UncountTextureBytes(array.type, array.sizes[level].size * usize(array.layers));
+    }
+}
+
+void TextureArrays::allocate_level(Array& array, int level)
+{
+    const auto& size = array.sizes[level];
+    if (array.format.compressed)
+        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, array.format.internal, size.width, size.height, array.layers, 0, GLsizei(size.size) * array.layers, nullptr);
+    else
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GLint(array.format.internal), size.width, size.height, array.layers, 0, array.format.format, GL_UNSIGNED_BYTE, nullptr);
+    this->resident += size.size * usize(array.layers);
+    array.bytes    += size.size * usize(array.layers);
+    array.texture.resize(array.bytes);
+    CountTextureBytes(array.type, size.size * usize(array.layers));
+}
+
+void TextureArrays::free_level(Array& array, int level)
+{
+    // NOTE(ted): Respecifying the level as empty is what lets the driver free it. Its format doesn't matter, it's
+    //            below the base level.
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, 0, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    this->resident -= array.sizes[level].size * usize(array.layers);
+    array.bytes    -= array.sizes[level].size * usize(array.layers);
+    array.texture.resize(array.bytes);
+    UncountTextureBytes(array.type, array.sizes[level].size * usize(array.layers));
+}
+
+void TextureArrays::upload_level(const Array& array, GLint layer, const Image& image, int level)
+{
+    const auto& size = array.sizes[level];
+    if (array.format.compressed)
+    {
+        glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, size.width, size.height, 1, array.format.internal, GLsizei(size.size), image.data + (image.levels.empty() ? 0 : image.levels[level].offset));
+    }
+    else
+    {
+        std::vector<unsigned char> scratch;
+        const auto* source = image.data + (image.levels.empty() ? 0 : image.levels[level].offset);
+        const auto* pixels = PackChannels(source, usize(size.width) * usize(size.height), image.channels, array.format.channels, scratch);
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, size.width, size.height, 1, array.format.format, GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+}
+
+TextureSlot TextureArrays::add(const Image& image, TextureOptions options, TextureSlot fallback)
+{
+    if (!image.data)
+        return fallback;
+
+    static_assert(sizeof(TextureOptions) == 8 * 4, "TextureOptions is hashed as bytes, so it must not have padding.");
+    const auto options_hash = std::to_string(HashBytes((const char*) &options, sizeof(options)));
+
+    // Only images that came from a file can be told apart.
+    std::string path;
+    if (image.pixels)
+    {
+        path = CanonicalPath(image.directory + image.name) + '#' + options_hash;
+        auto it = this->slots.find(path);
+        if (it != this->slots.end())
+            return it->second;
+    }
+
+    // Every layer comes with its whole mip chain, so the larger levels can be streamed and nothing has to be made by the
+    // driver. Images that didn't go through LoadCompressedImage get theirs here.
+    using Type = TextureOptions::Type;
+    const Image  chained = image.levels.empty() ? GenerateMipmaps(image, options.type == Type::DIFFUSE || options.type == Type::AMBIENT) : Image();
+    const Image& source  = image.levels.empty() ? chained : image;
+
+    // Arrays are told apart by how their layers are stored, so gray and colored maps of the same size don't share one.
+    const auto format = ChooseTextureFormat(source, options);
+
+    // Levels of plain pixels take up as many channels as are kept, which can be fewer than the image has. An image
+    // GenerateMipmaps can't handle gets a single level.
+    std::vector<ImageLevel> sizes = source.levels;
+    if (sizes.empty())
+        sizes.push_back({ source.width, source.height, 0, 0 });
+    if (!format.compressed)
+        for (auto& size : sizes)
+            size.size = usize(size.width) * usize(size.height) * usize(format.channels);
+    const int levels = int(sizes.size());
+
+    const auto key = std::to_string(image.width) + 'x' + std::to_string(image.height) + '#' + std::to_string(format.internal) + '#' + std::to_string(format.channels) + '#' + std::to_string(levels) + '#' + options_hash;
+    auto& candidates = this->arrays_of[key];
+    if (candidates.empty() || this->arrays[candidates.back()].used == this->arrays[candidates.back()].layers)
+    {
+        GLint max_layers = 256;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+
+        Array array;
+        array.layers   = candidates.empty() ? TEXTURE_ARRAY_FIRST_LAYERS : std::min(2 * this->arrays[candidates.back()].layers, max_layers);
+        array.format   = format;
+        array.type     = options.type;
+        array.levels   = levels;
+        array.sizes    = std::move(sizes);
+
+        while (array.base_level + 1 < levels && std::max(array.sizes[array.base_level].width, array.sizes[array.base_level].height) > TEXTURE_RESIDENT_SIZE)
+            array.base_level += 1;
+        array.tail   = array.base_level;
+        array.wanted = levels - 1;
+
+        array.texture = GpuTexture::create();
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture.get());
+
+        // Same sampling as CreateTexture2D.
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, array.base_level);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL,  levels - 1);
+        glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_LOD_BIAS,   options.lod_bias);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, options.min);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, options.mag);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S,     options.wrap_s);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T,     options.wrap_t);
+        glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, format.swizzle);
+
+        // Storage for every layer of the resident levels, filled in as textures come.
+        for (int level = array.base_level; level < levels; ++level)
+            this->allocate_level(array, level);
+
+        candidates.push_back(this->arrays.size());
+        this->index_of[array.texture.get()] = this->arrays.size();
+        this->arrays.push_back(std::move(array));
+    }
+
+    auto& array = this->arrays[candidates.back()];
+    const TextureSlot slot = { array.texture.get(), array.used++ };
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, slot.array);
+    for (int level = array.base_level; level < levels; ++level)
+        this->upload_level(array, slot.layer, source, level);
+
+    // Kept to stream the larger levels from. Cooked images only map their file; the pixels of the others stay in memory.
+    array.images.push_back(source);
+
+    this->textures += 1;
+    if (!path.empty())
+        this->slots[path] = slot;
+    return slot;
+}
+
+void TextureArrays::request(TextureSlot slot, f32 footprint)
+{
+    auto it = this->index_of.find(slot.array);
+    if (it == this->index_of.end())
+        return;
+
+    auto& array = this->arrays[it->second];
+
+    // The level with about as many texels across as the texture covers pixels.
+    int level = array.levels - 1;
+    if (footprint > 0.0f)
+    {
+        const f32 size = f32(std::max(array.sizes[0].width, array.sizes[0].height));
+        level = std::clamp(int(std::floor(std::log2(size / footprint))), 0, array.levels - 1);
+    }
+
+    array.wanted    = std::min(array.wanted, level);
+    array.last_used = this->frame;
+}
+
+StreamingStats TextureArrays::update(usize frame_budget)
+{
+    StreamingStats stats;
+
+    // Levels an array needs right now. Arrays that weren't requested this frame only need their tail.
+    auto needed = [this](const Array& array) {
+        return (array.last_used == this->frame) ? std::min(array.wanted, array.tail) : array.tail;
+    };
+
+    auto level_bytes = [](const Array& array, int level) {
+        return array.sizes[level].size * usize(array.layers);
+    };
+
+    // Drops the largest level of the least recently used array that has more than it needs, until 'bytes' fit.
+    // Nothing is dropped if they wouldn't fit anyway.
+    auto make_room = [&](usize bytes) {
+        if (this->resident + bytes <= this->budget)
+            return true;
+
+        usize spare = 0;
+        for (const auto& array : this->arrays)
+            for (int level = array.base_level; level < needed(array); ++level)
+                spare += level_bytes(array, level);
+        if (this->resident + bytes > this->budget + spare)
+            return false;
+
+        while (this->resident + bytes > this->budget)
+        {
+            Array* victim = nullptr;
+            for (auto& array : this->arrays)
+                if (array.base_level < needed(array) && (!victim || array.last_used < victim->last_used))
+                    victim = &array;
+            if (!victim)
+                return false;
+
+            const int level = victim->base_level++;
+            glBindTexture(GL_TEXTURE_2D_ARRAY, victim->texture.get());
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, victim->base_level);
+            this->free_level(*victim, level);
+
+            stats.bytes_evicted  += level_bytes(*victim, level);
+            stats.levels_evicted += 1;
+        }
+        return true;
+    };
+
+    // The arrays furthest from what they need go first, one level at a time.
+    std::vector<usize> starved;
+    for (usize i = 0; i < this->arrays.size(); ++i)
+        if (needed(this->arrays[i]) < this->arrays[i].base_level)
+            starved.push_back(i);
+    std::stable_sort(starved.begin(), starved.end(), [this, &needed](usize a, usize b) {
+        return this->arrays[a].base_level - needed(this->arrays[a]) > this->arrays[b].base_level - needed(this->arrays[b]);
+    });
+
+    // Arrays whose next level doesn't fit in the budget stay as they are.
+    std::vector<bool> blocked(this->arrays.size(), false);
+    while (stats.bytes_streamed < frame_budget)
+    {
+        bool progress = false;
+        for (const auto i : starved)
+        {
+            auto& array = this->arrays[i];
+            if (blocked[i] || array.base_level <= needed(array) || stats.bytes_streamed >= frame_budget)
+                continue;
+
+            const int level = array.base_level - 1;
+            if (!make_room(level_bytes(array, level)))
+            {
+                blocked[i] = true;
+                continue;
+            }
+
+            glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture.get());
+            this->allocate_level(array, level);
+            for (GLint layer = 0; layer < array.used; ++layer)
+                this->upload_level(array, layer, array.images[layer], level);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, level);
+            array.base_level = level;
+
+            stats.bytes_streamed  += array.sizes[level].size * usize(array.used);
+            stats.levels_streamed += 1;
+            progress = true;
+        }
+        if (!progress)
+            break;
+    }
+
+    for (auto& array : this->arrays)
+    {
+        for (int level = needed(array); level < array.levels; ++level)
+            stats.bytes_wanted += level_bytes(array, level);
+        array.wanted = array.levels - 1;
+    }
+    stats.bytes_resident = this->resident;
+
+    this->frame += 1;
+    return stats;
+}
+
+
+void CountSharedImage(const Image& image)
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    residency.images_shared     += 1;
+    residency.image_bytes_saved += image.size();
+}
+
+ResidencyStats GetResidencyStats()
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto stats = residency;
+    stats.image_bytes_live = image_bytes_live;
+    return stats;
+}
+
+void ReportResidency()
+{
+    constexpr double MB = 1024.0 * 1024.0;
+
+    const auto stats = GetResidencyStats();
+    INFO("Images: %zu decoded, %zu shared (%.2f MB saved), %.2f MB still in memory.", stats.images_decoded, stats.images_shared, double(stats.image_bytes_saved) / MB, double(stats.image_bytes_live) / MB);
+    INFO("Textures: %zu created, %zu shared (%.2f MB of VRAM saved).", stats.textures_created, stats.textures_shared, double(stats.texture_bytes_saved) / MB);
+}
+
+
+TextureMemory GetTextureMemory()
+{
+    TextureMemory memory;
+    for (usize i = 0; i < usize(TextureOptions::Type::COUNT); ++i)
+        memory.bytes[i] = texture_bytes[i];
+    return memory;
+}
+
+void ReportTextureMemory()
+{
+    constexpr double MB = 1024.0 * 1024.0;
+    static const char* const TYPE_NAMES[] = { "invalid", "ambient", "diffuse", "specular", "normal", "depth", "opacity" };
+    static_assert(sizeof(TYPE_NAMES) / sizeof(*TYPE_NAMES) == usize(TextureOptions::Type::COUNT), "A texture type has no name.");
 
-    return { .id = texture, .type = options.type, .height = image.height, .width = image.width, .name = image.name, .channels = image.channels, .dimension = 2 };
+    const auto memory = GetTextureMemory();
+    INFO("Texture memory: %.2f MB.", double(memory.total()) / MB);
+    for (usize i = 0; i < usize(TextureOptions::Type::COUNT); ++i)
+        if (memory.bytes[i])
+            INFO("    %-8s %8.2f MB", TYPE_NAMES[i], double(memory.bytes[i]) / MB);
 }
@@ -1,15 +1,21 @@
 #pragma once
 
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <glad/glad.h>
 
+#include "gpu.h"
+#include "types.h"
+
 
 struct TextureOptions
 {
     enum class Type
     {
-        INVALID, AMBIENT, DIFFUSE, SPECULAR, NORMAL, DEPTH
+        INVALID, AMBIENT, DIFFUSE, SPECULAR, NORMAL, DEPTH, OPACITY, COUNT
     };
 
     GLenum  wrap_t   = GL_REPEAT;
@@ -18,11 +24,21 @@ struct TextureOptions
     GLenum  min      = GL_LINEAR_MIPMAP_LINEAR;
     GLenum  mag      = GL_LINEAR;
     GLfloat lod_bias = 0.0f;
-    GLenum  internal = GL_RGBA;
+    GLenum  internal = 0;           // 0 picks one from the image and 'type' (see ChooseTextureFormat).
     Type    type     = Type::DIFFUSE;
 };
 
 
+// A mip level of an image. 'offset' is in bytes from the start of the image's data.
+struct ImageLevel
+{
+    int   width  = 0;
+    int   height = 0;
+    usize offset = 0;
+    usize size   = 0;
+};
+
+
 class Image
 {
 public:
@@ -34,11 +50,58 @@ public:
     std::string name      = "";
     std::string directory = "";
 
+    // Owns 'data' for images loaded from disk. Copies share it, and the pixels are freed along with the last one.
+    std::shared_ptr<const unsigned char> pixels = {};
+
+    // Images with a mip chain hold all their levels back to back in 'data', largest first. Block compressed images
+    // (see compress.h) always do.
+    GLenum                  compression = 0;   // GL_COMPRESSED_*, or 0 for plain 8-bit pixels.
+    std::vector<ImageLevel> levels      = {};
+
     static const Image from_raw(int width, int height, int channels, const unsigned char* data, const std::string& name, const std::string& directory);
+    // Goes through the image cache, so a file that's already in memory isn't decoded again.
     static const Image from_path(const std::string& name, const std::string& directory);
     static const Image empty();
+
+    [[nodiscard]] usize size() const noexcept
+    {
+        if (!this->levels.empty())
+            return this->levels.back().offset + this->levels.back().size;
+        if (this->compression)
+            return 0;
+        return usize(this->width) * usize(this->height) * usize(this->channels);
+    }
+
+    // Drops this copy's hold on the pixels, e.g. once they're on the GPU. Everything but 'data' stays.
+    void release() noexcept;
+};
+
+
+// How an image is stored on the GPU.
+struct TextureFormat
+{
+    GLenum internal   = GL_RGBA8;
+    GLenum format     = GL_RGBA;   // Of the uploaded pixels, or the GL_COMPRESSED_* format of block compressed ones.
+    int    channels   = 4;         // Of the uploaded pixels. Fewer than the image has means the rest are dropped.
+    bool   compressed = false;
+    GLint  swizzle[4] = { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA };
 };
 
+// The smallest format that keeps what a texture of 'options.type' needs from the image.
+//   * Diffuse and ambient maps hold colors, so they're sampled as sRGB: SRGB8, SRGB8_ALPHA8 or the sRGB versions of
+//     BC1 and BC3. Gray ones are kept as R8 or RG8 (BC4 or BC5), swizzled so the gray lands in RGB and the second
+//     channel in alpha. There's no sRGB version of those in core GL, so they're filtered as linear.
+//   * Specular and opacity maps only need one value. Gray ones are kept as R8.
+//   * Normal maps only keep X and Y, in RG8. Z follows from the normal having unit length.
+//   * Anything else keeps its channels, 8 bits each.
+// 'options.internal' overrides the internal format if set.
+TextureFormat ChooseTextureFormat(const Image& image, TextureOptions options);
+
+// Builds the whole mip chain of an 8-bit image down to 1x1, each level a box filtered half of the one before. Colors
+// ('srgb') are averaged in linear light, so dark and bright texels don't blend too dark, and weighted by their alpha.
+// The result has 'levels' set and owns its data. Images that failed to load are returned as they are.
+Image GenerateMipmaps(const Image& image, bool srgb);
+
 
 struct Texture
 {
@@ -52,7 +115,143 @@ struct Texture
 
     std::string name = "Uninitialized";
 
+    // Mip levels on the GPU are [base_level, levels), i.e. the smaller ones.
+    int    levels     = 1;
+    int    base_level = 0;
+    usize  bytes      = 0;   // Of texture memory.
+
     explicit operator bool() const noexcept { return id; }
 };
 
-Texture CreateTexture2D(const Image& image, TextureOptions options = {});
\ No newline at end of file
+// The texture is only deleted once the GPU is done with it (see gpu.h), so it can be let go of from any thread.
+Texture CreateTexture2D(const Image& image, TextureOptions options = {});
+void    DeleteTexture(const Texture& texture);
+
+
+// Textures from the same file and options share one GL texture. It's deleted when the last handle is gone.
+using TextureHandle = std::shared_ptr<const Texture>;
+
+TextureHandle AcquireTexture2D(const Image& image, TextureOptions options = {});
+
+
+// Where a texture was packed: a layer of a GL_TEXTURE_2D_ARRAY.
+struct TextureSlot
+{
+    GLuint array = 0;
+    GLint  layer = 0;
+};
+
+// Mip levels at most this many pixels across are always on the GPU. Larger ones are streamed in when needed.
+constexpr int TEXTURE_RESIDENT_SIZE = 64;
+
+// What TextureArrays::update did this frame, and where it stands.
+struct StreamingStats
+{
+    usize bytes_streamed  = 0;   // This frame.
+    usize bytes_evicted   = 0;   // This frame.
+    usize levels_streamed = 0;   // This frame.
+    usize levels_evicted  = 0;   // This frame.
+    usize bytes_resident  = 0;
+    usize bytes_wanted    = 0;   // What would be resident without a budget.
+};
+
+// Packs textures of the same size, format, mip count and options as layers of shared GL_TEXTURE_2D_ARRAYs, so
+// everything drawn with one of them needs a single bind. Arrays can't grow, so each new array for the same kind of
+// texture has twice the layers of the last, which keeps the number of arrays logarithmic without knowing up front how
+// many textures are coming. Textures from the same file and options share a layer. Owns the arrays.
+//
+// Images keep the mip chain they come with (see LoadCompressedImage) or get one from GenerateMipmaps, and arrays start
+// out with only their small levels on the GPU. Each frame, request() says how large a texture is on screen, and
+// update() streams in the levels that are needed from the images, which are kept (cooked images only map their file, so
+// the levels are read from disk as they're touched). Everything shares 'budget' bytes of VRAM; when it's full, the
+// levels that went unused the longest are dropped first. All layers of an array share its mip range, so the array
+// follows its largest layer.
+class TextureArrays
+{
+public:
+    explicit TextureArrays(usize budget = usize(-1)) : budget(budget) {}
+    TextureArrays(const TextureArrays&) = delete;
+    TextureArrays& operator= (const TextureArrays&) = delete;
+    ~TextureArrays();
+
+    // Images that failed to load (without data) get 'fallback' instead.
+    TextureSlot add(const Image& image, TextureOptions options = {}, TextureSlot fallback = {});
+
+    // The texture covers about 'footprint' pixels across on screen this frame.
+    void request(TextureSlot slot, f32 footprint);
+
+    // Streams in requested levels until 'frame_budget' bytes went up this frame (a level isn't split, so the last one
+    // may go over), evicting others if the VRAM budget calls for it. Call once per frame, after the requests.
+    StreamingStats update(usize frame_budget);
+
+    [[nodiscard]] usize texture_count() const noexcept { return this->textures; }
+    [[nodiscard]] usize array_count()   const noexcept { return this->arrays.size(); }
+
+private:
+    struct Array
+    {
+        GpuTexture texture = {};
+        usize  bytes      = 0;     // On the GPU, of all layers.
+        GLint  layers     = 0;
+        GLint  used       = 0;
+        TextureFormat        format = {};
+        TextureOptions::Type type   = TextureOptions::Type::DIFFUSE;
+        int    levels     = 1;
+        int    base_level = 0;     // Levels on the GPU are [base_level, levels).
+        int    tail       = 0;     // Levels from here on are always on the GPU.
+        int    wanted     = 0;     // Largest level requested this frame.
+        usize  last_used  = 0;     // Frame of the last request.
+        std::vector<ImageLevel> sizes  = {};   // Of one layer, on the GPU.
+        std::vector<Image>      images = {};   // Per layer, to stream from.
+    };
+
+    void allocate_level(Array& array, int level);
+    void free_level(Array& array, int level);
+    void upload_level(const Array& array, GLint layer, const Image& image, int level);
+
+    std::unordered_map<std::string, std::vector<usize>> arrays_of;  // Keyed by size, format and options.
+    std::unordered_map<std::string, TextureSlot>        slots;      // Keyed by path and options.
+    std::unordered_map<GLuint, usize>                   index_of;
+    std::vector<Array>                                  arrays;
+    usize                                               textures = 0;
+    usize                                               budget   = 0;
+    usize                                               resident = 0;
+    usize                                               frame    = 1;
+};
+
+
+// What the image and texture caches have saved so far.
+struct ResidencyStats
+{
+    usize images_decoded      = 0;
+    usize images_shared       = 0;   // Loads served from memory.
+    usize image_bytes_saved   = 0;
+    usize image_bytes_live    = 0;   // Decoded pixels still in memory.
+    usize textures_created    = 0;
+    usize textures_shared     = 0;   // AcquireTexture2D calls served by an existing texture.
+    usize texture_bytes_saved = 0;   // Base level only.
+};
+
+ResidencyStats GetResidencyStats();
+void ReportResidency();
+// Counts a copy of 'image' that was handed out again instead of being loaded, like from_path counts its cache hits.
+void CountSharedImage(const Image& image);
+
+
+// Texture memory allocated by CreateTexture2D and TextureArrays, per TextureOptions::Type. Drivers may pad RGB to RGBA
+// and add some alignment, so it's a lower bound.
+struct TextureMemory
+{
+    usize bytes[usize(TextureOptions::Type::COUNT)] = {};
+
+    [[nodiscard]] usize total() const noexcept
+    {
+        usize total = 0;
+        for (const auto bytes : this->bytes)
+            total += bytes;
+        return total;
+    }
+};
+
+TextureMemory GetTextureMemory();
+void ReportTextureMemory();
\ No newline at end of file
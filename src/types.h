@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
 
 using u8  = std::uint8_t;
 using u16 = std::uint16_t;
@@ -15,5 +16,5 @@ using s64 = std::int64_t;
 using f32 = float;
 using f64 = double;
 
-using ssize = std::ssize_t;
+using ssize = std::ptrdiff_t;
 using usize = std::size_t;
\ No newline at end of file
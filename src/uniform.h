@@ -0,0 +1,26 @@
+#pragma once
+
+#include <type_traits>
+
+#include "types.h"
+
+
+// A uniform, named by the FNV-1a hash of its name. Finding it is a scan over a shader's few hashes instead of building
+// a std::string and probing a map. Make them with UNIFORM, so the hash is computed when compiling.
+struct UniformId
+{
+    u32         hash;
+    const char* name;   // Only for messages.
+
+    static constexpr u32 Hash(const char* name, usize length) noexcept
+    {
+        u32 hash = 2166136261u;
+        for (usize i = 0; i < length; ++i)
+            hash = (hash ^ u8(name[i])) * 16777619u;
+        return hash;
+    }
+};
+
+// NOTE(ted): The hash goes through a template argument since that's the only way to be sure it isn't left to run time.
+//  Pasting "" in front makes anything but a string literal an error, rather than hashing the bytes of a pointer.
+#define UNIFORM(name) (UniformId { std::integral_constant<u32, UniformId::Hash("" name, sizeof("" name) - 1)>::value, name })
@@ -1,6 +1,12 @@
 #include "utils.h"
 
 #include <fstream>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "debug.h"
 
@@ -27,3 +33,66 @@ std::unique_ptr<char> LoadFileToString(const char* path)
 
     return std::move(buffer);
 }
+
+
+FileInfo GetFileInfo(const std::string& path)
+{
+    struct stat info {};
+    if (stat(path.data(), &info) != 0)
+        return {};
+
+    return { true, u64(info.st_size), s64(info.st_mtime) };
+}
+
+
+MappedFile::~MappedFile()
+{
+    if (this->data)
+        munmap((void*) this->data, this->size);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data{std::exchange(other.data, nullptr)}, size{std::exchange(other.size, 0)}
+{
+}
+
+MappedFile& MappedFile::operator= (MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (this->data)
+            munmap((void*) this->data, this->size);
+
+        this->data = std::exchange(other.data, nullptr);
+        this->size = std::exchange(other.size, 0);
+    }
+    return *this;
+}
+
+MappedFile MappedFile::open(const std::string& path)
+{
+    MappedFile file;
+
+    int descriptor = ::open(path.data(), O_RDONLY);
+    if (descriptor == -1)
+        return file;
+
+    struct stat info {};
+    if (fstat(descriptor, &info) == 0 && info.st_size > 0)
+    {
+        void* data = mmap(nullptr, usize(info.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (data != MAP_FAILED)
+        {
+            file.data = (const u8*) data;
+            file.size = usize(info.st_size);
+        }
+        else
+        {
+            WARNING("Couldn't map file '%s'.", path.data());
+        }
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    close(descriptor);
+    return file;
+}
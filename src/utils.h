@@ -1,5 +1,59 @@
 #pragma once
 
 #include <iostream>
+#include <memory>
+#include <string>
 
-std::unique_ptr<char> LoadFileToString(const char* path);
\ No newline at end of file
+#include "types.h"
+
+std::unique_ptr<char> LoadFileToString(const char* path);
+
+
+// FNV-1a. Good enough for detecting changed files, not for anything adversarial.
+constexpr u64 FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+constexpr u64 FNV_PRIME        = 0x00000100000001b3ull;
+
+constexpr u64 HashBytes(const char* data, usize size, u64 hash = FNV_OFFSET_BASIS)
+{
+    for (usize i = 0; i < size; ++i)
+        hash = (hash ^ u64(u8(data[i]))) * FNV_PRIME;
+    return hash;
+}
+
+
+struct FileInfo
+{
+    bool exists   = false;
+    u64  size     = 0;
+    s64  modified = 0;   // Seconds since epoch.
+};
+FileInfo GetFileInfo(const std::string& path);
+
+
+// Read-only memory mapping of a whole file. Move-only; the mapping is released on destruction.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator= (const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator= (MappedFile&& other) noexcept;
+
+    static MappedFile open(const std::string& path);
+
+    const u8* data = nullptr;
+    usize     size = 0;
+
+    explicit operator bool() const noexcept { return data; }
+};
+
+// Whether 'count' items of 'size' bytes from 'offset' end within 'limit', without overflowing on garbage. For checking
+// the tables of a file before reading them.
+constexpr bool FitsIn(u64 offset, u64 count, u64 size, u64 limit)
+{
+    return offset <= limit && count <= (limit - offset) / size;
+}